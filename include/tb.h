@@ -595,20 +595,40 @@ extern "C" {
         TB_Reg old_value;
     } TB_CmpXchgResult;
 
+    typedef struct TB_LoopExit {
+        // from is inside the loop, to isn't
+        TB_Label from, to;
+    } TB_LoopExit;
+
     typedef struct TB_Loop {
-        // refers to another entry in TB_LoopInfo... unless it's -1
+        // refers to another entry in TB_LoopInfo... unless it's -1, parents
+        // always come before their children.
         ptrdiff_t parent_loop;
 
+        // outermost loops are 1 deep
+        int depth;
+
         TB_Label header;
+        // one of the blocks which branch back to the header
         TB_Label backedge;
 
+        // every block in the loop (nested loops included) sorted by label
         size_t body_count;
         TB_Label* body;
+
+        // edges leaving the loop
+        size_t exit_count;
+        TB_LoopExit* exits;
     } TB_Loop;
 
     typedef struct TB_LoopInfo {
         size_t count;
         TB_Loop* loops;
+
+        // innermost loop for each block (-1 if it's not in one) and how
+        // many loops deep it is.
+        int* block_loop;
+        int* block_depth;
     } TB_LoopInfo;
 
     typedef struct TB_Predeccesors {
@@ -616,11 +636,38 @@ extern "C" {
         TB_Label** preds;
     } TB_Predeccesors;
 
+    // Compact control flow graph, the successors of block i are
+    // succ[succ_start[i] .. succ_start[i + 1]) and the same goes for the
+    // predecessors. An edge shows up once per terminator operand so an IF
+    // with the same label on both sides lists it twice.
+    typedef struct TB_CFG {
+        size_t block_count, edge_count;
+
+        // succ_start & pred_start have block_count + 1 entries
+        int* succ_start;
+        TB_Label* succ;
+
+        int* pred_start;
+        TB_Label* pred;
+    } TB_CFG;
+
     typedef struct TB_DominanceFrontiers {
         int* count;
         TB_Label** _;
     } TB_DominanceFrontiers;
 
+    typedef struct TB_DominatorTree {
+        size_t count;
+
+        // immediate dominator for each label, the entry is its own dominator
+        TB_Label* idom;
+
+        // DFS numbering of the dominator tree, A dominates B if B's pre and
+        // post numbers are nested within A's.
+        int* pre;
+        int* post;
+    } TB_DominatorTree;
+
     typedef enum {
         TB_OBJECT_RELOC_NONE, // how?
 
@@ -795,8 +842,35 @@ extern "C" {
     // returns false if it fails.
     TB_API bool tb_module_compile_function(TB_Module* m, TB_Function* f, TB_ISelMode isel_mode);
 
+    // compiles all the functions which haven't been compiled yet using thread_count
+    // worker threads (the calling thread is one of them), big functions are started
+    // first and idle workers steal from the others. The output doesn't depend on the
+    // thread count.
+    //
+    // returns false if any of the functions failed.
+    TB_API bool tb_module_compile_all(TB_Module* m, TB_ISelMode isel_mode, int thread_count);
+
     TB_API size_t tb_module_get_function_count(TB_Module* m);
 
+    typedef struct TB_ModuleStats {
+        // threads which have touched the module
+        size_t thread_count;
+
+        size_t function_count;
+        size_t compiled_function_count;
+
+        // relocation buffers, count is the patches in use and
+        // bytes is how much memory is reserved for them.
+        size_t symbol_patch_count, symbol_patch_bytes;
+        size_t const_patch_count, const_patch_bytes;
+
+        // functions which came out of the code cache and ones which went into it
+        size_t code_cache_hits, code_cache_misses;
+    } TB_ModuleStats;
+
+    // it's only accurate while no other thread is working on the module
+    TB_API TB_ModuleStats tb_module_get_stats(TB_Module* m);
+
     // Frees all resources for the TB_Module and it's functions, globals and
     // compiled code.
     TB_API void tb_module_destroy(TB_Module* m);
@@ -806,6 +880,26 @@ extern "C" {
     // dont and the tls_index is used, it'll crash
     TB_API void tb_module_set_tls_index(TB_Module* m, TB_Symbol* e);
 
+    ////////////////////////////////
+    // Code cache
+    ////////////////////////////////
+    typedef struct TB_CodeCache TB_CodeCache;
+
+    // on-disk cache of compiled functions, entries are keyed by the function's IR, the
+    // target, feature set, isel mode & TB version. Any number of threads & processes can
+    // share a directory (writes go through a rename), once it's bigger than max_size bytes
+    // the least recently used entries are deleted. max_size = 0 picks 256MiB.
+    //
+    // NOTE: the code is loaded as is, whoever can write to dir can put code in your JIT.
+    //
+    // returns NULL if the directory can't be made.
+    TB_API TB_CodeCache* tb_code_cache_open(const char* dir, uint64_t max_size);
+    TB_API void tb_code_cache_close(TB_CodeCache* cache);
+
+    // tb_module_compile_function (and everything which goes through it) checks the cache
+    // before compiling & fills it after. The cache has to outlive the module.
+    TB_API void tb_module_set_code_cache(TB_Module* m, TB_CodeCache* cache);
+
     ////////////////////////////////
     // Exporter
     ////////////////////////////////
@@ -828,7 +922,8 @@ extern "C" {
     TB_API TB_Exports tb_exporter_write_output(TB_Module* m, TB_OutputFlavor flavor, TB_DebugFormat debug_fmt);
     TB_API void tb_exporter_free(TB_Exports exports);
 
-    // Same as tb_exporter_write_output except it doesn't return the buffers and instead writes to the filepaths provided (using the C FILE IO)
+    // Same as tb_exporter_write_output except it doesn't return the buffers and instead writes to the filepaths provided,
+    // ELF objects are streamed out without being put together in memory first (the rest use the C FILE IO).
     // Returns true on success
     TB_API bool tb_exporter_write_files(TB_Module* m, TB_OutputFlavor flavor, TB_DebugFormat debug_fmt, size_t path_count, const char* paths[]);
 
@@ -837,10 +932,105 @@ extern "C" {
     ////////////////////////////////
     typedef struct TB_JITContext TB_JITContext;
 
-    // passing 0 to jit_heap_capacity will default to 4MiB
+    // links every compiled function along with the constants, globals and TLS
+    // template into executable memory (W^X), afterwards tb_function_get_jit_pos
+    // gives callable pointers until tb_module_end_jit. The module must've been made
+    // with is_jit and externals are called through an import table so they should be
+    // bound with tb_symbol_bind_ptr first.
+    //
+    // jit_heap_capacity is how much the JIT heap maps at a time (it grows as needed),
+    // passing 0 will default to 4MiB
     TB_API TB_JITContext* tb_module_begin_jit(TB_Module* m, size_t jit_heap_capacity);
+
+    // same as tb_module_begin_jit except the functions which haven't been compiled yet
+    // start off as stubs, the first call compiles (with isel_mode) & links it and every
+    // call after that goes straight to the code.
+    TB_API TB_JITContext* tb_module_begin_lazy_jit(TB_Module* m, size_t jit_heap_capacity, TB_ISelMode isel_mode);
+
+    typedef struct TB_JITTiering {
+        // calls before a function counts as hot, zero picks a default
+        uint32_t threshold;
+
+        // function level passes (and below) which run before the recompile
+        size_t pass_count;
+        const struct TB_Pass* passes;
+
+        // for the recompile, TB_ISEL_COMPLEX once the target's complex path can take it
+        TB_ISelMode isel_mode;
+    } TB_JITTiering;
+
+    // lazy JIT where the functions are compiled with TB_ISEL_FAST on their first call
+    // and then count their calls, once they're hot they get optimized and recompiled
+    // on a background thread and swapped in. The tier 0 code is retired like with
+    // tb_jit_redefine so tb_jit_reclaim should be called now and then.
+    TB_API TB_JITContext* tb_module_begin_tiered_jit(TB_Module* m, size_t jit_heap_capacity, const TB_JITTiering* tiering);
     TB_API void tb_module_end_jit(TB_JITContext* jit);
 
+    typedef enum TB_JITProfiling {
+        // /tmp/perf-<pid>.map, names & address ranges
+        TB_JIT_PERF_MAP = 1,
+
+        // /tmp/jit-<pid>.dump, names, code bytes & line info. It's meant for
+        // perf record -k mono followed by perf inject --jit.
+        TB_JIT_JITDUMP  = 2,
+
+        // registers in-memory ELF objects (symbols & unwind info) through the GDB
+        // JIT interface (__jit_debug_register_code) so gdb & lldb can see the code.
+        TB_JIT_GDB      = 4,
+    } TB_JITProfiling;
+
+    // opt-in, every function the JITs from here on place (lazy compiles, tier ups and
+    // tb_jit_redefine included) gets written out so perf can tell what it's looking at.
+    TB_API void tb_module_set_jit_profiling(TB_Module* m, TB_JITProfiling flags);
+
+    // with TB_JIT_GDB the functions linked after tb_module_begin_jit are registered
+    // in batches, this registers whatever's waiting on the next one.
+    TB_API void tb_jit_flush_debug_info(TB_JITContext* jit);
+
+    // TLS globals are accessed through the tls_index (see tb_module_set_tls_index),
+    // the host is expected to give each thread a copy of this template there.
+    TB_API void* tb_jit_get_tls_template(TB_JITContext* jit, size_t* out_size);
+
+    // functions are called through a patchable entry (that's what tb_function_get_jit_pos
+    // points to) so they can be replaced while other threads keep running. new_body is a
+    // function compiled after tb_module_begin_jit, it gets linked on its own and swapped
+    // into f's entry. The old code stays alive until tb_jit_reclaim is given the epoch
+    // this returns, which the user should only do once no thread could be running it.
+    TB_API uint64_t tb_jit_redefine(TB_JITContext* jit, TB_Function* f, TB_Function* new_body);
+    TB_API void tb_jit_reclaim(TB_JITContext* jit, uint64_t epoch);
+
+    // the epoch of the latest code to be retired, once every thread has been somewhere
+    // quiet after this was read it's safe to pass to tb_jit_reclaim.
+    TB_API uint64_t tb_jit_get_epoch(TB_JITContext* jit);
+
+    ////////////////////////////////
+    // JIT snapshots
+    ////////////////////////////////
+    typedef struct TB_JITSnapshot TB_JITSnapshot;
+
+    // links every compiled function (like tb_module_begin_jit) along with the constants,
+    // globals & TLS template into a file which another process can map and run without
+    // building the module. Only the externals are resolved at load, the rest is a handful
+    // of absolute addresses which get the image's address added to them.
+    //
+    // every function should only have been compiled once (tier ups are compiled twice)
+    // and the tls_index can't be used. Returns false if the file couldn't be written.
+    TB_API bool tb_module_write_jit_snapshot(TB_Module* m, const char* path);
+
+    // gives back the address of the external, NULL if there isn't one (calling it will crash)
+    typedef void* TB_JITResolver(void* user_data, const char* name);
+
+    // NOTE: like the code cache, the code is run as is so only load snapshots you trust.
+    //
+    // returns NULL if the file can't be read or it wasn't written by this version of TB.
+    TB_API TB_JITSnapshot* tb_jit_snapshot_load(const char* path, TB_JITResolver* resolve, void* user_data);
+    TB_API void tb_jit_snapshot_unload(TB_JITSnapshot* snap);
+
+    // named functions & globals, the functions are called through the same kind of
+    // entry tb_function_get_jit_pos gives. NULL if it's not there.
+    TB_API void* tb_jit_snapshot_get_symbol(TB_JITSnapshot* snap, const char* name);
+    TB_API void* tb_jit_snapshot_get_tls_template(TB_JITSnapshot* snap, size_t* out_size);
+
     #define TB_FOR_FUNCTIONS(it, module) for (TB_Function* it = tb_first_function(module); it != NULL; it = tb_next_function(it))
     TB_API TB_Function* tb_first_function(TB_Module* m);
     TB_API TB_Function* tb_next_function(TB_Function* f);
@@ -859,7 +1049,8 @@ extern "C" {
     // about to be killed :p), not calling it can only result in leaks on that thread
     // and calling it too early will result in TB potentially reallocating it but there's
     // should be no crashes from this, just potential slowdown or higher than expected memory
-    // usage.
+    // usage. It also gives back the thread's slot so the next thread to use TB can take it
+    // over, short-lived thread pools should call it before their threads exit.
     TB_API void tb_free_thread_resources(void);
 
     ////////////////////////////////
@@ -873,6 +1064,17 @@ extern "C" {
     // matching signatures.
     TB_API TB_FunctionPrototype* tb_prototype_create(TB_Module* m, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, int num_params, bool has_varargs);
 
+    typedef struct TB_PrototypeParam {
+        TB_DataType dt;
+        const char* name;
+        TB_DebugType* debug_type;
+    } TB_PrototypeParam;
+
+    // same as tb_prototype_create followed by tb_prototype_add_param_named for each
+    // param except the prototypes are hash-consed, asking for the same signature twice
+    // gives back the same prototype. They're shared so they can't be modified.
+    TB_API const TB_FunctionPrototype* tb_prototype_get(TB_Module* m, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, size_t num_params, const TB_PrototypeParam* params, bool has_varargs);
+
     // adds a parameter to the function prototype, TB doesn't support struct
     // parameters so the frontend must lower them to pointers or any other type
     // depending on their preferred ABI.
@@ -1185,6 +1387,15 @@ extern "C" {
     ////////////////////////////////
     // Optimizer
     ////////////////////////////////
+    // analyses cached on each function, passes list the ones they keep valid
+    typedef enum TB_AnalysisKind {
+        TB_ANALYSIS_PREDS = 1u << 0,
+        TB_ANALYSIS_DOMS  = 1u << 1,
+        TB_ANALYSIS_LOOPS = 1u << 2,
+
+        TB_ANALYSIS_ALL = TB_ANALYSIS_PREDS | TB_ANALYSIS_DOMS | TB_ANALYSIS_LOOPS,
+    } TB_AnalysisKind;
+
     typedef struct TB_Pass {
         // the pass modes tell us what things the pass can modify
         // and what it's being scheduled to run on
@@ -1206,6 +1417,10 @@ extern "C" {
         } mode;
         const char* name;
 
+        // TB_AnalysisKind bits which stay valid after the pass reports changes,
+        // anything else is thrown away. zero means it might've touched the CFG.
+        uint32_t preserves;
+
         // if l_state is not NULL, it'll run the lua function described
         void* l_state;
         union {
@@ -1216,8 +1431,11 @@ extern "C" {
         };
     } TB_Pass;
 
-    // Applies optimizations to the entire module
-    TB_API bool tb_module_optimize(TB_Module* m, size_t pass_count, const TB_Pass passes[]);
+    // Applies optimizations to the entire module, function level passes (and below)
+    // are split across thread_count worker threads between the module level passes.
+    // A thread_count of 1 or less will run everything on the calling thread, either
+    // way the results are the same.
+    TB_API bool tb_module_optimize(TB_Module* m, size_t pass_count, const TB_Pass passes[], int thread_count);
 
     #ifdef TB_USE_LUAJIT
     TB_API TB_Pass tb_opt_load_lua_pass(const char* path, enum TB_PassMode mode);
@@ -1225,7 +1443,16 @@ extern "C" {
     #endif
 
     // analysis
+    // built in one pass over the terminators, unlike the predecessors from
+    // tb_get_cfg the entry block never has predecessors here.
+    //
+    // Allocates from the heap and requires freeing with tb_free_predeccesors
     TB_API TB_Predeccesors tb_get_predeccesors(TB_Function* f);
+    TB_API void tb_free_predeccesors(TB_Predeccesors* preds);
+
+    // Allocates from the heap and requires freeing with tb_free_cfg
+    TB_API TB_CFG tb_get_cfg(TB_Function* f);
+    TB_API void tb_free_cfg(TB_CFG* cfg);
     TB_API TB_DominanceFrontiers tb_get_dominance_frontiers(TB_Function* f, TB_Predeccesors p, const TB_Label* doms);
     TB_API void tb_free_dominance_frontiers(TB_Function* f, TB_DominanceFrontiers* frontiers);
 
@@ -1249,11 +1476,28 @@ extern "C" {
 
     // if out_doms is NULL it'll only return the dominator array length (it's just the label count really)
     TB_API size_t tb_get_dominators(TB_Function* f, TB_Predeccesors p, TB_Label* out_doms);
-    TB_API bool tb_is_dominated_by(TB_Label* doms, TB_Label expected_dom, TB_Label bb);
 
-    TB_API TB_LoopInfo tb_get_loop_info(TB_Function* f, TB_Predeccesors preds, TB_Label* doms);
+    // Allocates from the heap and requires freeing with tb_free_dominator_tree
+    TB_API TB_DominatorTree tb_get_dominator_tree(TB_Function* f, TB_Predeccesors p);
+    TB_API void tb_free_dominator_tree(TB_DominatorTree* tree);
+
+    // constant time, unreachable blocks are treated as children of the entry
+    TB_API bool tb_is_dominated_by(const TB_DominatorTree* tree, TB_Label expected_dom, TB_Label bb);
+
+    TB_API TB_LoopInfo tb_get_loop_info(TB_Function* f, TB_Predeccesors preds, const TB_DominatorTree* doms);
     TB_API void tb_free_loop_info(TB_LoopInfo loops);
 
+    // Cached versions of the analyses above, they're owned by the function and stay
+    // around until the CFG is modified or a pass which doesn't preserve them reports
+    // changes. Don't free the results, and don't hold onto them across CFG edits.
+    TB_API const TB_Predeccesors* tb_function_get_cached_preds(TB_Function* f);
+    TB_API const TB_DominatorTree* tb_function_get_cached_doms(TB_Function* f);
+    TB_API const TB_LoopInfo* tb_function_get_cached_loops(TB_Function* f);
+
+    // throws away every cached analysis not in preserved (TB_AnalysisKind bits),
+    // the ones which depend on a discarded analysis go with it.
+    TB_API void tb_function_invalidate_analyses(TB_Function* f, uint32_t preserved);
+
     ////////////////////////////////
     // Transformation pass library
     ////////////////////////////////
@@ -15,8 +15,6 @@
 static_assert(sizeof(float) == sizeof(uint32_t), "lil bitch... float gotta be 32bit");
 static_assert(sizeof(double) == sizeof(uint64_t), "big bitch... double gotta be 64bit");
 
-static thread_local size_t s_local_thread_id;
-
 #if 0
 #define LISTING(...) printf(__VA_ARGS__)
 #else
@@ -526,8 +524,7 @@ static void GAD_FN(eval_bb)(Ctx* restrict ctx, TB_Function* f, TB_Label bb, TB_L
     ctx->flags_bound = 0;
 }
 
-static TB_FunctionOutput GAD_FN(compile_function)(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity, size_t local_thread_id) {
-    s_local_thread_id = local_thread_id;
+static TB_FunctionOutput GAD_FN(compile_function)(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity) {
     TB_TemporaryStorage* tls = tb_tls_allocate();
     TB_Predeccesors preds = tb_get_temp_predeccesors(f, tls);
 
@@ -556,7 +553,7 @@ static TB_FunctionOutput GAD_FN(compile_function)(TB_Function* restrict f, const
         };
 
         f->line_count = 0;
-        f->lines = tb_platform_arena_alloc(tally.line_info_count * sizeof(TB_Line));
+        f->lines = tb__arena_alloc(f->super.module, tally.line_info_count * sizeof(TB_Line));
 
         memset(ctx->values, 0, f->node_count * sizeof(GAD_VAL));
     }
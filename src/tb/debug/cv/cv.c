@@ -164,8 +164,8 @@ static TB_SectionGroup codeview_generate_debug_info(TB_Module* m, TB_TemporarySt
     sections[1] = (TB_ObjectSection){ gimme_cstr_as_slice(".debug$T") };
 
     size_t global_count = 0;
-    FOREACH_N(i, 0, m->max_threads) {
-        global_count += pool_popcount(m->thread_info[i].globals);
+    TB_FOR_THREAD_INFO(info, m) {
+        global_count += pool_popcount(info->globals);
     }
 
     // debug$S does quite a few relocations :P, namely saying that
@@ -370,8 +370,8 @@ static TB_SectionGroup codeview_generate_debug_info(TB_Module* m, TB_TemporarySt
             tb_out2b(&debugs_out, 0);
         }
 
-        FOREACH_N(i, 0, m->max_threads) {
-            pool_for(TB_Global, g, m->thread_info[i].globals) {
+        TB_FOR_THREAD_INFO(info, m) {
+            pool_for(TB_Global, g, info->globals) {
                 const char* name = g->super.name;
                 size_t name_len = strlen(g->super.name) + 1;
                 CV_TypeIndex type = g->dbg_type ? convert_to_codeview_type(&builder, g->dbg_type) : T_VOID;
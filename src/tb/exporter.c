@@ -5,6 +5,9 @@
 TB_Exports tb_ ## name ## _write_output(TB_Module* restrict m, const IDebugFormat* dbg);
 #include "objects/export_formats.h"
 
+// these stream straight into the file
+bool tb_elf64obj_write_file(TB_Module* restrict m, const IDebugFormat* dbg, const char* path);
+
 static const IDebugFormat* find_debug_format(TB_DebugFormat debug_fmt) {
     switch (debug_fmt) {
         //case TB_DEBUGFMT_DWARF: return &tb__dwarf_debug_format;
@@ -39,6 +42,16 @@ TB_API TB_Exports tb_exporter_write_output(TB_Module* m, TB_OutputFlavor flavor,
 }
 
 TB_API bool tb_exporter_write_files(TB_Module* m, TB_OutputFlavor flavor, TB_DebugFormat debug_fmt, size_t path_count, const char* paths[]) {
+    // no buffer holding the whole object, the code is written from where it was compiled
+    if (flavor == TB_FLAVOR_OBJECT && m->target_system == TB_SYSTEM_LINUX && path_count >= 1) {
+        if (!tb_elf64obj_write_file(m, find_debug_format(debug_fmt), paths[0])) {
+            fprintf(stderr, "tb_exporter_write_files: Could not write file! %s\n", paths[0]);
+            return false;
+        }
+
+        return true;
+    }
+
     TB_Exports exports = tb_exporter_write_output(m, flavor, debug_fmt);
     if (exports.count > path_count) {
         fprintf(stderr, "tb_exporter_write_files: Not enough filepaths for the exports (provided %zu, needed %zu)\n", path_count, exports.count);
@@ -109,13 +109,13 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
 
     size_t text_section_size = tb_helper_get_text_section_layout(m, function_sym_start);
     size_t unique_id_counter = 0;
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_External, ext, m->thread_info[i].externals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
             ext->super.symbol_id = external_sym_start + unique_id_counter;
             unique_id_counter += 1;
         }
 
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+        pool_for(TB_Global, g, info->globals) {
             g->super.symbol_id = external_sym_start + unique_id_counter;
             unique_id_counter += 1;
         }
@@ -132,8 +132,8 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
     // create headers
     ////////////////////////////////
     size_t num_of_relocs[S_MAX] = { 0 };
-    FOREACH_N(t, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[t].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             TB_Initializer* init = g->init;
             FOREACH_N(k, 0, init->obj_count) {
                 num_of_relocs[S_DATA] += (init->objects[k].type != TB_INIT_OBJ_REGION);
@@ -230,9 +230,9 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
     // relocation
     {
         num_of_relocs[S_TEXT] = 0;
-        FOREACH_N(i, 0, m->max_threads) {
-            num_of_relocs[S_TEXT] += dyn_array_length(m->thread_info[i].const_patches);
-            num_of_relocs[S_TEXT] += dyn_array_length(m->thread_info[i].symbol_patches);
+        TB_FOR_THREAD_INFO(info, m) {
+            num_of_relocs[S_TEXT] += TB_PATCH_LIVE_COUNT(info->const_patches);
+            num_of_relocs[S_TEXT] += TB_PATCH_LIVE_COUNT(info->symbol_patches);
         }
         num_of_relocs[S_TEXT] -= local_patch_count;
     }
@@ -284,13 +284,13 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
         if (name_len >= 8) string_table_size += name_len + 1;
     }
 
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_External, ext, m->thread_info[i].externals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
             size_t name_len = strlen(ext->super.name);
             if (name_len >= 8) string_table_size += name_len + 1;
         }
 
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+        pool_for(TB_Global, g, info->globals) {
             size_t name_len = strlen(g->super.name);
             if (name_len >= 8) string_table_size += name_len + 1;
         }
@@ -344,8 +344,8 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
             uint8_t* tls = &output[e->write_pos];
             e->write_pos += m->tls_region_size;
 
-            FOREACH_N(i, 0, m->max_threads) {
-                pool_for(TB_Global, g, m->thread_info[i].globals) {
+            TB_FOR_THREAD_INFO(info, m) {
+                pool_for(TB_Global, g, info->globals) {
                     if (g->storage != TB_STORAGE_TLS) continue;
 
                     TB_Initializer* init = g->init;
@@ -377,9 +377,8 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
             };
 
             assert(e->write_pos == sections[S_TEXT].pointer_to_reloc);
-            FOREACH_N(i, 0, m->max_threads) {
-                dyn_array_for(j, m->thread_info[i].const_patches) {
-                    TB_ConstPoolPatch* p = &m->thread_info[i].const_patches[j];
+            TB_FOR_THREAD_INFO(info, m) {
+                TB_FOR_PATCHES(TB_ConstPoolPatch, p, info->const_patches) {
                     TB_FunctionOutput* out_f = p->source->output;
 
                     size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos;
@@ -391,8 +390,7 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
                     TB_FIXED_ARRAY_APPEND(relocs, r);
                 }
 
-                dyn_array_for(j, m->thread_info[i].symbol_patches) {
-                    TB_SymbolPatch* p = &m->thread_info[i].symbol_patches[j];
+                TB_FOR_PATCHES(TB_SymbolPatch, p, info->symbol_patches) {
                     TB_FunctionOutput* out_f = p->source->output;
 
                     size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos;
@@ -434,8 +432,8 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
             };
 
             assert(e->write_pos == sections[S_DATA].pointer_to_reloc);
-            FOREACH_N(i, 0, m->max_threads) {
-                pool_for(TB_Global, g, m->thread_info[i].globals) {
+            TB_FOR_THREAD_INFO(info, m) {
+                pool_for(TB_Global, g, info->globals) {
                     TB_Initializer* init = g->init;
 
                     FOREACH_N(k, 0, init->obj_count) {
@@ -635,8 +633,8 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
                 symbols[count++].s = sym;
             }
 
-            FOREACH_N(i, 0, m->max_threads) {
-                pool_for(TB_External, ext, m->thread_info[i].externals) {
+            TB_FOR_THREAD_INFO(info, m) {
+                pool_for(TB_External, ext, info->externals) {
                     COFF_Symbol sym = {
                         .value = 0,
                         .section_number = 0,
@@ -660,7 +658,7 @@ TB_API TB_Exports tb_coff_write_output(TB_Module* m, const IDebugFormat* dbg) {
                     symbols[count++].s = sym;
                 }
 
-                pool_for(TB_Global, g, m->thread_info[i].globals) {
+                pool_for(TB_Global, g, info->globals) {
                     bool is_extern = g->linkage == TB_LINKAGE_PUBLIC;
                     COFF_Symbol sym = {
                         .value = g->pos,
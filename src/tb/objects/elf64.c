@@ -29,6 +29,35 @@ static void put_symbol(TB_Emitter* strtbl, TB_Emitter* stab, const char* name, u
     tb_outs(stab, sizeof(Elf64_Sym), (uint8_t*)&sym);
 }
 
+static Elf64_Ehdr elf64_header(TB_Module* m, Elf64_Half type) {
+    uint16_t machine = 0;
+    switch (m->target_arch) {
+        case TB_ARCH_X86_64: machine = EM_X86_64; break;
+        case TB_ARCH_AARCH64: machine = EM_AARCH64; break;
+        default: tb_todo();
+    }
+
+    return (Elf64_Ehdr){
+        .e_ident = {
+            [EI_MAG0]       = 0x7F, // magic number
+            [EI_MAG1]       = 'E',
+            [EI_MAG2]       = 'L',
+            [EI_MAG3]       = 'F',
+            [EI_CLASS]      = 2, // 64bit ELF file
+            [EI_DATA]       = 1, // little-endian
+            [EI_VERSION]    = 1, // 1.0
+            [EI_OSABI]      = 0,
+            [EI_ABIVERSION] = 0
+        },
+        .e_type = type,
+        .e_version = 1,
+        .e_machine = machine,
+        .e_entry = 0,
+        .e_flags = 0,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+    };
+}
+
 #define WRITE(data, length_) write_data(&e, output, length_, data)
 static void write_data(TB_ModuleExporter* restrict e, uint8_t* restrict output, size_t length, const void* data) {
     memcpy(output + e->write_pos, data, length);
@@ -40,7 +69,10 @@ static void zero_data(TB_ModuleExporter* restrict e, uint8_t* restrict output, s
     e->write_pos += length;
 }
 
-TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg) {
+// the object is put together as a list of pieces so the code can be written straight out
+// of each function's output. With a path it's streamed into the file, otherwise the pieces
+// are joined into one buffer which goes in *out.
+static bool elf64obj_write(TB_Module* m, const IDebugFormat* dbg, const char* path, TB_Exports* out) {
     // used by the sections array
     enum {
         S_NULL,
@@ -55,13 +87,11 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
         S_MAX
     };
 
-    TB_ModuleExporter e = { 0 };
-
     // tally up .data relocations
     /*uint32_t data_relocation_count = 0;
 
-    FOREACH_N(t, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[t].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             TB_Initializer* init = g->init;
             FOREACH_N(k, 0, init->obj_count) {
                 data_relocation_count += (init->objects[k].type != TB_INIT_OBJ_REGION);
@@ -81,8 +111,8 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
     }
 
     // TODO(NeGate): Doing all these iterations like this probably isn't good... speed up?
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             if (g->linkage != TB_LINKAGE_PUBLIC) {
                 g->super.symbol_id = unique_id_counter++;
             }
@@ -91,8 +121,8 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
 
     // public symbols need to fit at the end
     uint32_t first_nonlocal_symbol_id = unique_id_counter;
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             if (g->linkage == TB_LINKAGE_PUBLIC) {
                 g->super.symbol_id = unique_id_counter;
                 unique_id_counter += 1;
@@ -109,48 +139,19 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
         }
     }
 
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_External, ext, m->thread_info[i].externals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
             ext->super.address = (void*) (uintptr_t) unique_id_counter;
             unique_id_counter += 1;
         }
     }
 
-    uint16_t machine = 0;
-    switch (m->target_arch) {
-        case TB_ARCH_X86_64: machine = EM_X86_64; break;
-        case TB_ARCH_AARCH64: machine = EM_AARCH64; break;
-        default: tb_todo();
-    }
-
-    Elf64_Ehdr header = {
-        .e_ident = {
-            [EI_MAG0]       = 0x7F, // magic number
-            [EI_MAG1]       = 'E',
-            [EI_MAG2]       = 'L',
-            [EI_MAG3]       = 'F',
-            [EI_CLASS]      = 2, // 64bit ELF file
-            [EI_DATA]       = 1, // little-endian
-            [EI_VERSION]    = 1, // 1.0
-            [EI_OSABI]      = 0,
-            [EI_ABIVERSION] = 0
-        },
-        .e_type = ET_REL, // relocatable
-        .e_version = 1,
-        .e_machine = machine,
-        .e_entry = 0,
-
-        // section headers go at the end of the file
-        // and are filed in later.
-        .e_shoff = 0,
-        .e_flags = 0,
-
-        .e_ehsize = sizeof(Elf64_Ehdr),
-
-        .e_shentsize = sizeof(Elf64_Shdr),
-        .e_shnum     = S_MAX,
-        .e_shstrndx  = 1
-    };
+    // section headers go at the end of the file
+    // and are filed in later.
+    Elf64_Ehdr header = elf64_header(m, ET_REL);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum     = S_MAX;
+    header.e_shstrndx  = 1;
 
     Elf64_Shdr sections[S_MAX] = {
         [S_STRTAB] = {
@@ -223,14 +224,14 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
     // Target specific: resolve internal call patches
     size_t local_patch_count = code_gen->emit_call_patches(m);
 
-    FOREACH_N(i, 0, m->max_threads) {
-        sections[S_TEXT_REL].sh_size += dyn_array_length(m->thread_info[i].symbol_patches) * sizeof(Elf64_Rela);
-        sections[S_TEXT_REL].sh_size += dyn_array_length(m->thread_info[i].const_patches) * sizeof(Elf64_Rela);
+    TB_FOR_THREAD_INFO(info, m) {
+        sections[S_TEXT_REL].sh_size += TB_PATCH_LIVE_COUNT(info->symbol_patches) * sizeof(Elf64_Rela);
+        sections[S_TEXT_REL].sh_size += TB_PATCH_LIVE_COUNT(info->const_patches) * sizeof(Elf64_Rela);
     }
     sections[S_TEXT_REL].sh_size -= local_patch_count * sizeof(Elf64_Rela);
 
-    FOREACH_N(t, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[t].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             TB_Initializer* init = g->init;
             FOREACH_N(k, 0, init->obj_count) {
                 sections[S_DATA_REL].sh_size += (init->objects[k].type != TB_INIT_OBJ_REGION) * sizeof(Elf64_Rela);
@@ -256,8 +257,8 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
     }
 
     // static-linkage globals
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             if (g->linkage != TB_LINKAGE_PUBLIC) {
                 put_symbol(&strtbl, &stab, g->super.name, ELF64_ST_INFO(ELF64_STB_LOCAL, ELF64_STT_OBJECT), S_DATA, g->pos, 0);
             }
@@ -265,8 +266,8 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
     }
 
     // nonlocal globals
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             if (g->linkage == TB_LINKAGE_PUBLIC) {
                 put_symbol(&strtbl, &stab, g->super.name, ELF64_ST_INFO(ELF64_STB_GLOBAL, ELF64_STT_OBJECT), S_DATA, g->pos, 0);
             }
@@ -281,8 +282,8 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
         }
     }
 
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_External, external, m->thread_info[i].externals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, external, info->externals) {
             put_symbol(&strtbl, &stab, external->super.name, ELF64_ST_INFO(ELF64_STB_GLOBAL, 0), 0, 0, 0);
         }
     }
@@ -304,157 +305,162 @@ TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg
     header.e_shoff = output_size;
     output_size += S_MAX * sizeof(Elf64_Shdr);
 
-    // Allocate memory now
-    uint8_t* restrict output = tb_platform_heap_alloc(output_size);
-
-    // Write contents
-    {
-        WRITE(&header, sizeof(Elf64_Ehdr));
-        WRITE(strtbl.data, strtbl.count);
-
-        // TEXT section
-        e.write_pos = tb_helper_write_text_section(e.write_pos, m, output, sections[S_TEXT].sh_offset);
-
-        // TEXT patches
-        {
-            assert(e.write_pos == sections[S_TEXT_REL].sh_offset);
-
-            TB_FIXED_ARRAY(Elf64_Rela) relocs = {
-                .cap = sections[S_TEXT_REL].sh_size / sizeof(Elf64_Rela),
-                .elems = (Elf64_Rela*) &output[sections[S_TEXT_REL].sh_offset]
+    // TEXT patches
+    TB_FIXED_ARRAY(Elf64_Rela) text_relocs = {
+        .cap = sections[S_TEXT_REL].sh_size / sizeof(Elf64_Rela),
+        .elems = tb_platform_heap_alloc(sections[S_TEXT_REL].sh_size)
+    };
+
+    TB_FOR_THREAD_INFO(info, m) {
+        TB_FOR_PATCHES(TB_SymbolPatch, p, info->symbol_patches) {
+            size_t symbol_id = p->target->symbol_id;
+            assert(symbol_id != 0);
+
+            TB_FunctionOutput* out_f = p->source->output;
+            size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos;
+
+            if (p->target->tag == TB_SYMBOL_EXTERNAL) {
+                Elf64_Rela rela = {
+                    .r_offset = actual_pos,
+                    .r_info   = ELF64_R_INFO(symbol_id, p->is_function ? R_X86_64_PLT32 : R_X86_64_GOTPCREL),
+                    .r_addend = -4
+                };
+                TB_FIXED_ARRAY_APPEND(text_relocs, rela);
+            } else if (p->target->tag == TB_SYMBOL_GLOBAL) {
+                TB_Global* global = (TB_Global*) p->target;
+                ((void) global);
+                assert(global->super.tag == TB_SYMBOL_GLOBAL);
+                assert(global->storage == TB_STORAGE_DATA);
+
+                Elf64_Rela rela = {
+                    .r_offset = actual_pos,
+                    .r_info   = ELF64_R_INFO(symbol_id, R_X86_64_PC32),
+                    .r_addend = -4
+                };
+                TB_FIXED_ARRAY_APPEND(text_relocs, rela);
+            } else {
+                tb_todo();
+            }
+        }
+
+        TB_FOR_PATCHES(TB_ConstPoolPatch, p, info->const_patches) {
+            TB_FunctionOutput* out_f = p->source->output;
+
+            size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos;
+            Elf64_Rela rela = {
+                .r_offset = actual_pos,
+                .r_info   = ELF64_R_INFO(S_RODATA, R_X86_64_PC32),
+                .r_addend = -4
             };
+            TB_FIXED_ARRAY_APPEND(text_relocs, rela);
+        }
+    }
 
-            FOREACH_N(i, 0, m->max_threads) {
-                dyn_array_for(j, m->thread_info[i].symbol_patches) {
-                    TB_SymbolPatch* p = &m->thread_info[i].symbol_patches[j];
-                    size_t symbol_id = p->target->symbol_id;
-                    assert(symbol_id != 0);
+    // DATA section & patches, the addends are already in the data
+    uint8_t* data = tb_platform_heap_alloc(sections[S_DATA].sh_size);
+    tb_helper_write_data_section(0, m, data, 0);
 
-                    TB_FunctionOutput* out_f = p->source->output;
-                    size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos;
+    TB_FIXED_ARRAY(Elf64_Rela) data_relocs = {
+        .cap = sections[S_DATA_REL].sh_size / sizeof(Elf64_Rela),
+        .elems = tb_platform_heap_alloc(sections[S_DATA_REL].sh_size)
+    };
 
-                    if (p->target->tag == TB_SYMBOL_EXTERNAL) {
-                        Elf64_Rela rela = {
-                            .r_offset = actual_pos,
-                            .r_info   = ELF64_R_INFO(symbol_id, p->is_function ? R_X86_64_PLT32 : R_X86_64_GOTPCREL),
-                            .r_addend = -4
-                        };
-                        TB_FIXED_ARRAY_APPEND(relocs, rela);
-                    } else if (p->target->tag == TB_SYMBOL_GLOBAL) {
-                        TB_Global* global = (TB_Global*) p->target;
-                        ((void) global);
-                        assert(global->super.tag == TB_SYMBOL_GLOBAL);
-                        assert(global->storage == TB_STORAGE_DATA);
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
+            TB_Initializer* init = g->init;
+
+            FOREACH_N(k, 0, init->obj_count) {
+                size_t actual_pos = g->pos + init->objects[k].offset;
+
+                // load the addend from the buffer
+                uint64_t addend;
+                memcpy(&addend, &data[actual_pos], sizeof(addend));
+
+                switch (init->objects[k].type) {
+                    case TB_INIT_OBJ_RELOC_GLOBAL: {
+                        const TB_Global* g = init->objects[k].reloc_global;
 
                         Elf64_Rela rela = {
                             .r_offset = actual_pos,
-                            .r_info   = ELF64_R_INFO(symbol_id, R_X86_64_PC32),
-                            .r_addend = -4
+                            .r_info   = ELF64_R_INFO(g->super.symbol_id, R_X86_64_64),
+                            .r_addend = addend,
                         };
-                        TB_FIXED_ARRAY_APPEND(relocs, rela);
-                    } else {
-                        tb_todo();
+                        TB_FIXED_ARRAY_APPEND(data_relocs, rela);
+                        break;
                     }
-                }
 
-                FOREACH_N(j, 0, dyn_array_length(m->thread_info[i].const_patches)) {
-                    TB_ConstPoolPatch* p = &m->thread_info[i].const_patches[j];
-                    TB_FunctionOutput* out_f = p->source->output;
-
-                    size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos;
-                    Elf64_Rela rela = {
-                        .r_offset = actual_pos,
-                        .r_info   = ELF64_R_INFO(S_RODATA, R_X86_64_PC32),
-                        .r_addend = -4
-                    };
-                    TB_FIXED_ARRAY_APPEND(relocs, rela);
-                }
-            }
-
-            WRITE(relocs.elems, relocs.count * sizeof(Elf64_Rela));
-        }
-
-        e.write_pos = tb_helper_write_data_section(e.write_pos, m, output, sections[S_DATA].sh_offset);
-
-        // write DATA patches
-        {
-            assert(e.write_pos == sections[S_DATA_REL].sh_offset);
-            uint8_t* data = &output[sections[S_DATA].sh_offset];
-            TB_FIXED_ARRAY(Elf64_Rela) relocs = {
-                .cap = sections[S_TEXT_REL].sh_size / sizeof(Elf64_Rela),
-                .elems = (Elf64_Rela*) &output[sections[S_DATA_REL].sh_offset]
-            };
+                    case TB_INIT_OBJ_RELOC_EXTERN: {
+                        const TB_External* ext = init->objects[k].reloc_extern;
+                        int id = (uintptr_t) ext->super.address;
 
-            FOREACH_N(i, 0, m->max_threads) {
-                pool_for(TB_Global, g, m->thread_info[i].globals) {
-                    TB_Initializer* init = g->init;
-
-                    FOREACH_N(k, 0, init->obj_count) {
-                        size_t actual_pos = g->pos + init->objects[k].offset;
-
-                        // load the addend from the buffer
-                        uint64_t addend;
-                        memcpy(&addend, &data[actual_pos], sizeof(addend));
-
-                        switch (init->objects[k].type) {
-                            case TB_INIT_OBJ_RELOC_GLOBAL: {
-                                const TB_Global* g = init->objects[k].reloc_global;
-
-                                Elf64_Rela rela = {
-                                    .r_offset = actual_pos,
-                                    .r_info   = ELF64_R_INFO(g->super.symbol_id, R_X86_64_64),
-                                    .r_addend = addend,
-                                };
-                                TB_FIXED_ARRAY_APPEND(relocs, rela);
-                                break;
-                            }
-
-                            case TB_INIT_OBJ_RELOC_EXTERN: {
-                                const TB_External* ext = init->objects[k].reloc_extern;
-                                int id = (uintptr_t) ext->super.address;
-
-                                Elf64_Rela rela = {
-                                    .r_offset = actual_pos,
-                                    .r_info   = ELF64_R_INFO(id, R_X86_64_64),
-                                    .r_addend = addend,
-                                };
-                                TB_FIXED_ARRAY_APPEND(relocs, rela);
-                                break;
-                            }
-
-                            case TB_INIT_OBJ_RELOC_FUNCTION: {
-                                Elf64_Rela rela = {
-                                    .r_offset = actual_pos,
-                                    .r_info   = ELF64_R_INFO(init->objects[k].reloc_function->compiled_symbol_id, R_X86_64_64),
-                                    .r_addend = addend,
-                                };
-                                TB_FIXED_ARRAY_APPEND(relocs, rela);
-                                break;
-                            }
-
-                            default: break;
-                        }
-                    }
+                        Elf64_Rela rela = {
+                            .r_offset = actual_pos,
+                            .r_info   = ELF64_R_INFO(id, R_X86_64_64),
+                            .r_addend = addend,
+                        };
+                        TB_FIXED_ARRAY_APPEND(data_relocs, rela);
+                        break;
+                    }
+
+                    case TB_INIT_OBJ_RELOC_FUNCTION: {
+                        Elf64_Rela rela = {
+                            .r_offset = actual_pos,
+                            .r_info   = ELF64_R_INFO(init->objects[k].reloc_function->compiled_symbol_id, R_X86_64_64),
+                            .r_addend = addend,
+                        };
+                        TB_FIXED_ARRAY_APPEND(data_relocs, rela);
+                        break;
+                    }
+
+                    default: break;
                 }
             }
-
-            WRITE(relocs.elems, relocs.count * sizeof(Elf64_Rela));
         }
+    }
 
-        e.write_pos = tb_helper_write_rodata_section(e.write_pos, m, output, sections[S_RODATA].sh_offset);
-
-        assert(e.write_pos == sections[S_STAB].sh_offset);
-        WRITE(stab.data, stab.count);
+    uint8_t* rodata = tb_platform_heap_alloc(sections[S_RODATA].sh_size);
+    tb_helper_write_rodata_section(0, m, rodata, 0);
 
-        assert(e.write_pos == header.e_shoff);
-        WRITE(sections, S_MAX * sizeof(Elf64_Shdr));
+    // Write contents
+    TB_GatherList list = { 0 };
+    tb_helper_gather(&list, &header, sizeof(Elf64_Ehdr));
+    tb_helper_gather(&list, strtbl.data, strtbl.count);
+    tb_helper_gather_text_section(&list, m);
+    tb_helper_gather(&list, text_relocs.elems, text_relocs.count * sizeof(Elf64_Rela));
+    tb_helper_gather(&list, data, sections[S_DATA].sh_size);
+    tb_helper_gather(&list, data_relocs.elems, data_relocs.count * sizeof(Elf64_Rela));
+    tb_helper_gather(&list, rodata, sections[S_RODATA].sh_size);
+    tb_helper_gather(&list, stab.data, stab.count);
+    tb_helper_gather(&list, sections, S_MAX * sizeof(Elf64_Shdr));
+    assert(list.total == output_size);
+
+    bool success = true;
+    if (path != NULL) {
+        success = tb_helper_gather_write_file(&list, path);
+    } else {
+        *out = (TB_Exports){ .count = 1, .files = { { output_size, tb_helper_gather_join(&list) } } };
     }
 
     // Done
+    tb_platform_heap_free(list.vecs);
+    tb_platform_heap_free(rodata);
+    tb_platform_heap_free(data_relocs.elems);
+    tb_platform_heap_free(data);
+    tb_platform_heap_free(text_relocs.elems);
     tb_platform_heap_free(strtbl.data);
     tb_platform_heap_free(stab.data);
 
-    return (TB_Exports){ .count = 1, .files = { { output_size, output } } };
+    return success;
+}
+
+TB_API TB_Exports tb_elf64obj_write_output(TB_Module* m, const IDebugFormat* dbg) {
+    TB_Exports exports = { 0 };
+    elf64obj_write(m, dbg, NULL, &exports);
+    return exports;
+}
+
+bool tb_elf64obj_write_file(TB_Module* m, const IDebugFormat* dbg, const char* path) {
+    return elf64obj_write(m, dbg, path, NULL);
 }
 
 TB_API TB_Exports tb_elf64exe_write_output(TB_Module* m, const IDebugFormat* dbg) {
@@ -466,39 +472,11 @@ TB_API TB_Exports tb_elf64exe_write_output(TB_Module* m, const IDebugFormat* dbg
 
     TB_ModuleExporter e = { 0 };
 
-    uint16_t machine = 0;
-    switch (m->target_arch) {
-        case TB_ARCH_X86_64: machine = EM_X86_64; break;
-        case TB_ARCH_AARCH64: machine = EM_AARCH64; break;
-        default: tb_todo();
-    }
-
-    Elf64_Ehdr header = {
-        .e_ident = {
-            [EI_MAG0]       = 0x7F, // magic number
-            [EI_MAG1]       = 'E',
-            [EI_MAG2]       = 'L',
-            [EI_MAG3]       = 'F',
-            [EI_CLASS]      = 2, // 64bit ELF file
-            [EI_DATA]       = 1, // little-endian
-            [EI_VERSION]    = 1, // 1.0
-            [EI_OSABI]      = 0,
-            [EI_ABIVERSION] = 0
-        },
-        .e_type = ET_EXEC,
-        .e_version = 1,
-        .e_machine = machine,
-        .e_entry = 0,
-
-        .e_flags = 0,
-        .e_ehsize = sizeof(Elf64_Ehdr),
-
-        // segment headers go at the end of the file
-        // and are filed in later.
-        .e_phoff     = 0,
-        .e_phentsize = sizeof(Elf64_Phdr),
-        .e_phnum     = S_MAX,
-    };
+    // segment headers go at the end of the file
+    // and are filed in later.
+    Elf64_Ehdr header = elf64_header(m, ET_EXEC);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum     = S_MAX;
 
     Elf64_Phdr sections[] = {
         [S_TEXT] = {
@@ -540,15 +518,13 @@ TB_API TB_Exports tb_elf64exe_write_output(TB_Module* m, const IDebugFormat* dbg
         code_gen->emit_call_patches(m);
 
         // TODO: Handle rodata relocations
-        FOREACH_N(i, 0, m->max_threads) {
-            dyn_array_for(j, m->thread_info[i].symbol_patches) {
-                //TB_ExternFunctionPatch* p = &m->thread_info[i].ecall_patches[j];
+        TB_FOR_THREAD_INFO(info, m) {
+            TB_FOR_PATCHES(TB_SymbolPatch, p, info->symbol_patches) {
                 //TB_FunctionOutput* out_f = p->source->output;
                 tb_todo();
             }
 
-            FOREACH_N(j, 0, dyn_array_length(m->thread_info[i].const_patches)) {
-                TB_ConstPoolPatch* p = &m->thread_info[i].const_patches[j];
+            TB_FOR_PATCHES(TB_ConstPoolPatch, p, info->const_patches) {
                 TB_FunctionOutput* out_f = p->source->output;
                 assert(out_f && "Patch cannot be applied to function with no compiled output");
 
@@ -587,3 +563,152 @@ TB_API TB_Exports tb_elf64exe_write_output(TB_Module* m, const IDebugFormat* dbg
 
     return (TB_Exports){ .count = 1, .files = { { output_size, output } } };
 }
+
+// JIT debug images (see the GDB JIT interface in tb_jit.c), the code's already been placed
+// so there's nothing to relocate: each region is a .text section at its real address and
+// the symbols are relative to those. The unwind info is a .debug_frame, every frame is
+// rbp based (or doesn't touch the stack) so the FDEs are only a couple rules each.
+enum {
+    DW_CFA_advance_loc      = 0x40,
+    DW_CFA_offset           = 0x80,
+    DW_CFA_nop              = 0x00,
+    DW_CFA_def_cfa          = 0x0C,
+    DW_CFA_def_cfa_register = 0x0D,
+    DW_CFA_def_cfa_offset   = 0x0E,
+
+    // DWARF's numbering for x64
+    DW_X64_RBP = 6,
+    DW_X64_RSP = 7,
+    DW_X64_RIP = 16,
+};
+
+static void debug_frame_pad(TB_Emitter* frame, size_t start) {
+    while ((frame->count - start) % 8) tb_out1b(frame, DW_CFA_nop);
+    tb_patch4b(frame, start, (frame->count - start) - 4);
+}
+
+uint8_t* tb__elf64_write_jit_image(TB_Module* m, size_t region_count, const TB_JITImageRegion* regions, size_t symbol_count, const TB_JITImageSymbol* symbols, size_t* out_size) {
+    enum {
+        S_NULL,
+        S_STRTAB,
+        S_STAB,
+        S_FRAME,
+        S_TEXT,
+    };
+
+    assert(m->target_arch == TB_ARCH_X86_64);
+    assert(S_TEXT + region_count < 0xFF00 && "too many regions for one image");
+    size_t section_count = S_TEXT + region_count;
+
+    TB_Emitter strtbl = { 0 };
+    tb_out_reserve(&strtbl, 1024);
+    tb_out1b(&strtbl, 0);
+
+    Elf64_Shdr* sections = tb_platform_heap_alloc(section_count * sizeof(Elf64_Shdr));
+    sections[S_NULL] = (Elf64_Shdr){ 0 };
+    sections[S_STRTAB] = (Elf64_Shdr){
+        .sh_name = tb_outstr_nul_UNSAFE(&strtbl, ".strtab"),
+        .sh_type = SHT_STRTAB, .sh_addralign = 1
+    };
+    sections[S_STAB] = (Elf64_Shdr){
+        .sh_name = tb_outstr_nul_UNSAFE(&strtbl, ".symtab"),
+        .sh_type = SHT_SYMTAB, .sh_addralign = 1,
+        .sh_link = S_STRTAB, .sh_info = 1,
+        .sh_entsize = sizeof(Elf64_Sym)
+    };
+    sections[S_FRAME] = (Elf64_Shdr){
+        .sh_name = tb_outstr_nul_UNSAFE(&strtbl, ".debug_frame"),
+        .sh_type = SHT_PROGBITS, .sh_addralign = 8
+    };
+
+    size_t text_name = tb_outstr_nul_UNSAFE(&strtbl, ".text");
+    FOREACH_N(i, 0, region_count) {
+        sections[S_TEXT + i] = (Elf64_Shdr){
+            .sh_name = text_name,
+            .sh_type = SHT_PROGBITS,
+            .sh_flags = SHF_EXECINSTR | SHF_ALLOC,
+            .sh_addr = (uintptr_t) regions[i].base,
+            .sh_size = regions[i].size,
+            .sh_addralign = 16
+        };
+    }
+
+    // every symbol is global so they all come after the NULL one
+    TB_Emitter stab = { 0 };
+    tb_out_zero(&stab, sizeof(Elf64_Sym));
+    FOREACH_N(i, 0, symbol_count) {
+        const TB_JITImageSymbol* sym = &symbols[i];
+        put_symbol(&strtbl, &stab, sym->name, ELF64_ST_INFO(ELF64_STB_GLOBAL, ELF64_STT_FUNC), S_TEXT + sym->region, sym->offset, sym->size);
+    }
+
+    // CIE: the CFA starts at rsp+8 with the return address right below it
+    TB_Emitter frame = { 0 };
+    tb_out4b(&frame, 0);
+    tb_out4b(&frame, 0xFFFFFFFF);
+    tb_out1b(&frame, 1); // version
+    tb_out1b(&frame, 0); // no augmentation
+    tb_out1b(&frame, 1); // code alignment
+    tb_out1b(&frame, 0x78); // data alignment (-8 as a SLEB128)
+    tb_out1b(&frame, DW_X64_RIP);
+    tb_out1b(&frame, DW_CFA_def_cfa), tb_out1b(&frame, DW_X64_RSP), tb_out1b(&frame, 8);
+    tb_out1b(&frame, DW_CFA_offset | DW_X64_RIP), tb_out1b(&frame, 1);
+    debug_frame_pad(&frame, 0);
+
+    FOREACH_N(i, 0, symbol_count) {
+        const TB_JITImageSymbol* sym = &symbols[i];
+
+        size_t start = frame.count;
+        tb_out4b(&frame, 0);
+        tb_out4b(&frame, 0); // the CIE's offset
+        tb_out8b(&frame, (uintptr_t) regions[sym->region].base + sym->offset);
+        tb_out8b(&frame, sym->size);
+        if (sym->has_frame) {
+            // push rbp
+            tb_out1b(&frame, DW_CFA_advance_loc | 1);
+            tb_out1b(&frame, DW_CFA_def_cfa_offset), tb_out1b(&frame, 16);
+            tb_out1b(&frame, DW_CFA_offset | DW_X64_RBP), tb_out1b(&frame, 2);
+            // mov rbp, rsp
+            tb_out1b(&frame, DW_CFA_advance_loc | 3);
+            tb_out1b(&frame, DW_CFA_def_cfa_register), tb_out1b(&frame, DW_X64_RBP);
+        }
+        debug_frame_pad(&frame, start);
+    }
+
+    sections[S_STRTAB].sh_size = strtbl.count;
+    sections[S_STAB].sh_size   = stab.count;
+    sections[S_FRAME].sh_size  = frame.count;
+
+    size_t output_size = sizeof(Elf64_Ehdr);
+    FOREACH_N(i, 1, section_count) {
+        sections[i].sh_offset = output_size;
+        output_size += sections[i].sh_size;
+    }
+
+    Elf64_Ehdr header = elf64_header(m, ET_REL);
+    header.e_shoff     = output_size;
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum     = section_count;
+    header.e_shstrndx  = S_STRTAB;
+    output_size += section_count * sizeof(Elf64_Shdr);
+
+    TB_ModuleExporter e = { 0 };
+    uint8_t* restrict output = tb_platform_heap_alloc(output_size);
+    WRITE(&header, sizeof(Elf64_Ehdr));
+    WRITE(strtbl.data, strtbl.count);
+    WRITE(stab.data, stab.count);
+    WRITE(frame.data, frame.count);
+    FOREACH_N(i, 0, region_count) {
+        WRITE(regions[i].base, regions[i].size);
+    }
+
+    assert(e.write_pos == header.e_shoff);
+    WRITE(sections, section_count * sizeof(Elf64_Shdr));
+
+    tb_platform_heap_free(strtbl.data);
+    tb_platform_heap_free(stab.data);
+    tb_platform_heap_free(frame.data);
+    tb_platform_heap_free(sections);
+
+    *out_size = output_size;
+    return output;
+}
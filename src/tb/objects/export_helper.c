@@ -17,8 +17,8 @@ size_t tb_helper_write_data_section(size_t write_pos, TB_Module* m, uint8_t* out
     assert(write_pos == pos);
     uint8_t* data = &output[pos];
 
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_Global, g, m->thread_info[i].globals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
             if (g->storage != TB_STORAGE_DATA) continue;
 
             TB_Initializer* init = g->init;
@@ -41,9 +41,8 @@ size_t tb_helper_write_rodata_section(size_t write_pos, TB_Module* m, uint8_t* o
     assert(write_pos == pos);
 
     uint8_t* rdata = &output[pos];
-    FOREACH_N(i, 0, m->max_threads) {
-        FOREACH_N(j, 0, dyn_array_length(m->thread_info[i].const_patches)) {
-            TB_ConstPoolPatch* p = &m->thread_info[i].const_patches[j];
+    TB_FOR_THREAD_INFO(info, m) {
+        TB_FOR_PATCHES(TB_ConstPoolPatch, p, info->const_patches) {
             memcpy(&rdata[p->rdata_pos], p->data, p->length);
         }
     }
@@ -67,3 +66,47 @@ size_t tb_helper_get_text_section_layout(TB_Module* m, size_t symbol_id_start) {
 
     return offset;
 }
+
+void tb_helper_gather(TB_GatherList* list, const void* data, size_t length) {
+    if (length == 0) return;
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->vecs = tb_platform_heap_realloc(list->vecs, list->capacity * sizeof(TB_IOVec));
+    }
+
+    list->vecs[list->count++] = (TB_IOVec){ data, length };
+    list->total += length;
+}
+
+// same layout as tb_helper_write_text_section without the copy
+void tb_helper_gather_text_section(TB_GatherList* list, TB_Module* m) {
+    TB_FOR_FUNCTIONS(f, m) {
+        TB_FunctionOutput* out_f = f->output;
+        if (out_f != NULL) {
+            tb_helper_gather(list, out_f->code, out_f->code_size);
+        }
+    }
+}
+
+uint8_t* tb_helper_gather_join(const TB_GatherList* list) {
+    uint8_t* output = tb_platform_heap_alloc(list->total);
+
+    size_t write_pos = 0;
+    FOREACH_N(i, 0, list->count) {
+        memcpy(&output[write_pos], list->vecs[i].data, list->vecs[i].length);
+        write_pos += list->vecs[i].length;
+    }
+
+    return output;
+}
+
+bool tb_helper_gather_write_file(const TB_GatherList* list, const char* path) {
+    TB_FileHandle* file = tb_platform_file_create(path);
+    if (file == NULL) return false;
+
+    bool success = tb_platform_file_write_gather(file, list->count, list->vecs);
+    if (!tb_platform_file_close(file)) success = false;
+
+    return success;
+}
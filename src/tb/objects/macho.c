@@ -68,13 +68,13 @@ TB_API TB_Exports tb_macho_write_output(TB_Module* m, const IDebugFormat* dbg) {
     {
         /*symtab_cmd.nsyms += m->compiled_function_count;
 
-        FOREACH_N(i, 0, m->max_threads) {
-            size_t external_len = pool_popcount(m->thread_info[i].externals);
+        TB_FOR_THREAD_INFO(info, m) {
+            size_t external_len = pool_popcount(info->externals);
             symtab_cmd.nsyms += external_len ? external_len - 1 : 0;
         }
 
-        FOREACH_N(i, 0, m->max_threads) {
-            symtab_cmd.nsyms += pool_popcount(m->thread_info[i].globals);
+        TB_FOR_THREAD_INFO(info, m) {
+            symtab_cmd.nsyms += pool_popcount(info->globals);
         }*/
     }
 
@@ -191,8 +191,8 @@ static void gen_imports(TB_Module* restrict m, TB_ModuleExporter* restrict e) {
 
     // Find all the imports & place them into the right buckets
     uint32_t thunk_id_counter = 0;
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_for(TB_External, ext, m->thread_info[i].externals) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
             ptrdiff_t search = nl_strmap_get_cstr(e->import_nametable, ext->super.name);
             if (search < 0) {
                 printf("unresolved external: %s\n", ext->super.name);
@@ -415,9 +415,8 @@ TB_API TB_Exports tb_pe_write_output(TB_Module* m, const IDebugFormat* dbg) {
     // Apply external relocations
     ptrdiff_t const_data_rva = 0x1000 + e->import_table.count;
     // ptrdiff_t global_data_rva = 0x1000 + import_table.count;
-    FOREACH_N(i, 0, m->max_threads) {
-        FOREACH_N(j, 0, dyn_array_length(m->thread_info[i].symbol_patches)) {
-            TB_SymbolPatch* patch = &m->thread_info[i].symbol_patches[j];
+    TB_FOR_THREAD_INFO(info, m) {
+        TB_FOR_PATCHES(TB_SymbolPatch, patch, info->symbol_patches) {
 
             if (patch->target->tag == TB_SYMBOL_EXTERNAL) {
                 TB_FunctionOutput* out_f = patch->source->output;
@@ -434,8 +433,8 @@ TB_API TB_Exports tb_pe_write_output(TB_Module* m, const IDebugFormat* dbg) {
             }
         }
 
-        /*FOREACH_N(j, 0, dyn_array_length(m->thread_info[i].global_patches)) {
-            TB_SymbolPatch* patch = &m->thread_info[i].global_patches[j];
+        /*FOREACH_N(j, 0, dyn_array_length(info->global_patches)) {
+            TB_SymbolPatch* patch = &info->global_patches[j];
             TB_FunctionOutput* out_f = patch->source->output;
 
             size_t actual_pos = out_f->code_pos + out_f->prologue_length + patch->pos + 4;
@@ -447,8 +446,7 @@ TB_API TB_Exports tb_pe_write_output(TB_Module* m, const IDebugFormat* dbg) {
             *((int32_t*)&out_f->code[patch->pos]) += p;
         }*/
 
-        FOREACH_N(j, 0, dyn_array_length(m->thread_info[i].const_patches)) {
-            TB_ConstPoolPatch* patch = &m->thread_info[i].const_patches[j];
+        TB_FOR_PATCHES(TB_ConstPoolPatch, patch, info->const_patches) {
             TB_FunctionOutput* out_f = patch->source->output;
 
             size_t actual_pos = e->text_base + out_f->code_pos + out_f->prologue_length + patch->pos + 4;
@@ -481,9 +479,8 @@ TB_API TB_Exports tb_pe_write_output(TB_Module* m, const IDebugFormat* dbg) {
             WRITE(e->import_table.data, e->import_table.count);
 
             char* rdata = tb_platform_heap_alloc(m->rdata_region_size);
-            FOREACH_N(i, 0, m->max_threads) {
-                dyn_array_for(j, m->thread_info[i].const_patches) {
-                    TB_ConstPoolPatch* p = &m->thread_info[i].const_patches[j];
+            TB_FOR_THREAD_INFO(info, m) {
+                TB_FOR_PATCHES(TB_ConstPoolPatch, p, info->const_patches) {
                     memcpy(&rdata[p->rdata_pos], p->data, p->length);
                 }
             }
@@ -507,8 +504,8 @@ TB_API TB_Exports tb_pe_write_output(TB_Module* m, const IDebugFormat* dbg) {
         {
             char* data = tb_platform_heap_alloc(m->data_region_size);
 
-            FOREACH_N(i, 0, m->max_threads) {
-                pool_for(TB_Global, g, m->thread_info[i].globals) {
+            TB_FOR_THREAD_INFO(info, m) {
+                pool_for(TB_Global, g, info->globals) {
                     if (g->storage != TB_STORAGE_DATA) continue;
                     TB_Initializer* init = g->init;
 
@@ -304,6 +304,8 @@ static bool remove_passes(TB_Function* f) {
 
         nl_map_free(def_table);
     } else {
+        tb_function_build_uses(f);
+
         TB_FOR_BASIC_BLOCK(bb, f) {
             TB_FOR_NODE(r, f, bb) {
                 if (f->nodes[r].type == TB_PASS) {
@@ -315,6 +317,8 @@ static bool remove_passes(TB_Function* f) {
                 }
             }
         }
+
+        tb_function_free_uses(f);
     }
 
     return changes;
@@ -617,6 +621,7 @@ TB_API TB_Pass tb_opt_subexpr_elim(void) {
         .mode = TB_FUNCTION_PASS,
         .name = "CommonSubexprElim",
         .func_run = cse,
+        .preserves = TB_ANALYSIS_ALL,
     };
 }
 
@@ -633,5 +638,6 @@ TB_API TB_Pass tb_opt_compact_dead_regs(void) {
         .mode = TB_FUNCTION_PASS,
         .name = "CompactDeadRegs",
         .func_run = compact_regs,
+        .preserves = TB_ANALYSIS_ALL,
     };
 }
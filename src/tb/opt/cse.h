@@ -165,9 +165,7 @@ typedef struct {
 static void cse_create(CSE_Context* ctx, TB_TemporaryStorage* tls, TB_Function* f) {
     memset(ctx, 0, sizeof(CSE_Context));
 
-    TB_Predeccesors preds = tb_get_temp_predeccesors(f, tls);
-    ctx->doms = tb_tls_push(tls, f->bb_count * sizeof(TB_Label));
-    tb_get_dominators(f, preds, ctx->doms);
+    ctx->doms = tb_function_get_cached_doms(f)->idom;
 
     // list of defined nodes in for every basic block relevant to global CSE
     ctx->start = tb_tls_push(tls, 0);
@@ -234,6 +232,9 @@ static bool cse(TB_Function* f) {
     CSE_Context cse;
     cse_create(&cse, tls, f);
 
+    // every duplicate does a replace-all-uses
+    tb_function_build_uses(f);
+
     int changes = 0;
     TB_FOR_BASIC_BLOCK(bb, f) {
         cse_set_bb(&cse, tls, bb);
@@ -246,5 +247,6 @@ static bool cse(TB_Function* f) {
     }
 
     // don't free CSE, doesn't matter
+    tb_function_free_uses(f);
     return changes;
 }
@@ -30,6 +30,9 @@ static bool hoist_locals(TB_Function* f) {
 
     if (local_basepoint == 1) local_basepoint = prev;
 
+    // every local we move does a replace-all-uses
+    tb_function_build_uses(f);
+
     // hoist all locals which aren't in the entry label
     for (TB_Label bb = 1; bb < f->bb_count; bb++) {
         TB_FOR_NODE(r, f, bb) {
@@ -53,12 +56,14 @@ static bool hoist_locals(TB_Function* f) {
 
                 if (locals_to_move == 0) {
                     // ran out of stuff to do, early exit
+                    tb_function_free_uses(f);
                     return true;
                 }
             }
         }
     }
 
+    tb_function_free_uses(f);
     return true;
 }
 
@@ -67,5 +72,6 @@ TB_API TB_Pass tb_opt_hoist_locals(void) {
         .mode = TB_FUNCTION_PASS,
         .name = "HoistLocals",
         .func_run = hoist_locals,
+        .preserves = TB_ANALYSIS_ALL,
     };
 }
@@ -82,5 +82,6 @@ TB_API TB_Pass tb_opt_load_store_elim(void) {
         .mode = TB_FUNCTION_PASS,
         .name = "LoadStoreElimination",
         .func_run = load_store_elim,
+        .preserves = TB_ANALYSIS_ALL,
     };
 }
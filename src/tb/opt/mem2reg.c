@@ -31,7 +31,7 @@ typedef struct Mem2Reg_Ctx {
 } Mem2Reg_Ctx;
 
 static int bits_in_data_type(int pointer_size, TB_DataType dt);
-static Coherency tb_get_stack_slot_coherency(TB_Function* f, TB_Reg address, TB_DataType* dt, int* out_use_count);
+static Coherency tb_get_stack_slot_coherency(TB_Function* f, TB_Reg address, TB_Reg* seen, TB_DataType* dt, int* out_use_count);
 
 static int get_variable_id(Mem2Reg_Ctx* restrict c, TB_Reg r) {
     // TODO(NeGate): Maybe we speed this up... maybe it doesn't matter :P
@@ -365,15 +365,29 @@ bool mem2reg(TB_Function* f) {
     size_t to_promote_count = 0;
     TB_Reg* to_promote = tb_tls_push(tls, 0);
 
+    // the coherency checks only need to look at the users of each stack slot, seen
+    // has the last slot each node was checked for (SROA makes nodes so it can grow)
+    tb_function_build_uses(f);
+
+    size_t seen_count = f->node_count;
+    TB_Reg* seen = tb_platform_heap_alloc(seen_count * sizeof(TB_Reg));
+    memset(seen, 0, seen_count * sizeof(TB_Reg));
+
     int changes = 0;
     TB_FOR_BASIC_BLOCK(bb, f) {
         TB_FOR_NODE(r, f, bb) {
             TB_Node* n = &f->nodes[r];
 
             if (n->type == TB_LOCAL || n->type == TB_PARAM_ADDR) {
+                if (seen_count < f->node_count) {
+                    seen = tb_platform_heap_realloc(seen, f->node_count * sizeof(TB_Reg));
+                    memset(&seen[seen_count], 0, (f->node_count - seen_count) * sizeof(TB_Reg));
+                    seen_count = f->node_count;
+                }
+
                 TB_DataType dt;
                 int use_count;
-                Coherency coherence = tb_get_stack_slot_coherency(f, r, &dt, &use_count);
+                Coherency coherence = tb_get_stack_slot_coherency(f, r, seen, &dt, &use_count);
 
                 switch (coherence) {
                     case COHERENCY_GOOD: {
@@ -399,6 +413,10 @@ bool mem2reg(TB_Function* f) {
 
                             OPTIMIZER_LOG(r, "SROA on stack structure");
                             changes++;
+
+                            // SROA rewrote the addresses behind the use lists' back
+                            tb_function_free_uses(f);
+                            tb_function_build_uses(f);
                         } else {
                             OPTIMIZER_LOG(r, "could not mem2reg a stack slot (uses pointer arithmatic)");
                         }
@@ -414,6 +432,10 @@ bool mem2reg(TB_Function* f) {
         }
     }
 
+    // the rest of mem2reg rewrites nodes in place
+    tb_function_free_uses(f);
+    tb_platform_heap_free(seen);
+
     if (to_promote_count == 0) {
         // doesn't need to mem2reg
         return (changes != 0);
@@ -430,12 +452,10 @@ bool mem2reg(TB_Function* f) {
     c.current_def = tb_tls_push(tls, to_promote_count * c.bb_count * sizeof(TB_Reg));
     memset(c.current_def, 0, to_promote_count * c.bb_count * sizeof(TB_Reg));
 
-    // Calculate all the immediate predecessors
-    c.preds = tb_get_temp_predeccesors(f, tls);
-
-    // find dominators
-    c.doms = tb_tls_push(tls, f->bb_count * sizeof(TB_Label));
-    tb_get_dominators(f, c.preds, c.doms);
+    // Calculate all the immediate predecessors and dominators, mem2reg doesn't
+    // touch the CFG so these can come from the cache
+    c.preds = *tb_function_get_cached_preds(f);
+    c.doms = tb_function_get_cached_doms(f)->idom;
 
     TB_DominanceFrontiers df = tb_get_dominance_frontiers(f, c.preds, c.doms);
 
@@ -577,20 +597,12 @@ static int bits_in_data_type(int pointer_size, TB_DataType dt) {
 
 // NOTE(NeGate): a stack slot is coherent when all loads and stores share
 // the same type and alignment along with not needing any address usage.
-static Coherency tb_get_stack_slot_coherency(TB_Function* f, TB_Reg address, TB_DataType* out_dt, int* out_use_count) {
+static Coherency tb_get_stack_slot_coherency(TB_Function* f, TB_Reg address, TB_Reg* seen, TB_DataType* out_dt, int* out_use_count) {
     // if there's a difference between the times we want the value and the
     // times we want the address, then some address calculations are being done
     // and thus we can't mem2reg
-    int use_count = 0;
-    TB_FOR_BASIC_BLOCK(bb, f) {
-        TB_FOR_NODE(r, f, bb) {
-            TB_Node* n = &f->nodes[r];
-
-            TB_FOR_INPUT_IN_NODE(it, f, n) {
-                if (it.r == address) use_count += 1;
-            }
-        }
-    }
+    const TB_UseList* uses = tb_function_get_uses(f, address);
+    int use_count = uses->count;
     *out_use_count = use_count;
 
     int value_based_use_count = 0;
@@ -600,48 +612,52 @@ static Coherency tb_get_stack_slot_coherency(TB_Function* f, TB_Reg address, TB_
     TB_DataType dt = TB_TYPE_VOID;
     bool initialized = false;
     int dt_bits = 0;
-    TB_FOR_BASIC_BLOCK(bb, f) {
-        TB_FOR_NODE(r, f, bb) {
-            TB_Node* n = &f->nodes[r];
+    FOREACH_N(i, 0, uses->count) {
+        // a node which reads the address twice shows up twice (not necessarily next
+        // to each other), we only want to look at it once.
+        TB_Reg user = uses->users[i];
+        if (seen[user] == address) continue;
+        seen[user] = address;
+
+        TB_Node* n = &f->nodes[user];
+
+        static_assert(offsetof(TB_Node, load.address) == offsetof(TB_Node, store.address),
+            "TB_Node::load.address == TB_Node::store.address");
+
+        if (n->type == TB_MEMSET &&
+            n->mem_op.dst == address &&
+            f->nodes[n->mem_op.src].type == TB_INTEGER_CONST &&
+            f->nodes[n->mem_op.src].integer.num_words == 1 &&
+            f->nodes[n->mem_op.src].integer.single_word == 0 &&
+            f->nodes[n->mem_op.size].type == TB_INTEGER_CONST &&
+            f->nodes[n->mem_op.size].integer.num_words == 1) {
+            // untyped zeroing store
+            // we're hoping all data types match in size to continue along
+            int bits = bits_in_data_type(pointer_size, f->nodes[n->mem_op.src].dt) *
+                f->nodes[n->mem_op.size].integer.single_word;
+
+            if (bits == 0 || (dt_bits > 0 && bits != dt_bits)) {
+                return COHERENCY_BAD_DATA_TYPE;
+            }
+            dt_bits = bits;
+            value_based_use_count += 1;
+        } else if ((n->type == TB_LOAD || n->type == TB_STORE) && n->load.address == address) {
+            value_based_use_count += 1;
+
+            if (n->load.is_volatile) {
+                return COHERENCY_VOLATILE;
+            } else {
+                if (!initialized) {
+                    dt = n->dt;
+                    initialized = true;
+                }
 
-            static_assert(offsetof(TB_Node, load.address) == offsetof(TB_Node, store.address),
-                "TB_Node::load.address == TB_Node::store.address");
-
-            if (n->type == TB_MEMSET &&
-                n->mem_op.dst == address &&
-                f->nodes[n->mem_op.src].type == TB_INTEGER_CONST &&
-                f->nodes[n->mem_op.src].integer.num_words == 1 &&
-                f->nodes[n->mem_op.src].integer.single_word == 0 &&
-                f->nodes[n->mem_op.size].type == TB_INTEGER_CONST &&
-                f->nodes[n->mem_op.size].integer.num_words == 1) {
-                // untyped zeroing store
                 // we're hoping all data types match in size to continue along
-                int bits = bits_in_data_type(pointer_size, f->nodes[n->mem_op.src].dt) *
-                    f->nodes[n->mem_op.size].integer.single_word;
-
+                int bits = bits_in_data_type(pointer_size, dt);
                 if (bits == 0 || (dt_bits > 0 && bits != dt_bits)) {
                     return COHERENCY_BAD_DATA_TYPE;
                 }
                 dt_bits = bits;
-                value_based_use_count += 1;
-            } else if ((n->type == TB_LOAD || n->type == TB_STORE) && n->load.address == address) {
-                value_based_use_count += 1;
-
-                if (n->load.is_volatile) {
-                    return COHERENCY_VOLATILE;
-                } else {
-                    if (!initialized) {
-                        dt = n->dt;
-                        initialized = true;
-                    }
-
-                    // we're hoping all data types match in size to continue along
-                    int bits = bits_in_data_type(pointer_size, dt);
-                    if (bits == 0 || (dt_bits > 0 && bits != dt_bits)) {
-                        return COHERENCY_BAD_DATA_TYPE;
-                    }
-                    dt_bits = bits;
-                }
             }
         }
     }
@@ -663,5 +679,6 @@ TB_API TB_Pass tb_opt_mem2reg(void) {
         .mode = TB_FUNCTION_PASS,
         .name = "Mem2Reg",
         .func_run = mem2reg,
+        .preserves = TB_ANALYSIS_ALL,
     };
 }
@@ -390,6 +390,19 @@ void tb__print_func(TB_Function* f);
 bool tb__is_iconst(TB_Function* f, TB_Reg r, uint64_t imm);
 bool tb__is_izero(TB_Function* f, TB_Reg r);
 
+typedef struct TB_CFG {
+    size_t block_count, edge_count;
+
+    int* succ_start;
+    TB_Label* succ;
+
+    int* pred_start;
+    TB_Label* pred;
+} TB_CFG;
+
+TB_CFG tb_get_cfg(TB_Function* f);
+void tb_free_cfg(TB_CFG* cfg);
+
 ]]
 
 tb = {}
@@ -408,6 +421,15 @@ function tb.all_nodes_iter(f)
 	end
 end
 
+-- control flow graph, it's a TB_CFG[1] so index it with [0] (and hold onto the
+-- array, it's what gets collected). the successors of bb are cfg[0].succ from
+-- cfg[0].succ_start[bb] up to (but not including) cfg[0].succ_start[bb + 1]
+function tb.get_cfg(f)
+	local cfg = ffi.new("TB_CFG[1]")
+	cfg[0] = C.tb_get_cfg(f)
+	return ffi.gc(cfg, C.tb_free_cfg)
+end
+
 -- node type checking
 function tb.is_iadd(n) return C.tb__nodes(n.func)[n.reg].type == C.TB_ADD end
 function tb.is_isub(n) return C.tb__nodes(n.func)[n.reg].type == C.TB_SUB end
@@ -23,11 +23,10 @@ bool tb_opt_refinement(TB_Function* f) {
     TB_Predeccesors preds = tb_get_temp_predeccesors(f, tls);
 
     // find dominators
-    TB_Label* doms = tb_tls_push(tls, f->bb_count * sizeof(TB_Label));
-    tb_get_dominators(f, preds, doms);
+    TB_DominatorTree doms = tb_get_dominator_tree(f, preds);
 
     // we'll be using the loops to find out the ranges of different things
-    TB_LoopInfo loops = tb_get_loop_info(f, preds, doms);
+    TB_LoopInfo loops = tb_get_loop_info(f, preds, &doms);
     tb_function_print(f, tb_default_print_callback, stdout, false);
 
     FOREACH_N(i, 0, loops.count) {
@@ -76,6 +75,7 @@ bool tb_opt_refinement(TB_Function* f) {
     }
 
     tb_free_loop_info(loops);
+    tb_free_dominator_tree(&doms);
     return false;
 }
 #endif
\ No newline at end of file
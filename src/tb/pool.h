@@ -1,55 +1,133 @@
 #include "builtins.h"
 
+// Slab pool allocator, the pool pointer points at the first slab's
+// data so an empty pool is just NULL. Slabs double in size as they're
+// chained (up to POOL_MAX_SLOTS) and each one tracks its free slots with
+// a bitmap which lives right after the slots. Each slot starts with a pointer
+// back to its slab so freeing an element doesn't need to search for it:
+//
+//   [PoolHeader] [(PoolHeader*, T) * capacity] [uint64_t * (capacity / 64)]
+//
+// pools aren't thread-safe, each thread gets its own.
 enum {
-    MAX_SLOTS = 508
+    POOL_MIN_SLOTS = 64,
+    POOL_MAX_SLOTS = 4096,
 };
 
 typedef struct PoolHeader {
-    // population count
-    uint64_t used;
-    // each bit represents an allocated
-    uint64_t allocated[MAX_SLOTS];
+    // every slab, oldest first
     struct PoolHeader* next;
+    // slabs with at least one free slot
+    struct PoolHeader* next_free;
+
+    // these two are only meaningful on the first slab
+    struct PoolHeader* last;
+    struct PoolHeader* free_list;
+
+    // in slots, always a multiple of 64
+    uint32_t capacity;
+    uint32_t used;
+    // every bitmap word before this one is full
+    uint32_t hint;
+    uint32_t in_free_list;
 
-    // in 32bit builds, this would be padded so
-    // regardless the header is 4096 bytes
     char data[];
 } PoolHeader;
 
-inline static void* pool__alloc_slot(void** ptr, size_t type_size) {
-    // find the slot which isn't just filled
-    PoolHeader* hdr = *ptr ? ((PoolHeader*) *ptr) - 1 : NULL;
-    while (hdr != NULL && hdr->used >= MAX_SLOTS) hdr = hdr->next;
+// the back pointer and then the element padded so the next back pointer is aligned
+inline static size_t pool__stride(size_t type_size) {
+    return sizeof(PoolHeader*) + ((type_size + sizeof(PoolHeader*) - 1) & ~(sizeof(PoolHeader*) - 1));
+}
 
-    // if it's null allocate it
+inline static void* pool__slot(PoolHeader* hdr, size_t slot, size_t type_size) {
+    return &hdr->data[(slot * pool__stride(type_size)) + sizeof(PoolHeader*)];
+}
+
+inline static uint64_t* pool__bitmap(PoolHeader* hdr, size_t type_size) {
+    return (uint64_t*) &hdr->data[hdr->capacity * pool__stride(type_size)];
+}
+
+inline static size_t pool__slab_size(size_t capacity, size_t type_size) {
+    return sizeof(PoolHeader) + (capacity * pool__stride(type_size)) + (capacity / 8);
+}
+
+inline static PoolHeader* pool__new_slab(size_t capacity, size_t type_size) {
+    // valloc hands us zeroed pages so the bitmap starts empty
+    PoolHeader* hdr = tb_platform_valloc(pool__slab_size(capacity, type_size));
     if (hdr == NULL) {
-        hdr = tb_platform_valloc(sizeof(PoolHeader) + (MAX_SLOTS * type_size));
-        hdr->allocated[0] = 1;
-        hdr->used = 1;
+        fprintf(stderr, "pool: out of memory!\n");
+        abort();
+    }
+
+    hdr->capacity = capacity;
+    return hdr;
+}
 
-        // if it's NULL then it's the first element and thus
-        // we wanna actually store it back to the pointer
-        if (*ptr == NULL) {
-            *ptr = hdr->data;
-        }
+inline static void* pool__alloc_slot(void** ptr, size_t type_size) {
+    if (*ptr == NULL) {
+        PoolHeader* hdr = pool__new_slab(POOL_MIN_SLOTS, type_size);
+        hdr->last = hdr;
+        hdr->free_list = hdr;
+        hdr->in_free_list = 1;
 
-        return hdr->data;
+        *ptr = hdr->data;
     }
 
-    for (size_t i = 0; i < MAX_SLOTS; i++) {
-        if (hdr->allocated[i] == UINT64_MAX) continue;
+    PoolHeader* first = ((PoolHeader*) *ptr) - 1;
+    PoolHeader* hdr = first->free_list;
+    if (hdr == NULL) {
+        // every slab is full, chain a bigger one
+        size_t capacity = first->last->capacity * 2;
+        if (capacity > POOL_MAX_SLOTS) capacity = POOL_MAX_SLOTS;
+
+        hdr = pool__new_slab(capacity, type_size);
+        hdr->in_free_list = 1;
 
-        // find some unallocated slot
-        int index = hdr->allocated[i] ? tb_ffs64(~hdr->allocated[i]) - 1 : 0;
+        first->last->next = hdr;
+        first->last = hdr;
+        first->free_list = hdr;
+    }
 
-        hdr->allocated[i] |= (1ull << index);
-        hdr->used += 1;
+    // the slab isn't full so there's a free bit at or after the hint
+    uint64_t* bits = pool__bitmap(hdr, type_size);
+    size_t i = hdr->hint;
+    while (bits[i] == UINT64_MAX) i++;
 
-        return &hdr->data[((i * 64) + index) * type_size];
+    int index = tb_ffs64(~bits[i]) - 1;
+    bits[i] |= (1ull << index);
+    hdr->hint = i;
+
+    if (++hdr->used == hdr->capacity) {
+        first->free_list = hdr->next_free;
+        hdr->next_free = NULL;
+        hdr->in_free_list = 0;
     }
 
-    assert(0 && "TODO: implement the rest of the pool allocator");
-    return NULL;
+    void* elem = pool__slot(hdr, (i * 64) + index, type_size);
+    ((PoolHeader**) elem)[-1] = hdr;
+    return elem;
+}
+
+inline static void pool__free_slot(void* p, void* elem, size_t type_size) {
+    assert(p != NULL);
+    PoolHeader* first = ((PoolHeader*) p) - 1;
+
+    PoolHeader* hdr = ((PoolHeader**) elem)[-1];
+    size_t slot = ((char*) elem - sizeof(PoolHeader*) - hdr->data) / pool__stride(type_size);
+    assert(slot < hdr->capacity && elem == pool__slot(hdr, slot, type_size) && "pool_free: element isn't from a pool");
+
+    uint64_t* bits = pool__bitmap(hdr, type_size);
+    assert(bits[slot / 64] & (1ull << (slot % 64)) && "pool_free: double free");
+
+    bits[slot / 64] &= ~(1ull << (slot % 64));
+    hdr->used -= 1;
+    if (hdr->hint > slot / 64) hdr->hint = slot / 64;
+
+    if (!hdr->in_free_list) {
+        hdr->in_free_list = 1;
+        hdr->next_free = first->free_list;
+        first->free_list = hdr;
+    }
 }
 
 inline static void pool__destroy(void** ptr, size_t type_size) {
@@ -58,7 +136,7 @@ inline static void pool__destroy(void** ptr, size_t type_size) {
     PoolHeader* hdr = ((PoolHeader*) *ptr) - 1;
     while (hdr != NULL) {
         PoolHeader* next = hdr->next;
-        tb_platform_vfree(hdr, sizeof(PoolHeader) + (MAX_SLOTS * type_size));
+        tb_platform_vfree(hdr, pool__slab_size(hdr->capacity, type_size));
         hdr = next;
     }
     *ptr = NULL;
@@ -71,7 +149,7 @@ inline static size_t pool_popcount(void* ptr) {
 
     size_t c = 0;
     for (PoolHeader* hdr = ((PoolHeader*) ptr) - 1; hdr != NULL; hdr = hdr->next) {
-        c += tb_popcount64(hdr->used);
+        c += hdr->used;
     }
     return c;
 }
@@ -81,12 +159,14 @@ inline static size_t pool_popcount(void* ptr) {
 #define pool_put(p) \
 pool__alloc_slot((void**) &(p), sizeof(*(p)))
 
+#define pool_free(p, elem) pool__free_slot((p), (elem), sizeof(*(p)))
+
 #define pool_destroy(p) pool__destroy((void**) &(p), sizeof(*(p)))
 
+// walks the set bits of each word so empty words and slabs are skipped quickly
 #define pool_for(T, it, p) \
-for (PoolHeader *p_ = (PoolHeader*)(p), *hdr_ = p_ ? (p_ - 1) : NULL; hdr_; hdr_ = hdr_->next) \
-for (size_t a_ = 0; a_ < MAX_SLOTS; a_++) \
-if (hdr_->allocated[a_] != 0) \
-for (size_t b_ = 0; b_ < 64; b_++) \
-if (hdr_->allocated[a_] & (1ull << b_)) \
-for (T *it = (T*) &hdr_->data[((a_ * 64) + b_) * sizeof(T)]; it; it = NULL)
+for (PoolHeader* hdr_ = (p) ? ((PoolHeader*)(p)) - 1 : NULL; hdr_; hdr_ = hdr_->next) \
+if (hdr_->used != 0) \
+for (size_t a_ = 0, words_ = hdr_->capacity / 64; a_ < words_; a_++) \
+for (uint64_t bits_ = pool__bitmap(hdr_, sizeof(T))[a_]; bits_; bits_ &= bits_ - 1) \
+for (T *it = pool__slot(hdr_, (a_ * 64) + tb_ffs64(bits_) - 1, sizeof(T)); it; it = NULL)
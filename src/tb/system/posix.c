@@ -1,6 +1,21 @@
 #ifndef _WIN32
 #include "../tb_internal.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 void* tb_platform_valloc(size_t size) {
     return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 }
@@ -9,6 +24,53 @@ void* tb_platform_valloc_guard(size_t size) {
     return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 }
 
+void* tb_platform_vreserve(size_t size) {
+    void* ptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+bool tb_platform_vcommit(void* ptr, size_t size) {
+    return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+void* tb_platform_valloc_dual(size_t size, void** out_rw) {
+    #ifdef __linux__
+    int fd = syscall(SYS_memfd_create, "tb_jit", 0);
+    #else
+    static tb_atomic_int counter;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/tb_jit_%d_%d", (int) getpid(), tb_atomic_int_add(&counter, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    shm_unlink(name);
+    #endif
+
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // the mappings keep the memory alive after the fd is gone
+    void* rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void* view = mmap(NULL, size, PROT_NONE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (rw == MAP_FAILED || view == MAP_FAILED) {
+        if (rw != MAP_FAILED) munmap(rw, size);
+        if (view != MAP_FAILED) munmap(view, size);
+        return NULL;
+    }
+
+    *out_rw = rw;
+    return view;
+}
+
+void tb_platform_vfree_dual(void* ptr, void* rw, size_t size) {
+    munmap(ptr, size);
+    munmap(rw, size);
+}
+
 void tb_platform_vfree(void* ptr, size_t size) {
     munmap(ptr, size);
 }
@@ -37,91 +99,257 @@ void tb_platform_heap_free(void* ptr) {
     free(ptr);
 }
 
-static char* string_buffer;
-static tb_atomic_size_t string_head;
+////////////////////////////////
+// Threads
+////////////////////////////////
+struct TB_Thread {
+    pthread_t handle;
+    TB_ThreadFunc* func;
+    void* arg;
+};
+
+static void* thread_entry(void* arg) {
+    TB_Thread* t = arg;
+    t->func(t->arg);
+    return NULL;
+}
+
+TB_Thread* tb_platform_thread_create(TB_ThreadFunc* func, void* arg) {
+    TB_Thread* t = tb_platform_heap_alloc(sizeof(TB_Thread));
+    t->func = func;
+    t->arg = arg;
+
+    if (pthread_create(&t->handle, NULL, thread_entry, t) != 0) {
+        tb_platform_heap_free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void tb_platform_thread_join(TB_Thread* t) {
+    pthread_join(t->handle, NULL);
+    tb_platform_heap_free(t);
+}
+
+////////////////////////////////
+// Profiler support
+////////////////////////////////
+int tb_platform_process_id(void) {
+    return getpid();
+}
+
+int tb_platform_thread_id(void) {
+    #ifdef __linux__
+    return syscall(SYS_gettid);
+    #else
+    return getpid();
+    #endif
+}
+
+uint64_t tb_platform_perf_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+void* tb_platform_jitdump_marker(FILE* file, size_t size) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(file), 0);
+    return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+void tb_platform_jitdump_marker_free(void* ptr, size_t size) {
+    munmap(ptr, size);
+}
+
+////////////////////////////////
+// File system
+////////////////////////////////
+bool tb_platform_make_dir(const char* path) {
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+bool tb_platform_replace_file(const char* from, const char* to) {
+    return rename(from, to) == 0;
+}
+
+void tb_platform_touch_file(const char* path) {
+    utimes(path, NULL);
+}
+
+bool tb_platform_list_dir(const char* path, TB_ListDirFunc* func, void* user_data) {
+    DIR* dir = opendir(path);
+    if (dir == NULL) return false;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode)) {
+            func(user_data, entry->d_name, st.st_size, st.st_mtime);
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+void* tb_platform_map_file(const char* path, size_t* out_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // the mapping keeps the file alive after the fd is gone
+    void* ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED) return NULL;
+    *out_size = st.st_size;
+    return ptr;
+}
+
+void tb_platform_unmap_file(void* ptr, size_t size) {
+    munmap(ptr, size);
+}
 
-char* tb_platform_string_alloc(const char* str) {
-    if (!string_buffer) { string_buffer = tb_platform_valloc(64 << 20); }
+struct TB_FileHandle {
+    int fd;
+};
 
-    size_t len = strlen(str) + 1;
-    size_t pos = tb_atomic_size_add(&string_head, len);
+TB_FileHandle* tb_platform_file_create(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return NULL;
 
-    char* new_str = &string_buffer[pos];
-    strcpy(new_str, str);
+    TB_FileHandle* file = tb_platform_heap_alloc(sizeof(TB_FileHandle));
+    file->fd = fd;
+    return file;
+}
+
+bool tb_platform_file_write_gather(TB_FileHandle* file, size_t count, const TB_IOVec* vecs) {
+    // writev takes IOV_MAX pieces at most and it can stop short, offset is
+    // how much of vecs[i] already made it.
+    size_t i = 0, offset = 0;
+    while (i < count) {
+        struct iovec iov[64];
+        size_t n = 0, batch_size = 0;
+        for (size_t j = i; j < count && n < 64 && n < IOV_MAX; j++) {
+            size_t skip = (j == i) ? offset : 0;
+            iov[n++] = (struct iovec){ (uint8_t*) vecs[j].data + skip, vecs[j].length - skip };
+            batch_size += vecs[j].length - skip;
+        }
 
-    return new_str;
+        ssize_t written = writev(file->fd, iov, n);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 || (written == 0 && batch_size > 0)) return false;
+
+        size_t left = written;
+        while (i < count && left >= vecs[i].length - offset) {
+            left -= vecs[i].length - offset;
+            offset = 0, i++;
+        }
+        offset += left;
+    }
+
+    return true;
 }
 
-void tb_platform_string_free() { tb_platform_vfree(string_buffer, 64 << 20); }
+bool tb_platform_file_close(TB_FileHandle* file) {
+    bool success = close(file->fd) == 0;
+    tb_platform_heap_free(file);
+    return success;
+}
 
 ////////////////////////////////
 // Persistent arena allocator
 ////////////////////////////////
-#define ARENA_SEGMENT_SIZE (4 * 1024 * 1024)
+// segments start small and double up to ARENA_SEGMENT_SIZE so
+// arenas which barely get used (tiny modules) stay tiny.
+#define ARENA_MIN_SEGMENT_SIZE (64 * 1024)
+#define ARENA_SEGMENT_SIZE     (4 * 1024 * 1024)
 
 // It's a linked list :)
 typedef struct Segment {
     struct Segment* next;
+    size_t          capacity;
     size_t          used;
     unsigned char   data[];
 } Segment;
 
-static Segment* arena_base;
-static Segment* arena_top;
+// an arena belongs to a single thread (see tb__arena_alloc)
+// so there's no locking in here, the common path is just a pointer bump.
+struct TB_Arena {
+    Segment* base;
+    Segment* top;
+};
 
-// weird bootleg mutex because i dont get threads.h on windows :(
-static tb_atomic_int arena_lock = 0;
+static Segment* arena_new_segment(size_t capacity) {
+    Segment* s = (Segment*)mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (s == MAP_FAILED) {
+        tb_panic("tb_platform_arena_alloc: Out of memory!");
+    }
 
-void tb_platform_arena_init(void) {
-    Segment* s = (Segment*)mmap(NULL, ARENA_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (!s) abort();
+    s->next = NULL;
+    s->capacity = capacity;
+    s->used = 0;
+    return s;
+}
 
-    arena_base = arena_top = s;
+TB_Arena* tb_platform_arena_create(void) {
+    TB_Arena* a = tb_platform_heap_alloc(sizeof(TB_Arena));
+    a->base = a->top = arena_new_segment(ARENA_MIN_SEGMENT_SIZE);
+    return a;
 }
 
-void* tb_platform_arena_alloc(size_t size) {
+void* tb_platform_arena_alloc(TB_Arena* a, size_t size) {
     // align to max_align
     size_t align_mask = _Alignof(max_align_t) - 1;
     size = (size + align_mask) & ~align_mask;
 
-    // If this ever happens... literally how...
-    assert(size < ARENA_SEGMENT_SIZE);
-
-    // lock
-    int expected = 0;
-    while (!__atomic_compare_exchange_n(&arena_lock, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) { }
+    // big allocations get a segment all to themselves, it goes in the
+    // front of the list so the top segment doesn't go to waste.
+    if (size > (ARENA_SEGMENT_SIZE - sizeof(Segment)) / 2) {
+        Segment* s = arena_new_segment(sizeof(Segment) + size);
+        s->used = size;
+        s->next = a->base;
+        a->base = s;
+        return s->data;
+    }
 
     void* ptr;
-    if (arena_top->used + size - sizeof(Segment) < ARENA_SEGMENT_SIZE) {
-        ptr = &arena_top->data[arena_top->used];
-        arena_top->used += size;
+    if (a->top->used + size < a->top->capacity - sizeof(Segment)) {
+        ptr = &a->top->data[a->top->used];
+        a->top->used += size;
     } else {
-        // Add new page
-        Segment* s = (Segment*)mmap(NULL, ARENA_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (!s) {
-            tb_panic("tb_platform_arena_alloc: Out of memory!");
-        }
+        // Add new page, twice as big as the last one
+        size_t capacity = a->top->capacity;
+        do {
+            capacity = capacity * 2 < ARENA_SEGMENT_SIZE ? capacity * 2 : ARENA_SEGMENT_SIZE;
+        } while (size >= capacity - sizeof(Segment));
 
-        s->next = NULL;
+        Segment* s = arena_new_segment(capacity);
         s->used = size;
         ptr = s->data;
 
         // Insert to top of nodes
-        arena_top->next = s;
-        arena_top       = s;
+        a->top->next = s;
+        a->top       = s;
     }
 
-    // unlock
-    __atomic_exchange_n(&arena_lock, 0, __ATOMIC_SEQ_CST);
     return ptr;
 }
 
-void tb_platform_arena_free(void) {
-    Segment* c = arena_base;
+void tb_platform_arena_destroy(TB_Arena* a) {
+    Segment* c = a->base;
     while (c) {
         Segment* next = c->next;
-        munmap(c, ARENA_SEGMENT_SIZE);
+        munmap(c, c->capacity);
         c = next;
     }
+
+    tb_platform_heap_free(a);
 }
 #endif
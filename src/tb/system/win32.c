@@ -11,6 +11,39 @@ void* tb_platform_valloc(size_t size) {
     return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 }
 
+void* tb_platform_vreserve(size_t size) {
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+bool tb_platform_vcommit(void* ptr, size_t size) {
+    return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void* tb_platform_valloc_dual(size_t size, void** out_rw) {
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_EXECUTE_READWRITE, (DWORD) ((uint64_t) size >> 32), (DWORD) size, NULL);
+    if (mapping == NULL) return NULL;
+
+    // the views keep the memory alive after the handle is gone
+    void* rw = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS | FILE_MAP_EXECUTE, 0, 0, size);
+    CloseHandle(mapping);
+
+    DWORD old_protect;
+    if (rw == NULL || view == NULL || !VirtualProtect(view, size, PAGE_NOACCESS, &old_protect)) {
+        if (rw != NULL) UnmapViewOfFile(rw);
+        if (view != NULL) UnmapViewOfFile(view);
+        return NULL;
+    }
+
+    *out_rw = rw;
+    return view;
+}
+
+void tb_platform_vfree_dual(void* ptr, void* rw, size_t size) {
+    UnmapViewOfFile(ptr);
+    UnmapViewOfFile(rw);
+}
+
 void tb_platform_vfree(void* ptr, size_t size) {
     VirtualFree(ptr, 0, MEM_RELEASE);
 }
@@ -45,75 +78,245 @@ void tb_platform_heap_free(void* ptr) {
     free(ptr);
 }
 
-static char*  string_buffer;
-static size_t string_head;
+////////////////////////////////
+// Threads
+////////////////////////////////
+struct TB_Thread {
+    HANDLE handle;
+    TB_ThreadFunc* func;
+    void* arg;
+};
+
+static DWORD WINAPI thread_entry(LPVOID arg) {
+    TB_Thread* t = arg;
+    t->func(t->arg);
+    return 0;
+}
+
+TB_Thread* tb_platform_thread_create(TB_ThreadFunc* func, void* arg) {
+    TB_Thread* t = tb_platform_heap_alloc(sizeof(TB_Thread));
+    t->func = func;
+    t->arg = arg;
+
+    t->handle = CreateThread(NULL, 0, thread_entry, t, 0, NULL);
+    if (t->handle == NULL) {
+        tb_platform_heap_free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void tb_platform_thread_join(TB_Thread* t) {
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    tb_platform_heap_free(t);
+}
+
+////////////////////////////////
+// Profiler support
+////////////////////////////////
+int tb_platform_process_id(void) {
+    return GetCurrentProcessId();
+}
+
+int tb_platform_thread_id(void) {
+    return GetCurrentThreadId();
+}
+
+uint64_t tb_platform_perf_timestamp(void) {
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) ((now.QuadPart / freq.QuadPart) * 1000000000ull) + (((now.QuadPart % freq.QuadPart) * 1000000000ull) / freq.QuadPart);
+}
+
+// there's no perf on windows
+void* tb_platform_jitdump_marker(FILE* file, size_t size) {
+    return NULL;
+}
+
+void tb_platform_jitdump_marker_free(void* ptr, size_t size) {
+}
+
+////////////////////////////////
+// File system
+////////////////////////////////
+bool tb_platform_make_dir(const char* path) {
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+bool tb_platform_replace_file(const char* from, const char* to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+}
+
+void tb_platform_touch_file(const char* path) {
+    HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (file == INVALID_HANDLE_VALUE) return;
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file, NULL, NULL, &now);
+    CloseHandle(file);
+}
+
+bool tb_platform_list_dir(const char* path, TB_ListDirFunc* func, void* user_data) {
+    char pattern[MAX_PATH];
+    snprintf(pattern, MAX_PATH, "%s\\*", path);
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) return false;
+
+    do {
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+            uint64_t size = ((uint64_t) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+            uint64_t mtime = ((uint64_t) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+
+            // FILETIMEs are in 100ns ticks
+            func(user_data, data.cFileName, size, mtime / 10000000);
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+    return true;
+}
+
+// a copy-on-write view of the file can't be made executable unless
+// the file was mapped as an image so we just read it into fresh pages.
+void* tb_platform_map_file(const char* path, size_t* out_size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart > 0xFFFFFFFF) {
+        CloseHandle(file);
+        return NULL;
+    }
 
-char* tb_platform_string_alloc(const char* str) {
-    if (!string_buffer) {
-        string_buffer = tb_platform_valloc(32 << 20);
+    void* ptr = tb_platform_valloc(size.QuadPart);
+    DWORD read = 0;
+    if (ptr == NULL || !ReadFile(file, ptr, (DWORD) size.QuadPart, &read, NULL) || read != size.QuadPart) {
+        if (ptr != NULL) tb_platform_vfree(ptr, size.QuadPart);
+        CloseHandle(file);
+        return NULL;
     }
 
-    size_t len = strlen(str);
-    size_t pos = tb_atomic_size_add(&string_head, len + 1);
+    CloseHandle(file);
+    *out_size = size.QuadPart;
+    return ptr;
+}
 
-    char* new_str = &string_buffer[pos];
-    memcpy(new_str, str, len);
-    new_str[len] = '\0';
-    return new_str;
+void tb_platform_unmap_file(void* ptr, size_t size) {
+    tb_platform_vfree(ptr, size);
 }
 
-void tb_platform_string_free() {
-    tb_platform_vfree(string_buffer, 32 << 20);
-    string_buffer = NULL;
+struct TB_FileHandle {
+    HANDLE handle;
+};
+
+TB_FileHandle* tb_platform_file_create(const char* path) {
+    HANDLE handle = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return NULL;
+
+    TB_FileHandle* file = tb_platform_heap_alloc(sizeof(TB_FileHandle));
+    file->handle = handle;
+    return file;
+}
+
+// WriteFileGather only takes page sized buffers on unbuffered files
+// so it's a WriteFile per piece (split up since they only take 32bit lengths).
+bool tb_platform_file_write_gather(TB_FileHandle* file, size_t count, const TB_IOVec* vecs) {
+    FOREACH_N(i, 0, count) {
+        const uint8_t* data = vecs[i].data;
+        size_t left = vecs[i].length;
+        while (left > 0) {
+            DWORD written = 0, length = left > (1u << 30) ? (1u << 30) : (DWORD) left;
+            if (!WriteFile(file->handle, data, length, &written, NULL) || written == 0) {
+                return false;
+            }
+
+            data += written, left -= written;
+        }
+    }
+
+    return true;
+}
+
+bool tb_platform_file_close(TB_FileHandle* file) {
+    bool success = CloseHandle(file->handle);
+    tb_platform_heap_free(file);
+    return success;
 }
 
 ////////////////////////////////
 // Persistent arena allocator
 ////////////////////////////////
-#define ARENA_SEGMENT_SIZE (4 * 1024 * 1024)
+// segments start small and double up to ARENA_SEGMENT_SIZE so
+// arenas which barely get used (tiny modules) stay tiny.
+#define ARENA_MIN_SEGMENT_SIZE (64 * 1024)
+#define ARENA_SEGMENT_SIZE     (4 * 1024 * 1024)
 
 // It's a linked list :)
 typedef struct Segment {
     struct Segment* next;
+    size_t capacity;
     size_t used;
     unsigned char data[];
 } Segment;
 
-typedef struct Arena {
+// an arena belongs to a single thread (see tb__arena_alloc)
+// so there's no locking in here, the common path is just a pointer bump.
+struct TB_Arena {
     Segment *base, *top;
-} Arena;
+};
 
-static Arena tb__global_arena;
-static CRITICAL_SECTION tb__global_arena_lock;
+static Segment* arena_new_segment(size_t capacity) {
+    Segment* s = (Segment*) tb_platform_valloc(capacity);
+    if (!s) {
+        fprintf(stderr, "Out of memory!\n");
+        abort();
+    }
 
-void tb__arena_init(Arena* a) {
-    Segment* s = (Segment*) tb_platform_valloc(ARENA_SEGMENT_SIZE);
-    if (!s) abort();
+    s->next = NULL;
+    s->capacity = capacity;
+    s->used = 0;
+    return s;
+}
 
-    a->base = a->top = s;
+TB_Arena* tb_platform_arena_create(void) {
+    TB_Arena* a = tb_platform_heap_alloc(sizeof(TB_Arena));
+    a->base = a->top = arena_new_segment(ARENA_MIN_SEGMENT_SIZE);
+    return a;
 }
 
-void* tb__arena_alloc(Arena* a, size_t size) {
+void* tb_platform_arena_alloc(TB_Arena* a, size_t size) {
     // align to max_align
     size_t align_mask = _Alignof(intmax_t) - 1;
     size = (size + align_mask) & ~align_mask;
 
-    // If this ever happens... literally how...
-    assert(size < ARENA_SEGMENT_SIZE);
+    // big allocations get a segment all to themselves, it goes in the
+    // front of the list so the top segment doesn't go to waste.
+    if (size > (ARENA_SEGMENT_SIZE - sizeof(Segment)) / 2) {
+        Segment* s = arena_new_segment(sizeof(Segment) + size);
+        s->used = size;
+        s->next = a->base;
+        a->base = s;
+        return s->data;
+    }
 
     void* ptr;
-    if (a->top->used + size < ARENA_SEGMENT_SIZE - sizeof(Segment)) {
+    if (a->top->used + size < a->top->capacity - sizeof(Segment)) {
         ptr = &a->top->data[a->top->used];
         a->top->used += size;
     } else {
-        // Add new page
-        Segment* s = (Segment*) tb_platform_valloc(ARENA_SEGMENT_SIZE);
-        if (!s) {
-            fprintf(stderr, "Out of memory!\n");
-            abort();
-        }
+        // Add new page, twice as big as the last one
+        size_t capacity = a->top->capacity;
+        do {
+            capacity = capacity * 2 < ARENA_SEGMENT_SIZE ? capacity * 2 : ARENA_SEGMENT_SIZE;
+        } while (size >= capacity - sizeof(Segment));
 
-        s->next = NULL;
+        Segment* s = arena_new_segment(capacity);
         s->used = size;
         ptr = s->data;
 
@@ -122,34 +325,17 @@ void* tb__arena_alloc(Arena* a, size_t size) {
         a->top = s;
     }
 
-    // unlock
     return ptr;
 }
 
-void tb__arena_free(Arena* a) {
+void tb_platform_arena_destroy(TB_Arena* a) {
     Segment* c = a->base;
     while (c) {
         Segment* next = c->next;
-        tb_platform_vfree(c, ARENA_SEGMENT_SIZE);
+        tb_platform_vfree(c, c->capacity);
         c = next;
     }
 
-    a->base = a->top = NULL;
-}
-
-void tb_platform_arena_init(void) {
-    tb__arena_init(&tb__global_arena);
-    InitializeCriticalSection(&tb__global_arena_lock);
-}
-
-void* tb_platform_arena_alloc(size_t size) {
-    EnterCriticalSection(&tb__global_arena_lock);
-    void* r = tb__arena_alloc(&tb__global_arena, size);
-    LeaveCriticalSection(&tb__global_arena_lock);
-    return r;
-}
-
-void tb_platform_arena_free(void) {
-    tb__arena_free(&tb__global_arena);
+    tb_platform_heap_free(a);
 }
 #endif
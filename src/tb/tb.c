@@ -2,11 +2,28 @@
 #include "host.h"
 #include "coroutine.h"
 
+#define NL_STRING_MAP_IMPL
+#define NL_STRING_MAP_INLINE
+#include "string_map.h"
+
 enum { BATCH_SIZE = 8192 };
 
 static thread_local uint8_t* tb_thread_storage;
 static thread_local int tid;
-static tb_atomic_int total_tid;
+
+// the last module this thread looked up, keyed by uid since the
+// module could've been freed and another one put in its place.
+static thread_local uint64_t cached_module_uid;
+static thread_local TB_ThreadInfo* cached_thread_info;
+
+// thread slots, tid_count is the number of slots ever handed out and
+// the free ones are stacked up to be reused.
+static tb_atomic_int tid_lock;
+static int tid_count;
+static int free_tid_count, free_tid_capacity;
+static int* free_tids;
+
+static tb_atomic_size_t module_uid_counter;
 
 ICodeGen* tb__find_code_generator(TB_Module* m) {
     switch (m->target_arch) {
@@ -26,22 +43,155 @@ int tb__get_local_tid(void) {
     // the value it spits out is zero-based, but
     // the TIDs consider zero as a NULL space.
     if (tid == 0) {
-        int new_id = tb_atomic_int_add(&total_tid, 1);
+        while (tb_atomic_int_store(&tid_lock, 1)) {}
+        int new_id = free_tid_count > 0 ? free_tids[--free_tid_count] : tid_count++;
+        tb_atomic_int_store(&tid_lock, 0);
+
         tid = new_id + 1;
     }
 
     return tid - 1;
 }
 
-static TB_CodeRegion* get_or_allocate_code_region(TB_Module* m, int tid) {
-    if (m->code_regions[tid] == NULL) {
-        m->code_regions[tid] = tb_platform_valloc(CODE_REGION_BUFFER_SIZE / total_tid);
-        if (m->code_regions[tid] == NULL) tb_panic("could not allocate code region!");
+static void release_local_tid(void) {
+    if (tid == 0) return;
 
-        m->code_regions[tid]->capacity = CODE_REGION_BUFFER_SIZE / total_tid;
+    while (tb_atomic_int_store(&tid_lock, 1)) {}
+    if (free_tid_count + 1 > free_tid_capacity) {
+        free_tid_capacity = free_tid_capacity ? free_tid_capacity * 2 : 64;
+        free_tids = tb_platform_heap_realloc(free_tids, free_tid_capacity * sizeof(int));
+    }
+    free_tids[free_tid_count++] = tid - 1;
+    tb_atomic_int_store(&tid_lock, 0);
+
+    tid = 0;
+    cached_module_uid = 0;
+    cached_thread_info = NULL;
+}
+
+TB_ThreadInfo* tb__get_thread_info(TB_Module* m) {
+    if (cached_module_uid == m->uid) {
+        return cached_thread_info;
     }
 
-    return m->code_regions[tid];
+    // we might've had the slot's info made by a thread which has since
+    // given its slot back, only one thread owns a slot at a time so it's
+    // safe to just pick it up.
+    int id = tb__get_local_tid();
+    TB_ThreadInfo* info = m->first_thread_info;
+    while (info != NULL && info->tid != id) {
+        info = info->next_in_module;
+    }
+
+    if (info == NULL) {
+        info = tb_platform_heap_alloc(sizeof(TB_ThreadInfo));
+        *info = (TB_ThreadInfo){ .tid = id };
+
+        // atomic push, everyone else only ever reads the list
+        do {
+            info->next_in_module = m->first_thread_info;
+        } while (!tb_atomic_ptr_cmpxchg((void**) &m->first_thread_info, info->next_in_module, info));
+    }
+
+    cached_module_uid = m->uid;
+    cached_thread_info = info;
+    return info;
+}
+
+void* tb__arena_alloc(TB_Module* m, size_t size) {
+    // only this thread ever touches its info so no need for atomics
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+    if (info->arena == NULL) {
+        info->arena = tb_platform_arena_create();
+    }
+
+    return tb_platform_arena_alloc(info->arena, size);
+}
+
+char* tb__intern_string(TB_Module* m, const char* str) {
+    NL_Slice key = nl_slice__cstr(str);
+
+    // bootleg spin lock, we're only holding it for a lookup & maybe a copy
+    while (tb_atomic_int_store(&m->strings_lock, 1)) {}
+
+    char* result;
+    ptrdiff_t i = nl_strmap_get(m->strings, key);
+    if (i >= 0) {
+        result = m->strings[i];
+    } else {
+        result = tb__arena_alloc(m, key.length + 1);
+        memcpy(result, str, key.length + 1);
+
+        // the key has to point at our copy, the caller's string might die
+        NL_Slice new_key = { key.length, (const uint8_t*) result };
+        nl_strmap_put(m->strings, new_key, result);
+    }
+
+    tb_atomic_int_store(&m->strings_lock, 0);
+    return result;
+}
+
+static TB_CodeRegion* code_region_create(TB_CodeRegion* prev, size_t min_size) {
+    // a function too big for the usual reservation gets one sized for it
+    size_t reserved = CODE_REGION_RESERVE_SIZE;
+    while (reserved - sizeof(TB_CodeRegion) < min_size) reserved *= 2;
+
+    TB_CodeRegion* region = tb_platform_vreserve(reserved);
+    if (region == NULL || !tb_platform_vcommit(region, CODE_REGION_COMMIT_SIZE)) {
+        tb_panic("could not allocate code region!");
+    }
+
+    region->prev = prev;
+    region->reserved = reserved;
+    region->committed = CODE_REGION_COMMIT_SIZE;
+    region->size = 0;
+    return region;
+}
+
+static TB_CodeRegion* get_or_allocate_code_region(TB_ThreadInfo* info) {
+    if (info->code_region == NULL) {
+        info->code_region = code_region_create(NULL, 0);
+    }
+
+    return info->code_region;
+}
+
+uint8_t* tb__code_region_grow(TB_Module* m, uint8_t* code, size_t used, size_t extra, size_t* out_capacity) {
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+    TB_CodeRegion* region = info->code_region;
+    assert(code == &region->data[region->size]);
+
+    // the emitter wants to stay strictly below its capacity
+    size_t needed = used + extra + 1;
+    size_t end = sizeof(TB_CodeRegion) + region->size + needed;
+    if (end > region->reserved) {
+        // the function gets moved to a fresh region, it's only ever
+        // addressed relative to its start so the bytes can just be copied.
+        TB_CodeRegion* new_region = code_region_create(region, needed);
+        info->code_region = new_region;
+
+        end = sizeof(TB_CodeRegion) + needed;
+        if (end > new_region->committed) {
+            size_t size = align_up(end, CODE_REGION_COMMIT_SIZE);
+            if (!tb_platform_vcommit(new_region, size)) tb_panic("could not commit code region!");
+            new_region->committed = size;
+        }
+
+        memcpy(new_region->data, code, used);
+        code = new_region->data;
+        region = new_region;
+    } else if (end > region->committed) {
+        size_t size = align_up(end, CODE_REGION_COMMIT_SIZE);
+        if (size > region->reserved) size = region->reserved;
+
+        if (!tb_platform_vcommit((uint8_t*) region + region->committed, size - region->committed)) {
+            tb_panic("could not commit code region!");
+        }
+        region->committed = size;
+    }
+
+    *out_capacity = region->committed - sizeof(TB_CodeRegion) - region->size;
+    return code;
 }
 
 TB_API TB_DataType tb_vector_type(TB_DataTypeEnum type, int width) {
@@ -88,7 +238,7 @@ TB_API TB_Module* tb_module_create(TB_Arch arch, TB_System sys, const TB_Feature
     }
     memset(m, 0, sizeof(TB_Module));
 
-    m->max_threads = TB_MAX_THREADS;
+    m->uid = tb_atomic_size_add(&module_uid_counter, 1) + 1;
     m->is_jit = is_jit;
 
     m->target_abi = (sys == TB_SYSTEM_WINDOWS) ? TB_ABI_WIN64 : TB_ABI_SYSTEMV;
@@ -100,26 +250,15 @@ TB_API TB_Module* tb_module_create(TB_Arch arch, TB_System sys, const TB_Feature
         m->features = *features;
     }
 
-    m->prototypes_arena = tb_platform_valloc(PROTOTYPES_ARENA_SIZE * sizeof(uint64_t));
-    if (m->prototypes_arena == NULL) {
-        fprintf(stderr, "tb_module_create: Out of memory!\n");
-        return NULL;
-    }
-
     m->files.count = 1;
     m->files.capacity = 64;
     m->files.data = tb_platform_heap_alloc(64 * sizeof(TB_File));
     m->files.data[0] = (TB_File) { 0 };
 
-    FOREACH_N(i, 0, TB_MAX_THREADS) {
-        m->thread_info[i].const_patches  = dyn_array_create(TB_ConstPoolPatch);
-        m->thread_info[i].symbol_patches = dyn_array_create(TB_SymbolPatch);
-    }
-
     // we start a little off the start just because
     m->rdata_region_size = 16;
 
-    tb_platform_arena_init();
+    m->strings = nl_strmap_alloc(char*, 1024);
     return m;
 }
 
@@ -128,11 +267,9 @@ TB_API bool tb_module_compile_function(TB_Module* m, TB_Function* f, TB_ISelMode
     ICodeGen* restrict code_gen = tb__find_code_generator(m);
 
     // Machine code gen
-    int id = tb__get_local_tid();
-    assert(id < TB_MAX_THREADS);
-
-    TB_CodeRegion* region = get_or_allocate_code_region(m, id);
-    TB_FunctionOutput* func_out = tb_platform_arena_alloc(sizeof(TB_FunctionOutput));
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+    TB_CodeRegion* region = get_or_allocate_code_region(info);
+    TB_FunctionOutput* func_out = tb__arena_alloc(m, sizeof(TB_FunctionOutput));
 
     if (isel_mode == TB_ISEL_COMPLEX && code_gen->complex_path == NULL) {
         // TODO(NeGate): we need better logging...
@@ -140,20 +277,51 @@ TB_API bool tb_module_compile_function(TB_Module* m, TB_Function* f, TB_ISelMode
         isel_mode = TB_ISEL_FAST;
     }
 
+    // it's been compiled before, those patches are for the old code
+    tb__kill_function_patches(f);
+
+    TB_PatchMark symbol_mark = TB_PATCH_MARK(info->symbol_patches);
+    TB_PatchMark const_mark = TB_PATCH_MARK(info->const_patches);
+    f->patches = (TB_FunctionPatches){
+        .info = info,
+        .symbol_start = symbol_mark, .const_start = const_mark,
+        .symbol_count = info->symbol_patches.count, .const_count = info->const_patches.count,
+    };
+
+    TB_CodeCacheKey key;
+    bool cacheable = m->code_cache != NULL && tb__code_cache_key(m, f, isel_mode, &key);
+    if (cacheable && tb__code_cache_load(m, f, &key, func_out)) {
+        tb__code_cache_key_free(&key);
+
+        tb_atomic_size_add(&m->code_cache_hits, 1);
+        tb_atomic_size_add(&m->compiled_function_count, 1);
+        info->code_region->size += func_out->code_size;
+
+        f->patches.symbol_count = info->symbol_patches.count - f->patches.symbol_count;
+        f->patches.const_count = info->const_patches.count - f->patches.const_count;
+        f->output = func_out;
+        return true;
+    }
+
     uint8_t* local_buffer = &region->data[region->size];
-    size_t local_capacity = region->capacity - region->size;
+    size_t local_capacity = region->committed - sizeof(TB_CodeRegion) - region->size;
     if (isel_mode == TB_ISEL_COMPLEX) {
-        *func_out = code_gen->complex_path(f, &m->features, local_buffer, local_capacity, id);
+        *func_out = code_gen->complex_path(f, &m->features, local_buffer, local_capacity);
     } else {
-        *func_out = code_gen->fast_path(f, &m->features, local_buffer, local_capacity, id);
+        *func_out = code_gen->fast_path(f, &m->features, local_buffer, local_capacity);
     }
 
     // prologue & epilogue insertion
     {
         uint8_t buffer[PROEPI_BUFFER];
-        uint8_t* base = &region->data[region->size];
         size_t body_size = func_out->code_size;
-        assert(func_out->code == base);
+
+        // the body might've moved into a new region while it was emitted and
+        // the prologue & epilogue need room too.
+        size_t capacity;
+        uint8_t* base = tb__code_region_grow(m, func_out->code, body_size, PROEPI_BUFFER, &capacity);
+        region = info->code_region;
+        func_out->code = base;
 
         uint64_t meta = func_out->prologue_epilogue_metadata;
         size_t prologue_len = code_gen->emit_prologue(buffer, meta, func_out->stack_usage);
@@ -171,17 +339,237 @@ TB_API bool tb_module_compile_function(TB_Module* m, TB_Function* f, TB_ISelMode
         func_out->code_size += (prologue_len + epilogue_len);
     }
 
+    if (cacheable) {
+        tb__code_cache_store(m, f, &key, func_out, symbol_mark, const_mark);
+        tb__code_cache_key_free(&key);
+
+        tb_atomic_size_add(&m->code_cache_misses, 1);
+    }
+
     tb_atomic_size_add(&m->compiled_function_count, 1);
     region->size += func_out->code_size;
 
+    f->patches.symbol_count = info->symbol_patches.count - f->patches.symbol_count;
+    f->patches.const_count = info->const_patches.count - f->patches.const_count;
     f->output = func_out;
     return true;
 }
 
+typedef struct {
+    TB_Module* m;
+    TB_ISelMode isel_mode;
+    int worker_count;
+
+    // sorted from biggest to smallest so the big ones get started first,
+    // order is the function's index in the module's function list.
+    size_t function_count;
+    struct CompileItem {
+        TB_Function* f;
+        size_t order;
+    }* items;
+
+    // where each function's const patches ended up (indexed by order), these get
+    // reordered once everyone is done so that the code doesn't depend on the schedule.
+    struct CompileConstRange {
+        TB_Function* f;
+        TB_PatchList* list;
+        // where the list ended before compiling it, NULL if it was empty
+        TB_PatchChunk* chunk;
+        size_t index, count;
+    }* const_ranges;
+
+    // every worker owns the functions [w, w + worker_count, w + 2*worker_count...]
+    // of the sorted list and once it's out it'll steal from the other workers
+    struct CompileWorker {
+        size_t head;
+        bool failed;
+    }* workers;
+} CompileAllWork;
+
+typedef struct {
+    CompileAllWork* work;
+    int worker_id;
+} CompileAllWorkerArg;
+
+static int compare_function_size(const void* a, const void* b) {
+    const struct CompileItem* ia = a;
+    const struct CompileItem* ib = b;
+
+    if (ia->f->node_count != ib->f->node_count) {
+        return ia->f->node_count > ib->f->node_count ? -1 : 1;
+    }
+
+    return ia->order < ib->order ? -1 : ia->order > ib->order;
+}
+
+static bool compile_all_pop(CompileAllWork* work, int victim, size_t* out) {
+    size_t i = tb_atomic_size_add(&work->workers[victim].head, 1);
+    size_t index = victim + (i * work->worker_count);
+
+    if (index >= work->function_count) return false;
+    *out = index;
+    return true;
+}
+
+static void compile_all_worker(CompileAllWork* work, int worker_id) {
+    TB_Module* m = work->m;
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+
+    FOREACH_N(i, 0, work->worker_count) {
+        int victim = (worker_id + i) % work->worker_count;
+
+        size_t index;
+        while (compile_all_pop(work, victim, &index)) {
+            struct CompileItem* item = &work->items[index];
+
+            TB_PatchList* list = &info->const_patches;
+            TB_PatchChunk* chunk = list->last;
+            size_t chunk_index = chunk ? chunk->count : 0;
+            size_t start = list->count;
+
+            if (!tb_module_compile_function(m, item->f, work->isel_mode)) {
+                work->workers[worker_id].failed = true;
+            }
+
+            work->const_ranges[item->order] = (struct CompileConstRange){ item->f, list, chunk, chunk_index, list->count - start };
+        }
+    }
+}
+
+static void compile_all_worker_thread(void* arg) {
+    CompileAllWorkerArg* a = arg;
+    compile_all_worker(a->work, a->worker_id);
+
+    tb_free_thread_resources();
+}
+
+// Places the constants in function order instead of in whatever order the workers
+// happened to emit them, the codegen writes the rdata position into the code so we
+// have to update it there too.
+static void compile_all_layout_rdata(CompileAllWork* work, size_t rdata_start) {
+    TB_Module* m = work->m;
+
+    size_t rdata_pos = rdata_start;
+    FOREACH_N(i, 0, work->function_count) {
+        struct CompileConstRange r = work->const_ranges[i];
+        TB_FunctionOutput* out_f = r.f->output;
+
+        TB_PatchChunk* c = r.chunk ? r.chunk : r.list->first;
+        size_t j = r.index;
+        FOREACH_N(k, 0, r.count) {
+            // the range might start at the end of a full chunk or spill into the next
+            if (j == c->count) c = c->next, j = 0;
+
+            TB_ConstPoolPatch* p = &((TB_ConstPoolPatch*) c->data)[j++];
+            size_t new_pos = p->length > 8 ? align_up(rdata_pos, 16) : rdata_pos;
+
+            uint32_t disp = new_pos;
+            memcpy(&out_f->code[out_f->prologue_length + p->pos], &disp, sizeof(disp));
+
+            p->rdata_pos = new_pos;
+            rdata_pos = new_pos + p->length;
+        }
+    }
+
+    m->rdata_region_size = rdata_pos;
+}
+
+TB_API bool tb_module_compile_all(TB_Module* m, TB_ISelMode isel_mode, int thread_count) {
+    size_t function_count = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        if (f->super.tag == TB_SYMBOL_FUNCTION && f->output == NULL) function_count++;
+    }
+
+    if (function_count == 0) return true;
+
+    if (thread_count > (int) function_count) thread_count = function_count;
+    if (thread_count < 1) thread_count = 1;
+
+    CompileAllWork work = {
+        .m = m,
+        .isel_mode = isel_mode,
+        .worker_count = thread_count,
+        .function_count = function_count,
+        .items = tb_platform_heap_alloc(function_count * sizeof(struct CompileItem)),
+        .const_ranges = tb_platform_heap_alloc(function_count * sizeof(struct CompileConstRange)),
+        .workers = tb_platform_heap_alloc(thread_count * sizeof(struct CompileWorker)),
+    };
+
+    size_t i = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        if (f->super.tag == TB_SYMBOL_FUNCTION && f->output == NULL) {
+            work.items[i] = (struct CompileItem){ f, i };
+            i++;
+        }
+    }
+    qsort(work.items, function_count, sizeof(struct CompileItem), compare_function_size);
+
+    // the calling thread is worker 0
+    CompileAllWorkerArg* args = tb_platform_heap_alloc(thread_count * sizeof(CompileAllWorkerArg));
+    TB_Thread** threads = tb_platform_heap_alloc(thread_count * sizeof(TB_Thread*));
+    FOREACH_N(i, 0, thread_count) {
+        work.workers[i] = (struct CompileWorker){ 0 };
+        args[i] = (CompileAllWorkerArg){ &work, i };
+        threads[i] = NULL;
+    }
+
+    size_t rdata_start = tb_atomic_size_load(&m->rdata_region_size);
+    FOREACH_N(i, 1, thread_count) {
+        // if the thread fails to spawn, the others will steal its work
+        threads[i] = tb_platform_thread_create(compile_all_worker_thread, &args[i]);
+    }
+    compile_all_worker(&work, 0);
+
+    bool success = true;
+    FOREACH_N(i, 0, thread_count) {
+        if (threads[i] != NULL) tb_platform_thread_join(threads[i]);
+        if (work.workers[i].failed) success = false;
+    }
+
+    // the text section is laid out in function order at export time so
+    // it's deterministic as long as the function bodies are.
+    compile_all_layout_rdata(&work, rdata_start);
+
+    tb_platform_heap_free(threads);
+    tb_platform_heap_free(args);
+    tb_platform_heap_free(work.workers);
+    tb_platform_heap_free(work.const_ranges);
+    tb_platform_heap_free(work.items);
+    return success;
+}
+
 TB_API size_t tb_module_get_function_count(TB_Module* m) {
     return m->symbol_count[TB_SYMBOL_FUNCTION];
 }
 
+static size_t patch_list_bytes(const TB_PatchList* list, size_t type_size) {
+    size_t bytes = 0;
+    for (TB_PatchChunk* c = list->first; c != NULL; c = c->next) {
+        bytes += sizeof(TB_PatchChunk) + (c->capacity * type_size);
+    }
+    return bytes;
+}
+
+TB_API TB_ModuleStats tb_module_get_stats(TB_Module* m) {
+    TB_ModuleStats stats = {
+        .function_count = m->symbol_count[TB_SYMBOL_FUNCTION],
+        .compiled_function_count = m->compiled_function_count,
+        .code_cache_hits = m->code_cache_hits,
+        .code_cache_misses = m->code_cache_misses,
+    };
+
+    TB_FOR_THREAD_INFO(info, m) {
+        stats.thread_count += 1;
+
+        stats.symbol_patch_count += TB_PATCH_LIVE_COUNT(info->symbol_patches);
+        stats.symbol_patch_bytes += patch_list_bytes(&info->symbol_patches, sizeof(TB_SymbolPatch));
+        stats.const_patch_count += TB_PATCH_LIVE_COUNT(info->const_patches);
+        stats.const_patch_bytes += patch_list_bytes(&info->const_patches, sizeof(TB_ConstPoolPatch));
+    }
+
+    return stats;
+}
+
 TB_API void tb_module_kill_symbol(TB_Module* m, TB_Symbol* sym) {
     switch (sym->tag) {
         case TB_SYMBOL_TOMBSTONE: break;
@@ -189,10 +577,13 @@ TB_API void tb_module_kill_symbol(TB_Module* m, TB_Symbol* sym) {
         case TB_SYMBOL_FUNCTION: {
             TB_Function* f = (TB_Function*) sym;
 
+            tb_function_free_uses(f);
+            tb_function_invalidate_analyses(f, 0);
             tb_platform_heap_free(f->bbs);
             tb_platform_heap_free(f->nodes);
             tb_platform_heap_free(f->attrib_pool);
             tb_platform_heap_free(f->vla.data);
+            tb_platform_heap_free(f->params);
             break;
         }
         case TB_SYMBOL_EXTERNAL: break;
@@ -204,9 +595,6 @@ TB_API void tb_module_kill_symbol(TB_Module* m, TB_Symbol* sym) {
 }
 
 TB_API void tb_module_destroy(TB_Module* m) {
-    tb_platform_arena_free();
-    tb_platform_string_free();
-
     {
         TB_Symbol* s = m->first_symbol_of_tag[TB_SYMBOL_FUNCTION];
 
@@ -217,6 +605,14 @@ TB_API void tb_module_destroy(TB_Module* m) {
                 TB_Symbol* next = s->next;
                 tb_assume(tag == s->tag);
 
+                // frees the IR, the outputs stick around after a kill since
+                // the exporters still look at them.
+                TB_FunctionOutput* out_f = ((TB_Function*) s)->output;
+                if (out_f != NULL) {
+                    dyn_array_destroy(out_f->stack_slots);
+                }
+                tb_module_kill_symbol(m, s);
+
                 // TODO(NeGate): probably wanna have a custom heap for the symbol table
                 tb_platform_heap_free(s);
                 s = next;
@@ -224,28 +620,35 @@ TB_API void tb_module_destroy(TB_Module* m) {
         }
     }
 
-    FOREACH_N(i, 0, m->max_threads) {
-        if (m->code_regions[i] != NULL) {
-            tb_platform_vfree(m->code_regions[i], m->code_regions[i]->capacity);
-            m->code_regions[i] = NULL;
+    TB_ThreadInfo* info = m->first_thread_info;
+    while (info != NULL) {
+        TB_ThreadInfo* next = info->next_in_module;
+
+        TB_CodeRegion* region = info->code_region;
+        while (region != NULL) {
+            TB_CodeRegion* prev = region->prev;
+            tb_platform_vfree(region, region->reserved);
+            region = prev;
         }
+
+        pool_destroy(info->globals);
+        pool_destroy(info->externals);
+        pool_destroy(info->debug_types);
+
+        tb__patch_list_free(&info->symbol_patches);
+        tb__patch_list_free(&info->const_patches);
+
+        // function outputs, line info and such all live in here
+        if (info->arena != NULL) {
+            tb_platform_arena_destroy(info->arena);
+        }
+
+        tb_platform_heap_free(info);
+        info = next;
     }
 
-    if (m->jit_region) {
-        tb_platform_vfree(m->jit_region, m->jit_region_size);
-        m->jit_region = NULL;
-    }
-
-    FOREACH_N(i, 0, m->max_threads) {
-        pool_destroy(m->thread_info[i].globals);
-        pool_destroy(m->thread_info[i].externals);
-        pool_destroy(m->thread_info[i].debug_types);
-
-        dyn_array_destroy(m->thread_info[i].symbol_patches);
-        dyn_array_destroy(m->thread_info[i].const_patches);
-    }
-
-    tb_platform_vfree(m->prototypes_arena, PROTOTYPES_ARENA_SIZE * sizeof(uint64_t));
+    tb_platform_heap_free(m->prototypes);
+    nl_strmap_free(m->strings);
 
     tb_platform_heap_free(m->files.data);
     tb_platform_heap_free(m);
@@ -262,7 +665,7 @@ TB_API TB_FileID tb_file_create(TB_Module* m, const char* path) {
         m->files.data = tb_platform_heap_realloc(m->files.data, m->files.capacity * sizeof(TB_File));
     }
 
-    char* str = tb_platform_string_alloc(path);
+    char* str = tb__intern_string(m, path);
 
     size_t r = m->files.count++;
     m->files.data[r] = (TB_File) { .path = str };
@@ -278,18 +681,11 @@ void tb_function_reserve_nodes(TB_Function* f, size_t extra) {
     }
 }
 
-TB_API TB_FunctionPrototype* tb_prototype_create(TB_Module* m, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, int num_params, bool has_varargs) {
-    assert(num_params == (uint32_t)num_params);
-
-    size_t space_needed = (sizeof(TB_FunctionPrototype) + (sizeof(uint64_t) - 1)) / sizeof(uint64_t);
-    space_needed += ((num_params * sizeof(TB_PrototypeParam)) + (sizeof(uint64_t) - 1)) / sizeof(uint64_t);
+static TB_FunctionPrototype* prototype_alloc(TB_Module* m, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, size_t num_params, bool has_varargs) {
+    assert(num_params == (short)num_params);
 
-    size_t len = tb_atomic_size_add(&m->prototypes_arena_size, space_needed);
-    if (len + space_needed >= PROTOTYPES_ARENA_SIZE) {
-        tb_panic("Prototype arena: out of memory!\n");
-    }
-
-    TB_FunctionPrototype* p = (TB_FunctionPrototype*)&m->prototypes_arena[len];
+    TB_FunctionPrototype* p = tb__arena_alloc(m, sizeof(TB_FunctionPrototype) + (num_params * sizeof(TB_PrototypeParam)));
+    p->module = m;
     p->call_conv = conv;
     p->param_capacity = num_params;
     p->param_count = 0;
@@ -299,6 +695,98 @@ TB_API TB_FunctionPrototype* tb_prototype_create(TB_Module* m, TB_CallingConv co
     return p;
 }
 
+TB_API TB_FunctionPrototype* tb_prototype_create(TB_Module* m, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, int num_params, bool has_varargs) {
+    return prototype_alloc(m, conv, return_dt, return_type, num_params, has_varargs);
+}
+
+// param names are interned so comparing the pointers is enough
+static uint32_t prototype_hash(TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, size_t num_params, const TB_PrototypeParam* params, bool has_varargs) {
+    uint32_t h = tb__crc32(0, sizeof(conv), &conv);
+    h = tb__crc32(h, sizeof(return_dt.raw), &return_dt.raw);
+    h = tb__crc32(h, sizeof(return_type), &return_type);
+    h = tb__crc32(h, sizeof(num_params), &num_params);
+    h = tb__crc32(h, sizeof(has_varargs), &has_varargs);
+
+    FOREACH_N(i, 0, num_params) {
+        h = tb__crc32(h, sizeof(params[i].dt.raw), &params[i].dt.raw);
+        h = tb__crc32(h, sizeof(params[i].name), &params[i].name);
+        h = tb__crc32(h, sizeof(params[i].debug_type), &params[i].debug_type);
+    }
+    return h;
+}
+
+static bool prototype_equals(const TB_FunctionPrototype* p, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, size_t num_params, const TB_PrototypeParam* params, bool has_varargs) {
+    if (p->call_conv != conv || p->return_dt.raw != return_dt.raw || p->return_type != return_type ||
+        p->param_count != num_params || p->has_varargs != has_varargs) {
+        return false;
+    }
+
+    FOREACH_N(i, 0, num_params) {
+        if (p->params[i].dt.raw != params[i].dt.raw || p->params[i].name != params[i].name ||
+            p->params[i].debug_type != params[i].debug_type) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TB_API const TB_FunctionPrototype* tb_prototype_get(TB_Module* m, TB_CallingConv conv, TB_DataType return_dt, TB_DebugType* return_type, size_t num_params, const TB_PrototypeParam* params, bool has_varargs) {
+    // intern the names first so the params can be compared by pointer
+    TB_TemporaryStorage* tls = tb_tls_steal();
+    TB_PrototypeParam* interned = tb_tls_push(tls, num_params * sizeof(TB_PrototypeParam));
+    FOREACH_N(i, 0, num_params) {
+        interned[i] = params[i];
+        interned[i].name = params[i].name ? tb__intern_string(m, params[i].name) : NULL;
+    }
+
+    uint32_t h = prototype_hash(conv, return_dt, return_type, num_params, interned, has_varargs);
+    while (tb_atomic_int_store(&m->prototypes_lock, 1)) {}
+
+    // grow at 3/4 load
+    if ((m->prototype_count + 1) * 4 > m->prototype_capacity * 3) {
+        size_t old_capacity = m->prototype_capacity;
+        TB_FunctionPrototype** old = m->prototypes;
+
+        m->prototype_capacity = old_capacity ? old_capacity * 2 : 64;
+        m->prototypes = tb_platform_heap_alloc(m->prototype_capacity * sizeof(TB_FunctionPrototype*));
+        memset(m->prototypes, 0, m->prototype_capacity * sizeof(TB_FunctionPrototype*));
+
+        size_t mask = m->prototype_capacity - 1;
+        FOREACH_N(i, 0, old_capacity) if (old[i] != NULL) {
+            TB_FunctionPrototype* p = old[i];
+            size_t j = prototype_hash(p->call_conv, p->return_dt, p->return_type, p->param_count, p->params, p->has_varargs) & mask;
+            while (m->prototypes[j] != NULL) j = (j + 1) & mask;
+
+            m->prototypes[j] = p;
+        }
+        tb_platform_heap_free(old);
+    }
+
+    size_t mask = m->prototype_capacity - 1;
+    size_t i = h & mask;
+    for (; m->prototypes[i] != NULL; i = (i + 1) & mask) {
+        if (prototype_equals(m->prototypes[i], conv, return_dt, return_type, num_params, interned, has_varargs)) {
+            TB_FunctionPrototype* p = m->prototypes[i];
+
+            tb_atomic_int_store(&m->prototypes_lock, 0);
+            tb_tls_restore(tls, interned);
+            return p;
+        }
+    }
+
+    TB_FunctionPrototype* p = prototype_alloc(m, conv, return_dt, return_type, num_params, has_varargs);
+    FOREACH_N(j, 0, num_params) {
+        p->params[p->param_count++] = interned[j];
+    }
+
+    m->prototypes[i] = p;
+    m->prototype_count += 1;
+
+    tb_atomic_int_store(&m->prototypes_lock, 0);
+    tb_tls_restore(tls, interned);
+    return p;
+}
+
 TB_API void tb_prototype_add_param(TB_FunctionPrototype* p, TB_DataType dt) {
     assert(p->param_count + 1 <= p->param_capacity);
     p->params[p->param_count++] = (TB_PrototypeParam){ dt };
@@ -306,7 +794,7 @@ TB_API void tb_prototype_add_param(TB_FunctionPrototype* p, TB_DataType dt) {
 
 TB_API void tb_prototype_add_param_named(TB_FunctionPrototype* p, TB_DataType dt, const char* name, TB_DebugType* debug_type) {
     assert(p->param_count + 1 <= p->param_capacity);
-    p->params[p->param_count++] = (TB_PrototypeParam){ dt, tb_platform_string_alloc(name), debug_type };
+    p->params[p->param_count++] = (TB_PrototypeParam){ dt, tb__intern_string(p->module, name), debug_type };
 }
 
 TB_API TB_Function* tb_function_create(TB_Module* m, const char* name, TB_Linkage linkage) {
@@ -335,7 +823,7 @@ TB_API TB_Function* tb_function_create(TB_Module* m, const char* name, TB_Linkag
 }
 
 TB_API void tb_symbol_set_name(TB_Symbol* s, const char* name) {
-    s->name = tb_platform_string_alloc(name);
+    s->name = tb__intern_string(s->module, name);
 }
 
 TB_API const char* tb_symbol_get_name(TB_Symbol* s) {
@@ -456,13 +944,11 @@ TB_API void tb_initializer_add_extern(TB_Module* m, TB_Initializer* init, size_t
 }
 
 TB_API TB_Global* tb_global_create(TB_Module* m, const char* name, TB_StorageClass storage, TB_DebugType* dbg_type, TB_Linkage linkage) {
-    int tid = tb__get_local_tid();
-
-    TB_Global* g = pool_put(m->thread_info[tid].globals);
+    TB_Global* g = pool_put(tb__get_thread_info(m)->globals);
     *g = (TB_Global){
         .super = {
             .tag = TB_SYMBOL_GLOBAL,
-            .name = tb_platform_string_alloc(name),
+            .name = tb__intern_string(m, name),
             .module = m,
         },
         .dbg_type = dbg_type,
@@ -494,6 +980,10 @@ TB_API void tb_module_set_tls_index(TB_Module* m, TB_Symbol* e) {
     m->tls_index_extern = e;
 }
 
+TB_API void tb_module_set_jit_profiling(TB_Module* m, TB_JITProfiling flags) {
+    m->jit_profiling = flags;
+}
+
 TB_API void tb_symbol_bind_ptr(TB_Symbol* s, void* ptr) {
     s->address = ptr;
 }
@@ -508,13 +998,11 @@ TB_API void* tb_function_get_jit_pos(TB_Function* f) {
 
 TB_API TB_External* tb_extern_create(TB_Module* m, const char* name, TB_ExternalType type) {
     assert(name != NULL);
-    int tid = tb__get_local_tid();
-
-    TB_External* e = pool_put(m->thread_info[tid].externals);
+    TB_External* e = pool_put(tb__get_thread_info(m)->externals);
     *e = (TB_External){
         .super = {
             .tag = TB_SYMBOL_EXTERNAL,
-            .name = tb_platform_string_alloc(name),
+            .name = tb__intern_string(m, name),
             .module = m,
         },
         .type = type,
@@ -551,6 +1039,9 @@ void tb_free_thread_resources(void) {
         tb_platform_vfree(tb_thread_storage, TB_TEMPORARY_STORAGE_SIZE);
         tb_thread_storage = NULL;
     }
+
+    // the next thread to show up can have our slot (and our per-module state)
+    release_local_tid();
 }
 
 TB_TemporaryStorage* tb_tls_allocate() {
@@ -619,14 +1110,83 @@ void tb_tls_restore(TB_TemporaryStorage* store, void* ptr) {
     store->used = i;
 }
 
-void tb_emit_symbol_patch(TB_Module* m, TB_Function* source, const TB_Symbol* target, size_t pos, bool is_function, size_t local_thread_id) {
+void* tb__patch_list_push(TB_PatchList* list, size_t type_size) {
+    TB_PatchChunk* c = list->last;
+    if (c == NULL || c->count == c->capacity) {
+        size_t capacity = c ? c->capacity * 2 : PATCH_CHUNK_MIN;
+        if (capacity > PATCH_CHUNK_MAX) capacity = PATCH_CHUNK_MAX;
+
+        TB_PatchChunk* new_c = tb_platform_heap_alloc(sizeof(TB_PatchChunk) + (capacity * type_size));
+        if (new_c == NULL) tb_panic("out of memory");
+
+        *new_c = (TB_PatchChunk){ .capacity = capacity };
+        if (c) c->next = new_c;
+        else list->first = new_c;
+
+        list->last = c = new_c;
+    }
+
+    list->count += 1;
+    return &c->data[c->count++ * type_size];
+}
+
+void tb__patch_list_free(TB_PatchList* list) {
+    TB_PatchChunk* c = list->first;
+    while (c != NULL) {
+        TB_PatchChunk* next = c->next;
+        tb_platform_heap_free(c);
+        c = next;
+    }
+
+    *list = (TB_PatchList){ 0 };
+}
+
+void* tb__patch_mark_next(const TB_PatchList* list, TB_PatchMark* mark, size_t type_size) {
+    TB_PatchChunk* c = mark->chunk ? mark->chunk : list->first;
+    if (c == NULL) return NULL;
+
+    if (mark->index == c->count) {
+        if (c->next == NULL) return NULL;
+        c = c->next, mark->index = 0;
+    }
+
+    mark->chunk = c;
+    return &c->data[mark->index++ * type_size];
+}
+
+void tb__kill_function_patches(TB_Function* f) {
+    TB_FunctionPatches* fp = &f->patches;
+    if (fp->info == NULL) return;
+
+    TB_PatchMark mark = fp->symbol_start;
+    FOREACH_N(i, 0, fp->symbol_count) {
+        TB_SymbolPatch* p = tb__patch_mark_next(&fp->info->symbol_patches, &mark, sizeof(TB_SymbolPatch));
+        assert(p != NULL && p->source == f);
+        p->dead = true;
+    }
+
+    mark = fp->const_start;
+    FOREACH_N(i, 0, fp->const_count) {
+        TB_ConstPoolPatch* p = tb__patch_mark_next(&fp->info->const_patches, &mark, sizeof(TB_ConstPoolPatch));
+        assert(p != NULL && p->source == f);
+        p->dead = true;
+    }
+
+    // other threads might be killing patches on the same list
+    tb_atomic_size_add(&fp->info->symbol_patches.dead, fp->symbol_count);
+    tb_atomic_size_add(&fp->info->const_patches.dead, fp->const_count);
+    *fp = (TB_FunctionPatches){ 0 };
+}
+
+void tb_emit_symbol_patch(TB_Module* m, TB_Function* source, const TB_Symbol* target, size_t pos, bool is_function) {
     assert(pos == (uint32_t)pos);
 
     TB_SymbolPatch p = { .source = source, .target = target, .is_function = is_function, .pos = pos };
-    dyn_array_put(m->thread_info[local_thread_id].symbol_patches, p);
+    TB_SymbolPatch* slot = tb__patch_list_push(&tb__get_thread_info(m)->symbol_patches, sizeof(TB_SymbolPatch));
+    *slot = p;
 }
 
-uint32_t tb_emit_const_patch(TB_Module* m, TB_Function* source, size_t pos, const void* ptr, size_t len, size_t local_thread_id) {
+uint32_t tb_emit_const_patch(TB_Module* m, TB_Function* source, size_t pos, const void* ptr, size_t len) {
     assert(pos == (uint32_t)pos);
     assert(len == (uint32_t)len);
 
@@ -637,7 +1197,8 @@ uint32_t tb_emit_const_patch(TB_Module* m, TB_Function* source, size_t pos, cons
     TB_ConstPoolPatch p = {
         .source = source, .pos = pos, .rdata_pos = rdata_pos, .data = ptr, .length = len
     };
-    dyn_array_put(m->thread_info[local_thread_id].const_patches, p);
+    TB_ConstPoolPatch* slot = tb__patch_list_push(&tb__get_thread_info(m)->const_patches, sizeof(TB_ConstPoolPatch));
+    *slot = p;
 
     assert(rdata_pos == (uint32_t)rdata_pos);
     return rdata_pos;
@@ -661,7 +1222,8 @@ void tb_object_free(TB_ObjectFile* obj) {
 void* tb_out_reserve(TB_Emitter* o, size_t count) {
     if (o->count + count >= o->capacity) {
         if (o->capacity == 0) {
-            o->capacity = 64;
+            // the first write might not fit in the default either
+            o->capacity = count < 64 ? 64 : count * 2;
         } else {
             o->capacity += count;
             o->capacity *= 2;
@@ -2,8 +2,10 @@
 #include "tb_internal.h"
 
 typedef struct {
-    TB_Function* f;
-    int* doms;
+    TB_Label* doms;
+
+    // maps labels to their index in the postorder traversal, -1 if unreachable
+    int* po_index;
     TB_PostorderWalk order;
 } DomContext;
 
@@ -61,49 +63,128 @@ TB_API void tb_function_get_postorder_explicit(TB_Function* f, TB_PostorderWalk*
     return postorder(f, walk, 0);
 }
 
-static int find_traversal_index(DomContext* ctx, TB_Label l) {
-    FOREACH_N(i, 0, ctx->order.count) {
-        if (ctx->order.traversal[i] == l) return i;
-    }
-
-    tb_todo();
-}
-
-static int get_idom_in_postorder_index(DomContext* ctx, int x) {
-    return find_traversal_index(ctx, ctx->doms[ctx->order.traversal[x]]);
-}
-
 // this takes in postorder indices
-static TB_Label intersect(DomContext* ctx, int a, int b) {
+static int intersect(DomContext* ctx, int a, int b) {
     while (a != b) {
         // while (finger1 < finger2)
         //   finger1 = doms[finger1]
         while (a < b) {
-            a = get_idom_in_postorder_index(ctx, a);
+            a = ctx->po_index[ctx->doms[ctx->order.traversal[a]]];
         }
 
         // while (finger2 < finger1)
         //   finger2 = doms[finger2]
         while (b < a) {
-            b = get_idom_in_postorder_index(ctx, b);
+            b = ctx->po_index[ctx->doms[ctx->order.traversal[b]]];
         }
     }
 
     return a;
 }
 
+// writes out the successors of bb (if out isn't NULL) and returns how many there
+// are, IFs with the same label on both edges list it twice.
+static int get_successors(TB_Function* f, TB_Label bb, TB_Label* out) {
+    // Empty BB
+    if (f->bbs[bb].end == 0) return 0;
+
+    TB_Node* end = &f->nodes[f->bbs[bb].end];
+    switch (end->type) {
+        case TB_IF:
+        if (out) {
+            out[0] = end->if_.if_true;
+            out[1] = end->if_.if_false;
+        }
+        return 2;
+
+        case TB_GOTO:
+        if (out) out[0] = end->goto_.label;
+        return 1;
+
+        case TB_SWITCH: {
+            size_t entry_count = (end->switch_.entries_end - end->switch_.entries_start) / 2;
+            TB_SwitchEntry* entries = (TB_SwitchEntry*) &f->vla.data[end->switch_.entries_start];
+
+            if (out) {
+                FOREACH_N(i, 0, entry_count) out[i] = entries[i].value;
+                out[entry_count] = end->switch_.default_label;
+            }
+            return entry_count + 1;
+        }
+
+        // these blocks have no successors
+        case TB_UNREACHABLE: case TB_RET: case TB_TRAP: return 0;
+        default: tb_todo();
+    }
+}
+
+TB_CFG tb_get_temp_cfg(TB_Function* f, TB_TemporaryStorage* tls) {
+    size_t bb_count = f->bb_count;
+
+    size_t edge_count = 0;
+    FOREACH_N(bb, 0, bb_count) {
+        edge_count += get_successors(f, bb, NULL);
+    }
+
+    // pred_start has an extra slot for the counting sort
+    size_t size = ((bb_count + 1) + (bb_count + 2)) * sizeof(int) + (2 * edge_count * sizeof(TB_Label));
+    void* mem = tls ? tb_tls_push(tls, size) : tb_platform_heap_alloc(size);
+
+    TB_CFG cfg = { .block_count = bb_count, .edge_count = edge_count };
+    cfg.succ_start = mem;
+    cfg.pred_start = &cfg.succ_start[bb_count + 1];
+    cfg.succ       = (TB_Label*) &cfg.pred_start[bb_count + 2];
+    cfg.pred       = &cfg.succ[edge_count];
+
+    // every terminator is only read once
+    int cursor = 0;
+    FOREACH_N(bb, 0, bb_count) {
+        cfg.succ_start[bb] = cursor;
+        cursor += get_successors(f, bb, &cfg.succ[cursor]);
+    }
+    cfg.succ_start[bb_count] = cursor;
+
+    // counting sort on the edge targets, we walk the sources in order so
+    // each predecessor list comes out sorted by block.
+    int* pred_start = cfg.pred_start;
+    memset(pred_start, 0, (bb_count + 2) * sizeof(int));
+    FOREACH_N(i, 0, edge_count) pred_start[cfg.succ[i] + 2] += 1;
+    FOREACH_N(i, 2, bb_count + 2) pred_start[i] += pred_start[i - 1];
+
+    // pred_start[l + 1] is used as the write cursor for l, once it's done
+    // filling it lands on the start of l + 1.
+    FOREACH_N(bb, 0, bb_count) {
+        FOREACH_N(i, cfg.succ_start[bb], cfg.succ_start[bb + 1]) {
+            cfg.pred[pred_start[cfg.succ[i] + 1]++] = bb;
+        }
+    }
+
+    return cfg;
+}
+
+TB_API TB_CFG tb_get_cfg(TB_Function* f) {
+    return tb_get_temp_cfg(f, NULL);
+}
+
+TB_API void tb_free_cfg(TB_CFG* cfg) {
+    tb_platform_heap_free(cfg->succ_start);
+    *cfg = (TB_CFG){ 0 };
+}
+
 TB_Predeccesors tb_get_temp_predeccesors(TB_Function* f, TB_TemporaryStorage* tls) {
     TB_Predeccesors p = { 0 };
     p.count = tb_tls_push(tls, f->bb_count * sizeof(int));
     p.preds = tb_tls_push(tls, f->bb_count * sizeof(TB_Label*));
 
+    TB_CFG cfg = tb_get_temp_cfg(f, tls);
+
     // entry label has no predecessors
     p.count[0] = 0;
     p.preds[0] = NULL;
 
     FOREACH_N(j, 1, f->bb_count) {
-        p.preds[j] = tb_tls_push(tls, 0);
-        tb_calculate_immediate_predeccessors(f, tls, j, &p.count[j]);
+        p.count[j] = cfg.pred_start[j + 1] - cfg.pred_start[j];
+        p.preds[j] = &cfg.pred[cfg.pred_start[j]];
     }
 
     return p;
@@ -113,22 +194,46 @@ void tb_free_temp_predeccesors(TB_TemporaryStorage* tls, TB_Predeccesors preds)
     tb_tls_restore(tls, preds.count);
 }
 
+// the predecessor lists are packed into one allocation so they can be
+// freed without knowing how many blocks there were when they got built.
 TB_API TB_Predeccesors tb_get_predeccesors(TB_Function* f) {
-    TB_Predeccesors p = { 0 };
-    p.count = tb_platform_heap_alloc(f->bb_count * sizeof(int));
-    p.preds = tb_platform_heap_alloc(f->bb_count * sizeof(TB_Label*));
+    size_t bb_count = f->bb_count;
+
+    TB_TemporaryStorage* tls = tb_tls_steal();
+    void* tls_base = tb_tls_push(tls, 0);
+    TB_CFG cfg = tb_get_temp_cfg(f, tls);
 
     // entry label has no predecessors
+    size_t total = cfg.edge_count - (cfg.pred_start[1] - cfg.pred_start[0]);
+
+    char* mem = tb_platform_heap_alloc(bb_count * (sizeof(TB_Label*) + sizeof(int)) + total * sizeof(TB_Label));
+    TB_Predeccesors p;
+    p.preds = (TB_Label**) mem;
+    p.count = (int*) &p.preds[bb_count];
+
     p.count[0] = 0;
     p.preds[0] = NULL;
 
-    FOREACH_N(j, 1, f->bb_count) {
-        p.preds[j] = tb_calculate_immediate_predeccessors(f, NULL, j, &p.count[j]);
+    TB_Label* cursor = (TB_Label*) &p.count[bb_count];
+    FOREACH_N(j, 1, bb_count) {
+        int count = cfg.pred_start[j + 1] - cfg.pred_start[j];
+
+        p.count[j] = count;
+        p.preds[j] = count ? cursor : NULL;
+
+        memcpy(cursor, &cfg.pred[cfg.pred_start[j]], count * sizeof(TB_Label));
+        cursor += count;
     }
 
+    tb_tls_restore(tls, tls_base);
     return p;
 }
 
+TB_API void tb_free_predeccesors(TB_Predeccesors* preds) {
+    tb_platform_heap_free(preds->preds);
+    *preds = (TB_Predeccesors){ 0 };
+}
+
 TB_API TB_DominanceFrontiers tb_get_dominance_frontiers(TB_Function* f, TB_Predeccesors p, const TB_Label* doms) {
     TB_DominanceFrontiers df = { 0 };
     df.count = tb_platform_heap_alloc(f->bb_count * sizeof(int));
@@ -199,18 +304,19 @@ TB_API size_t tb_get_dominators(TB_Function* f, TB_Predeccesors preds, TB_Label*
     }
 
     // entrypoint dominates itself
-    DomContext ctx = { .f = f, .doms = doms };
+    DomContext ctx = { .doms = doms };
     doms[0] = 0;
 
     // undef all dominator entries
     FOREACH_N(i, 1, f->bb_count) doms[i] = -1;
 
     // identify post order traversal order
+    TB_TemporaryStorage* tls = tb_tls_steal();
+    void* tls_base = tb_tls_push(tls, 0);
     {
-        TB_TemporaryStorage* tls = tb_tls_steal();
-
         ctx.order.count = 0;
-        ctx.order.traversal = tb_tls_push(tls, f->bb_count * sizeof(TB_Reg));
+        ctx.order.traversal = tb_tls_push(tls, f->bb_count * sizeof(TB_Label));
+        ctx.po_index = tb_tls_push(tls, f->bb_count * sizeof(int));
 
         // we only need the visited array for this scope, it's just to avoid
         // recursing forever on post order traversal stuff
@@ -222,6 +328,11 @@ TB_API size_t tb_get_dominators(TB_Function* f, TB_Predeccesors preds, TB_Label*
         // NOTE: free ctx.order.visited but keep ctx.traversal
         tb_tls_restore(tls, ctx.order.visited);
         ctx.order.visited = NULL;
+
+        // cache the label -> postorder index mapping so intersect doesn't
+        // need to search the traversal every step up the tree
+        FOREACH_N(i, 0, f->bb_count) ctx.po_index[i] = -1;
+        FOREACH_N(i, 0, ctx.order.count) ctx.po_index[ctx.order.traversal[i]] = i;
     }
 
     bool changed = true;
@@ -231,29 +342,29 @@ TB_API size_t tb_get_dominators(TB_Function* f, TB_Predeccesors preds, TB_Label*
         // for all nodes, b, in reverse postorder (except start node)
         FOREACH_REVERSE_N(i, 0, ctx.order.count - 1) {
             TB_Label b = ctx.order.traversal[i];
-            TB_Label new_idom = preds.preds[b][0];
+            int new_idom = -1;
 
-            // for all other predecessors, p, of b
-            FOREACH_N(j, 1, preds.count[b]) {
+            // for all predecessors, p, of b which have been processed
+            FOREACH_N(j, 0, preds.count[b]) {
                 TB_Label p = preds.preds[b][j];
 
                 // i.e., if doms[p] already calculated
                 if (doms[p] != -1) {
-                    new_idom = ctx.order.traversal[intersect(
-                            &ctx,
-                            find_traversal_index(&ctx, p),
-                            find_traversal_index(&ctx, new_idom)
-                        )];
+                    new_idom = new_idom < 0 ? ctx.po_index[p] : intersect(&ctx, ctx.po_index[p], new_idom);
                 }
             }
 
-            if (doms[b] != new_idom) {
-                doms[b] = new_idom;
+            assert(new_idom >= 0 && "reachable block with no processed predecessors");
+            TB_Label new_idom_label = ctx.order.traversal[new_idom];
+            if (doms[b] != new_idom_label) {
+                doms[b] = new_idom_label;
                 changed = true;
             }
         }
     }
 
+    tb_tls_restore(tls, tls_base);
+
     // if it's still undefined it's unreachable but for now we'll make
     // it map to the entrypoint to avoid array bounds issues and such
     FOREACH_N(i, 1, f->bb_count){
@@ -263,62 +374,331 @@ TB_API size_t tb_get_dominators(TB_Function* f, TB_Predeccesors preds, TB_Label*
     return f->bb_count;
 }
 
-TB_API bool tb_is_dominated_by(TB_Label* doms, TB_Label expected_dom, TB_Label bb) {
-    while (bb != 0 && expected_dom != bb) {
-        bb = doms[bb];
+// numbers the dominator tree described by idom in DFS pre and post order, the
+// subtree of a node is then exactly the nodes with their pre/post numbers
+// nested inside of its own.
+static void number_dominator_tree(size_t count, const TB_Label* idom, int* pre, int* post) {
+    TB_TemporaryStorage* tls = tb_tls_steal();
+    void* tls_base = tb_tls_push(tls, 0);
+
+    // children lists in CSR form
+    int* child_start = tb_tls_push(tls, (count + 1) * sizeof(int));
+    TB_Label* children = tb_tls_push(tls, count * sizeof(TB_Label));
+    memset(child_start, 0, (count + 1) * sizeof(int));
+
+    FOREACH_N(i, 1, count) child_start[idom[i] + 1] += 1;
+    FOREACH_N(i, 0, count) child_start[i + 1] += child_start[i];
+
+    // post is used as the fill cursor until the walk overwrites it
+    FOREACH_N(i, 0, count) post[i] = child_start[i];
+    FOREACH_N(i, 1, count) children[post[idom[i]]++] = i;
+
+    // explicit stack since the tree can be as deep as the block count
+    TB_Label* stack = tb_tls_push(tls, count * sizeof(TB_Label));
+    int* cursor = tb_tls_push(tls, count * sizeof(int));
+    size_t top = 0;
+    int pre_counter = 0, post_counter = 0;
+
+    stack[top++] = 0;
+    cursor[0] = child_start[0];
+    pre[0] = pre_counter++;
+
+    while (top > 0) {
+        TB_Label bb = stack[top - 1];
+        int i = cursor[top - 1];
+
+        if (i < child_start[bb + 1]) {
+            TB_Label kid = children[i];
+            cursor[top - 1] = i + 1;
+
+            pre[kid] = pre_counter++;
+            stack[top] = kid;
+            cursor[top] = child_start[kid];
+            top++;
+        } else {
+            post[bb] = post_counter++;
+            top--;
+        }
     }
 
-    return (expected_dom == bb);
+    tb_tls_restore(tls, tls_base);
 }
 
-TB_API TB_LoopInfo tb_get_loop_info(TB_Function* f, TB_Predeccesors preds, TB_Label* doms) {
-    // Find loops
-    DynArray(TB_Loop) loops = dyn_array_create(TB_Loop);
-    FOREACH_N(bb, 0, f->bb_count) {
-        TB_Label backedge = 0;
-        FOREACH_N(j, 0, preds.count[bb]) {
-            if (tb_is_dominated_by(doms, bb, preds.preds[bb][j])) {
-                backedge = preds.preds[bb][j];
-                break;
+TB_API TB_DominatorTree tb_get_dominator_tree(TB_Function* f, TB_Predeccesors preds) {
+    size_t count = f->bb_count;
+
+    // one allocation for all the arrays, freed through idom
+    TB_DominatorTree tree = { .count = count };
+    tree.idom = tb_platform_heap_alloc(count * (sizeof(TB_Label) + 2*sizeof(int)));
+    tree.pre  = (int*) &tree.idom[count];
+    tree.post = &tree.pre[count];
+
+    tb_get_dominators(f, preds, tree.idom);
+    number_dominator_tree(count, tree.idom, tree.pre, tree.post);
+    return tree;
+}
+
+TB_API void tb_free_dominator_tree(TB_DominatorTree* tree) {
+    tb_platform_heap_free(tree->idom);
+    *tree = (TB_DominatorTree){ 0 };
+}
+
+TB_API bool tb_is_dominated_by(const TB_DominatorTree* tree, TB_Label expected_dom, TB_Label bb) {
+    return tree->pre[expected_dom] <= tree->pre[bb] && tree->post[bb] <= tree->post[expected_dom];
+}
+
+// walks up from the innermost loop x until it hits the loop at depth, returns
+// -1 if x isn't nested in anything that deep
+static int loop_ancestor_at_depth(const TB_Loop* loops, int x, int depth) {
+    while (x >= 0 && loops[x].depth > depth) {
+        x = loops[x].parent_loop;
+    }
+
+    return x >= 0 && loops[x].depth == depth ? x : -1;
+}
+
+// Builds the natural loop forest: every block which is the target of a back edge
+// (an edge from a block it dominates) heads a loop, and the body is found by
+// walking the predecessors backwards from the latches. Headers are handled
+// innermost first so when we run into an already discovered loop we just
+// attach it as a child and keep going from its header.
+TB_API TB_LoopInfo tb_get_loop_info(TB_Function* f, TB_Predeccesors preds, const TB_DominatorTree* doms) {
+    size_t bb_count = f->bb_count;
+
+    TB_TemporaryStorage* tls = tb_tls_steal();
+    void* tls_base = tb_tls_push(tls, 0);
+
+    // number the headers in dominator tree preorder, that way a loop's parent
+    // always has a smaller index than it.
+    TB_Label* by_pre = tb_tls_push(tls, bb_count * sizeof(TB_Label));
+    FOREACH_N(bb, 0, bb_count) by_pre[doms->pre[bb]] = bb;
+
+    // unreachable blocks look like children of the entry in the dominator tree
+    // so one which branches to itself would count as a loop, filter those out.
+    bool* reachable = tb_tls_push(tls, bb_count * sizeof(bool));
+    {
+        memset(reachable, 0, bb_count * sizeof(bool));
+
+        TB_Label* stack = tb_tls_push(tls, bb_count * sizeof(TB_Label));
+        size_t top = 0;
+
+        reachable[0] = true;
+        stack[top++] = 0;
+        while (top > 0) {
+            TB_Label bb = stack[--top];
+
+            TB_Label* succ = tb_tls_push(tls, get_successors(f, bb, NULL) * sizeof(TB_Label));
+            int succ_count = get_successors(f, bb, succ);
+            FOREACH_N(j, 0, succ_count) {
+                if (!reachable[succ[j]]) {
+                    reachable[succ[j]] = true;
+                    stack[top++] = succ[j];
+                }
             }
+            tb_tls_restore(tls, succ);
         }
 
-        if (backedge) {
-            printf("L%zu is a loop (backedge: L%d)\n    ", bb, backedge);
+        tb_tls_restore(tls, stack);
+    }
 
-            TB_Loop l = { .parent_loop = -1, .header = bb, .backedge = backedge };
-            l.body = malloc(f->bb_count * sizeof(TB_Label));
+    TB_Loop* loops = tb_tls_push(tls, 0);
+    size_t loop_count = 0;
+    FOREACH_N(i, 0, bb_count) {
+        TB_Label bb = by_pre[i];
+        if (!reachable[bb]) continue;
 
-            FOREACH_N(j, 0, f->bb_count) {
-                if (tb_is_dominated_by(doms, bb, j)) {
-                    printf("L%zu ", j);
+        FOREACH_N(j, 0, preds.count[bb]) {
+            if (tb_is_dominated_by(doms, bb, preds.preds[bb][j])) {
+                tb_tls_push(tls, sizeof(TB_Loop));
+                loops[loop_count++] = (TB_Loop){
+                    .parent_loop = -1, .header = bb, .backedge = preds.preds[bb][j]
+                };
+                break;
+            }
+        }
+    }
 
-                    l.body[l.body_count++] = j;
+    // innermost loop for each block
+    int* block_loop = tb_tls_push(tls, bb_count * sizeof(int));
+    FOREACH_N(bb, 0, bb_count) block_loop[bb] = -1;
+
+    // blocks are marked as they're pushed so each one shows up at most once
+    TB_Label* worklist = tb_tls_push(tls, bb_count * sizeof(TB_Label));
+    FOREACH_REVERSE_N(i, 0, loop_count) {
+        TB_Label header = loops[i].header;
+        block_loop[header] = i;
+
+        // starting from the header means the first things we find are the latches
+        size_t worklist_count = 0;
+        worklist[worklist_count++] = header;
+
+        while (worklist_count > 0) {
+            TB_Label bb = worklist[--worklist_count];
+
+            // anything which isn't dominated by the header can't be in the loop, the
+            // unreachable blocks are skipped on their own since they hang off the
+            // entry in the dominator tree (so it looks like it dominates them).
+            FOREACH_N(j, 0, preds.count[bb]) {
+                TB_Label p = preds.preds[bb][j];
+                if (p == header || !reachable[p] || !tb_is_dominated_by(doms, header, p)) continue;
+
+                if (block_loop[p] < 0) {
+                    block_loop[p] = i;
+                    worklist[worklist_count++] = p;
+                } else {
+                    // find the outermost loop found so far, if it's not us then
+                    // it's nested in us and we continue from its header
+                    int root = block_loop[p];
+                    while (loops[root].parent_loop >= 0) root = loops[root].parent_loop;
+                    if (root == i) continue;
+
+                    loops[root].parent_loop = i;
+                    worklist[worklist_count++] = loops[root].header;
                 }
             }
+        }
+    }
 
-            l.body = realloc(l.body, l.body_count * sizeof(TB_Label));
+    // parents come before their children so this resolves in one go
+    FOREACH_N(i, 0, loop_count) {
+        ptrdiff_t parent = loops[i].parent_loop;
+        loops[i].depth = parent >= 0 ? loops[parent].depth + 1 : 1;
+    }
 
-            // check if we have a parent...
-            FOREACH_REVERSE_N(o, 0, dyn_array_length(loops)) {
-                FOREACH_N(j, 0, loops[o].body_count) {
-                    if (bb == loops[o].body[j]) {
-                        l.parent_loop = o;
-                        goto fatherfull_behavior;
-                    }
+    // count the bodies and exits, a block is in its innermost loop and every
+    // loop above that.
+    size_t body_total = 0, exit_total = 0;
+    TB_Label* succ = tb_tls_push(tls, 0);
+    FOREACH_N(bb, 0, bb_count) {
+        if (block_loop[bb] < 0) continue;
+
+        int succ_count = get_successors(f, bb, NULL);
+        tb_tls_push(tls, succ_count * sizeof(TB_Label));
+        get_successors(f, bb, succ);
+
+        for (ptrdiff_t l = block_loop[bb]; l >= 0; l = loops[l].parent_loop) {
+            loops[l].body_count += 1;
+            body_total += 1;
+
+            FOREACH_N(j, 0, succ_count) {
+                if (loop_ancestor_at_depth(loops, block_loop[succ[j]], loops[l].depth) != l) {
+                    loops[l].exit_count += 1;
+                    exit_total += 1;
                 }
             }
+        }
+
+        tb_tls_restore(tls, succ);
+    }
+
+    // everything lives in one allocation which starts with the loops array
+    size_t size = (loop_count * sizeof(TB_Loop)) + (2 * bb_count * sizeof(int)) +
+        (exit_total * sizeof(TB_LoopExit)) + (body_total * sizeof(TB_Label));
+
+    char* mem = tb_platform_heap_alloc(size);
+    TB_LoopInfo info = { .count = loop_count };
+    info.loops       = (TB_Loop*) mem;
+    info.block_loop  = (int*) &info.loops[loop_count];
+    info.block_depth = &info.block_loop[bb_count];
+
+    TB_LoopExit* exits = (TB_LoopExit*) &info.block_depth[bb_count];
+    TB_Label* bodies = (TB_Label*) &exits[exit_total];
+
+    memcpy(info.loops, loops, loop_count * sizeof(TB_Loop));
+    memcpy(info.block_loop, block_loop, bb_count * sizeof(int));
+    FOREACH_N(i, 0, loop_count) {
+        TB_Loop* l = &info.loops[i];
+
+        l->body = bodies, bodies += l->body_count;
+        l->exits = exits, exits += l->exit_count;
+        l->body_count = l->exit_count = 0;
+    }
+
+    // fill them in, bodies end up sorted by label
+    FOREACH_N(bb, 0, bb_count) {
+        if (block_loop[bb] < 0) {
+            info.block_depth[bb] = 0;
+            continue;
+        }
+
+        info.block_depth[bb] = info.loops[block_loop[bb]].depth;
 
-            fatherfull_behavior:
-            dyn_array_put(loops, l);
+        int succ_count = get_successors(f, bb, NULL);
+        tb_tls_push(tls, succ_count * sizeof(TB_Label));
+        get_successors(f, bb, succ);
 
-            printf("\n\n");
+        for (ptrdiff_t l = block_loop[bb]; l >= 0; l = info.loops[l].parent_loop) {
+            TB_Loop* loop = &info.loops[l];
+            loop->body[loop->body_count++] = bb;
+
+            FOREACH_N(j, 0, succ_count) {
+                if (loop_ancestor_at_depth(info.loops, block_loop[succ[j]], loop->depth) != l) {
+                    loop->exits[loop->exit_count++] = (TB_LoopExit){ bb, succ[j] };
+                }
+            }
         }
+
+        tb_tls_restore(tls, succ);
     }
 
-    return (TB_LoopInfo){ .count = dyn_array_length(loops), .loops = &loops[0] };
+    tb_tls_restore(tls, tls_base);
+    return info;
 }
 
 TB_API void tb_free_loop_info(TB_LoopInfo l) {
-    dyn_array_destroy(l.loops);
+    tb_platform_heap_free(l.loops);
+}
+
+////////////////////////////////
+// Analysis cache
+////////////////////////////////
+TB_API const TB_Predeccesors* tb_function_get_cached_preds(TB_Function* f) {
+    if ((f->analysis_valid & TB_ANALYSIS_PREDS) == 0) {
+        f->cached_preds = tb_get_predeccesors(f);
+        f->analysis_valid |= TB_ANALYSIS_PREDS;
+    }
+
+    return &f->cached_preds;
+}
+
+TB_API const TB_DominatorTree* tb_function_get_cached_doms(TB_Function* f) {
+    if ((f->analysis_valid & TB_ANALYSIS_DOMS) == 0) {
+        f->cached_doms = tb_get_dominator_tree(f, *tb_function_get_cached_preds(f));
+        f->analysis_valid |= TB_ANALYSIS_DOMS;
+    }
+
+    return &f->cached_doms;
+}
+
+TB_API const TB_LoopInfo* tb_function_get_cached_loops(TB_Function* f) {
+    if ((f->analysis_valid & TB_ANALYSIS_LOOPS) == 0) {
+        const TB_DominatorTree* doms = tb_function_get_cached_doms(f);
+
+        f->cached_loops = tb_get_loop_info(f, f->cached_preds, doms);
+        f->analysis_valid |= TB_ANALYSIS_LOOPS;
+    }
+
+    return &f->cached_loops;
+}
+
+TB_API void tb_function_invalidate_analyses(TB_Function* f, uint32_t preserved) {
+    // dominators are built from the predecessors and loops from both
+    if ((preserved & TB_ANALYSIS_PREDS) == 0) preserved &= ~TB_ANALYSIS_DOMS;
+    if ((preserved & TB_ANALYSIS_DOMS) == 0) preserved &= ~TB_ANALYSIS_LOOPS;
+
+    uint32_t killed = f->analysis_valid & ~preserved;
+    if (killed & TB_ANALYSIS_LOOPS) {
+        tb_free_loop_info(f->cached_loops);
+        f->cached_loops = (TB_LoopInfo){ 0 };
+    }
+
+    if (killed & TB_ANALYSIS_DOMS) {
+        tb_free_dominator_tree(&f->cached_doms);
+    }
+
+    if (killed & TB_ANALYSIS_PREDS) {
+        tb_free_predeccesors(&f->cached_preds);
+    }
+
+    f->analysis_valid &= preserved;
 }
@@ -36,7 +36,7 @@ void* tb_atomic_ptr_exchange(void** address, void* new_value) {
 }
 
 bool tb_atomic_ptr_cmpxchg(void** address, void* old_value, void* new_value) {
-    return _InterlockedCompareExchangePointer(address, new_value, old_value) == new_value;
+    return _InterlockedCompareExchangePointer(address, new_value, old_value) == old_value;
 }
 #elif __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
 #include <stdatomic.h>
@@ -147,7 +147,7 @@ TB_API void tb_function_attrib_variable(TB_Function* f, TB_Reg r, const char* na
     assert(type != NULL);
 
     TB_Attrib* a = tb_make_attrib(f);
-    *a = (TB_Attrib) { .type = TB_ATTRIB_VARIABLE, .var = { tb_platform_string_alloc(name), type } };
+    *a = (TB_Attrib) { .type = TB_ATTRIB_VARIABLE, .var = { tb__intern_string(f->super.module, name), type } };
     append_attrib(f, r, a);
 }
 
@@ -163,6 +163,11 @@ static TB_Reg tb_make_reg(TB_Function* f, int type, TB_DataType dt) {
         .dt = dt
     };
 
+    // new edges in the CFG
+    if (TB_IS_NODE_TERMINATOR(type) && f->analysis_valid) {
+        tb_function_invalidate_analyses(f, 0);
+    }
+
     TB_BasicBlock* bb = &f->bbs[f->current_label];
     if (bb->start == 0) {
         bb->start = r;
@@ -472,7 +477,7 @@ TB_API TB_Reg tb_inst_float64(TB_Function* f, double imm) {
 }
 
 TB_API TB_Reg tb_inst_string(TB_Function* f, size_t len, const char* str) {
-    char* newstr = tb_platform_arena_alloc(len);
+    char* newstr = tb__arena_alloc(f->super.module, len);
     memcpy(newstr, str, len);
 
     TB_Reg r = tb_make_reg(f, TB_STRING_CONST, TB_TYPE_PTR);
@@ -482,7 +487,7 @@ TB_API TB_Reg tb_inst_string(TB_Function* f, size_t len, const char* str) {
 
 TB_API TB_Reg tb_inst_cstring(TB_Function* f, const char* str) {
     size_t len = strlen(str);
-    char* newstr = tb_platform_arena_alloc(len + 1);
+    char* newstr = tb__arena_alloc(f->super.module, len + 1);
     memcpy(newstr, str, len);
     newstr[len] = '\0';
 
@@ -1010,6 +1015,11 @@ TB_API TB_Label tb_basic_block_create(TB_Function* f) {
         if (f->bbs == NULL) tb_panic("tb_basic_block_create: Out of memory");
     }
 
+    // the cached analyses are sized by the block count
+    if (f->analysis_valid) {
+        tb_function_invalidate_analyses(f, 0);
+    }
+
     TB_Label bb = f->bb_count++;
     f->bbs[bb] = (TB_BasicBlock){ 0 };
     return bb;
@@ -0,0 +1,699 @@
+// On-disk code cache, entries are named after the md5 of the function's canonical IR
+// (see tb__code_cache_key) and hold everything tb_module_compile_function would've
+// made: the code, the symbol & constant patches, stack slots and line info.
+//
+// The directory can be shared by any number of processes, entries are written to a
+// temporary file and renamed into place so readers never see half of one. Reading an
+// entry bumps its mtime and once the directory grows past max_size the oldest ones go.
+#include "tb_internal.h"
+
+enum {
+    // bump this whenever the entry layout changes (or the key does)
+    CODE_CACHE_FORMAT = 1,
+
+    // "TBCE"
+    CODE_CACHE_MAGIC = 0x45434254,
+};
+
+// trimming doesn't stop at the limit, it makes some room so that it's not
+// happening again a few stores later.
+#define CODE_CACHE_TRIM_RATIO   0.75
+#define CODE_CACHE_DEFAULT_SIZE (256ull * 1024 * 1024)
+
+struct TB_CodeCache {
+    char* dir;
+    uint64_t max_size;
+
+    // size of the directory when it was last measured, plus what we've written since.
+    // other processes write here too so it's only an estimate, once it's over the limit
+    // the directory gets measured again (and trimmed if it needs to be).
+    tb_atomic_size_t size;
+    tb_atomic_int trim_lock;
+
+    tb_atomic_size_t temp_counter;
+};
+
+////////////////////////////////
+// Byte buffers
+////////////////////////////////
+// tb_outs but fine with empty (and NULL) data
+static void out_bytes(TB_Emitter* o, const void* data, size_t len) {
+    if (len) tb_outs(o, len, data);
+}
+
+static void out_string(TB_Emitter* o, const char* str) {
+    size_t len = str ? strlen(str) : 0;
+    tb_out4b(o, len);
+    out_bytes(o, str, len);
+}
+
+typedef struct {
+    const uint8_t* data;
+    size_t size, pos;
+
+    // set once anything reads past the end, every read after that gives back zeroes
+    bool failed;
+} EntryReader;
+
+static const void* entry_read(EntryReader* r, size_t size) {
+    if (r->failed || size > r->size - r->pos) {
+        r->failed = true;
+        return NULL;
+    }
+
+    const void* ptr = &r->data[r->pos];
+    r->pos += size;
+    return ptr;
+}
+
+static uint8_t entry_read_u8(EntryReader* r) {
+    const uint8_t* ptr = entry_read(r, sizeof(uint8_t));
+    return ptr ? *ptr : 0;
+}
+
+static uint32_t entry_read_u32(EntryReader* r) {
+    uint32_t x = 0;
+    const void* ptr = entry_read(r, sizeof(x));
+    if (ptr) memcpy(&x, ptr, sizeof(x));
+    return x;
+}
+
+static uint64_t entry_read_u64(EntryReader* r) {
+    uint64_t x = 0;
+    const void* ptr = entry_read(r, sizeof(x));
+    if (ptr) memcpy(&x, ptr, sizeof(x));
+    return x;
+}
+
+////////////////////////////////
+// Keys
+////////////////////////////////
+// symbols are looked up by address in an open addressing table (slots hold index+1)
+static uint32_t key_symbol_slot(const TB_CodeCacheKey* key, const TB_Symbol* s) {
+    size_t mask = key->symbol_table_capacity - 1;
+    size_t i = (((uintptr_t) s) >> 4) * 11400714819323198485ull;
+
+    for (;;) {
+        i &= mask;
+
+        uint32_t index = key->symbol_table[i];
+        if (index == 0 || key->symbols[index - 1] == s) return i;
+        i += 1;
+    }
+}
+
+static ptrdiff_t key_find_symbol(const TB_CodeCacheKey* key, const TB_Symbol* s) {
+    if (key->symbol_table_capacity == 0) return -1;
+
+    uint32_t index = key->symbol_table[key_symbol_slot(key, s)];
+    return (ptrdiff_t) index - 1;
+}
+
+// symbols are written by what the codegen cares about and not their name, the patches
+// refer to them by the order they first show up in.
+static void key_write_symbol(TB_CodeCacheKey* key, const TB_Symbol* s) {
+    if (key->symbol_count * 2 >= key->symbol_table_capacity) {
+        size_t old_capacity = key->symbol_table_capacity;
+        uint32_t* old_table = key->symbol_table;
+
+        key->symbol_table_capacity = old_capacity ? old_capacity * 2 : 64;
+        key->symbol_table = tb_platform_heap_alloc(key->symbol_table_capacity * sizeof(uint32_t));
+        memset(key->symbol_table, 0, key->symbol_table_capacity * sizeof(uint32_t));
+
+        FOREACH_N(i, 0, old_capacity) if (old_table[i] != 0) {
+            key->symbol_table[key_symbol_slot(key, key->symbols[old_table[i] - 1])] = old_table[i];
+        }
+
+        key->symbols = tb_platform_heap_realloc(key->symbols, key->symbol_table_capacity * sizeof(TB_Symbol*));
+        tb_platform_heap_free(old_table);
+    }
+
+    uint32_t slot = key_symbol_slot(key, s);
+    if (key->symbol_table[slot] == 0) {
+        key->symbols[key->symbol_count++] = s;
+        key->symbol_table[slot] = key->symbol_count;
+    }
+
+    tb_out4b(&key->ir, key->symbol_table[slot] - 1);
+    tb_out4b(&key->ir, s->tag);
+    if (s->tag == TB_SYMBOL_GLOBAL) {
+        tb_out4b(&key->ir, ((const TB_Global*) s)->storage);
+    }
+}
+
+static void key_write_file(TB_CodeCacheKey* key, TB_Module* m, TB_FileID file) {
+    size_t i = 0;
+    while (i < key->file_count && key->files[i] != file) i++;
+
+    if (i == key->file_count) {
+        if (key->file_count == key->file_capacity) {
+            key->file_capacity = key->file_capacity ? key->file_capacity * 2 : 8;
+            key->files = tb_platform_heap_realloc(key->files, key->file_capacity * sizeof(TB_FileID));
+        }
+
+        key->files[key->file_count++] = file;
+    }
+
+    tb_out4b(&key->ir, i);
+    out_string(&key->ir, m->files.data[file].path);
+}
+
+static uint32_t pack_features(const TB_FeatureSet* features) {
+    const bool bits[] = {
+        features->x64.sse3, features->x64.popcnt, features->x64.lzcnt, features->x64.sse41,
+        features->x64.sse42, features->x64.clmul, features->x64.f16c, features->x64.bmi1,
+        features->x64.bmi2, features->x64.avx, features->x64.avx2, features->aarch64.bf16,
+    };
+
+    uint32_t packed = 0;
+    FOREACH_N(i, 0, sizeof(bits) / sizeof(bits[0])) {
+        packed |= (uint32_t) bits[i] << i;
+    }
+    return packed;
+}
+
+bool tb__code_cache_key(TB_Module* m, TB_Function* f, TB_ISelMode isel_mode, TB_CodeCacheKey* key) {
+    *key = (TB_CodeCacheKey){ 0 };
+
+    // target & compiler
+    tb_out4b(&key->ir, CODE_CACHE_FORMAT);
+    tb_out4b(&key->ir, (TB_VERSION_MAJOR << 16) | (TB_VERSION_MINOR << 8) | TB_VERSION_PATCH);
+    tb_out4b(&key->ir, m->target_arch);
+    tb_out4b(&key->ir, m->target_system);
+    tb_out4b(&key->ir, m->target_abi);
+    tb_out4b(&key->ir, m->is_jit);
+    tb_out4b(&key->ir, pack_features(&m->features));
+    tb_out4b(&key->ir, isel_mode);
+
+    // the TLS accesses are patched against it
+    tb_out4b(&key->ir, m->tls_index_extern != NULL);
+    if (m->tls_index_extern != NULL) {
+        key_write_symbol(key, m->tls_index_extern);
+    }
+
+    // signature
+    const TB_FunctionPrototype* p = f->prototype;
+    tb_out4b(&key->ir, p->call_conv);
+    tb_out4b(&key->ir, p->return_dt.raw);
+    tb_out4b(&key->ir, p->has_varargs);
+    tb_out4b(&key->ir, p->param_count);
+    FOREACH_N(i, 0, p->param_count) {
+        tb_out4b(&key->ir, p->params[i].dt.raw);
+        tb_out4b(&key->ir, f->params[i]);
+    }
+
+    tb_out8b(&key->ir, f->bb_count);
+    out_bytes(&key->ir, f->bbs, f->bb_count * sizeof(TB_BasicBlock));
+
+    tb_out8b(&key->ir, f->vla.count);
+    out_bytes(&key->ir, f->vla.data, f->vla.count * sizeof(TB_Reg));
+
+    // the nodes are written by value except for the pointers, those get replaced
+    // with what they point to.
+    tb_out8b(&key->ir, f->node_count);
+    FOREACH_N(r, 0, f->node_count) {
+        TB_Node* n = &f->nodes[r];
+
+        // a variable attribute on a local makes it a stack slot
+        bool has_variable = false;
+        for (TB_Attrib* a = n->first_attrib; a != NULL; a = a->next) {
+            if (a->type == TB_ATTRIB_VARIABLE) has_variable = true;
+        }
+
+        tb_out4b(&key->ir, n->type | (n->dt.raw << 8) | ((uint32_t) has_variable << 24));
+        tb_out4b(&key->ir, n->next);
+
+        switch (n->type) {
+            case TB_INTEGER_CONST: {
+                tb_out8b(&key->ir, n->integer.num_words);
+                if (n->integer.num_words == 1) {
+                    tb_out8b(&key->ir, n->integer.single_word);
+                } else {
+                    out_bytes(&key->ir, n->integer.words, n->integer.num_words * sizeof(uint64_t));
+                }
+                break;
+            }
+            case TB_STRING_CONST: {
+                tb_out8b(&key->ir, n->string.length);
+                out_bytes(&key->ir, n->string.data, n->string.length);
+                break;
+            }
+            case TB_LINE_INFO: {
+                key_write_file(key, m, n->line_info.file);
+                tb_out4b(&key->ir, n->line_info.line);
+                break;
+            }
+            case TB_GET_SYMBOL_ADDRESS: {
+                key_write_symbol(key, n->sym.value);
+                break;
+            }
+            case TB_CALL:
+            case TB_ICALL: {
+                tb_out4b(&key->ir, n->call.param_start);
+                tb_out4b(&key->ir, n->call.param_end);
+                key_write_symbol(key, n->call.target);
+                break;
+            }
+            case TB_PHIN: {
+                tb_out8b(&key->ir, n->phi.count);
+                out_bytes(&key->ir, n->phi.inputs, n->phi.count * sizeof(TB_PhiInput));
+                break;
+            }
+            case TB_INITIALIZE: {
+                // the codegen only handles zeroing ones anyways
+                if (n->init.src->obj_count != 0) goto fail;
+
+                tb_out4b(&key->ir, n->init.addr);
+                tb_out4b(&key->ir, n->init.src->size);
+                tb_out4b(&key->ir, n->init.src->align);
+                break;
+            }
+            default: {
+                out_bytes(&key->ir, n->raw_operands, sizeof(n->raw_operands));
+                break;
+            }
+        }
+    }
+
+    tb__md5sum(key->hash, key->ir.data, key->ir.count);
+    return true;
+
+    fail:
+    tb__code_cache_key_free(key);
+    return false;
+}
+
+void tb__code_cache_key_free(TB_CodeCacheKey* key) {
+    tb_platform_heap_free(key->ir.data);
+    tb_platform_heap_free(key->symbols);
+    tb_platform_heap_free(key->symbol_table);
+    tb_platform_heap_free(key->files);
+    *key = (TB_CodeCacheKey){ 0 };
+}
+
+////////////////////////////////
+// Eviction
+////////////////////////////////
+typedef struct {
+    char* name;
+    uint64_t size, mtime;
+} CacheFile;
+
+typedef struct {
+    size_t count, capacity;
+    CacheFile* files;
+    uint64_t total;
+} CacheListing;
+
+static bool is_hex_name(const char* name, size_t len) {
+    FOREACH_N(i, 0, len) {
+        char ch = name[i];
+        if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f'))) return false;
+    }
+
+    return true;
+}
+
+static bool is_digits(const char* str, const char* end) {
+    if (str == end) return false;
+    for (; str != end; str++) {
+        if (*str < '0' || *str > '9') return false;
+    }
+
+    return true;
+}
+
+// the directory might have other things in it, we only count (and delete) entries
+// which are 32 hex digits and the temporaries stores leave behind when they die
+// halfway (<entry>.<pid>-<counter>.tmp)
+static bool is_cache_file(const char* name) {
+    size_t len = strlen(name);
+    if (len < 32 || !is_hex_name(name, 32)) return false;
+    if (len == 32) return true;
+
+    const char* rest = &name[32];
+    const char* dash = strchr(rest, '-');
+    const char* ext = &name[len - 4];
+    return len > 36 && rest[0] == '.' && strcmp(ext, ".tmp") == 0 &&
+        dash != NULL && dash < ext && is_digits(rest + 1, dash) && is_digits(dash + 1, ext);
+}
+
+static void list_cache_file(void* user_data, const char* name, uint64_t size, uint64_t mtime) {
+    CacheListing* l = user_data;
+    if (!is_cache_file(name)) return;
+
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : 256;
+        l->files = tb_platform_heap_realloc(l->files, l->capacity * sizeof(CacheFile));
+    }
+
+    size_t len = strlen(name);
+    char* copy = tb_platform_heap_alloc(len + 1);
+    memcpy(copy, name, len + 1);
+
+    l->files[l->count++] = (CacheFile){ copy, size, mtime };
+    l->total += size;
+}
+
+static int compare_cache_file(const void* a, const void* b) {
+    const CacheFile* fa = a;
+    const CacheFile* fb = b;
+    return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+// measures the directory and deletes the least recently used entries until it's
+// comfortably under the limit. Only one thread does this at a time, the rest just
+// keep going.
+static void code_cache_trim(TB_CodeCache* cache) {
+    if (tb_atomic_int_store(&cache->trim_lock, 1)) return;
+
+    CacheListing l = { 0 };
+    if (tb_platform_list_dir(cache->dir, list_cache_file, &l)) {
+        if (l.total > cache->max_size) {
+            qsort(l.files, l.count, sizeof(CacheFile), compare_cache_file);
+
+            uint64_t goal = cache->max_size * CODE_CACHE_TRIM_RATIO;
+            for (size_t i = 0; i < l.count && l.total > goal; i++) {
+                char path[FILENAME_MAX];
+                if (snprintf(path, FILENAME_MAX, "%s/%s", cache->dir, l.files[i].name) >= FILENAME_MAX) continue;
+
+                // someone else might've gotten to it first
+                if (remove(path) == 0) l.total -= l.files[i].size;
+            }
+        }
+
+        tb_atomic_size_store(&cache->size, l.total);
+    }
+
+    FOREACH_N(i, 0, l.count) tb_platform_heap_free(l.files[i].name);
+    tb_platform_heap_free(l.files);
+    tb_atomic_int_store(&cache->trim_lock, 0);
+}
+
+TB_API TB_CodeCache* tb_code_cache_open(const char* dir, uint64_t max_size) {
+    if (!tb_platform_make_dir(dir)) return NULL;
+
+    TB_CodeCache* cache = tb_platform_heap_alloc(sizeof(TB_CodeCache));
+    *cache = (TB_CodeCache){ .max_size = max_size ? max_size : CODE_CACHE_DEFAULT_SIZE };
+
+    size_t len = strlen(dir);
+    cache->dir = tb_platform_heap_alloc(len + 1);
+    memcpy(cache->dir, dir, len + 1);
+
+    code_cache_trim(cache);
+    return cache;
+}
+
+TB_API void tb_code_cache_close(TB_CodeCache* cache) {
+    tb_platform_heap_free(cache->dir);
+    tb_platform_heap_free(cache);
+}
+
+TB_API void tb_module_set_code_cache(TB_Module* m, TB_CodeCache* cache) {
+    m->code_cache = cache;
+}
+
+////////////////////////////////
+// Entries
+////////////////////////////////
+// native endian (the target is part of the key anyways):
+//   u32 magic, u64 key size, key
+//   u64 code size, u8 prologue length, u8 epilogue length, u64 metadata, u64 stack usage, code
+//   u32 count, { u32 pos, u32 symbol index, u8 is_function } symbol patches
+//   u32 count, { u32 pos, u32 length, data } constants
+//   u32 count, { i32 source, i32 position } stack slots
+//   u32 count, { u32 file index, i32 line, u32 pos } lines
+enum {
+    ENTRY_SYMBOL_PATCH_SIZE = 9,
+    ENTRY_STACK_SLOT_SIZE = 8,
+    ENTRY_LINE_SIZE = 12,
+};
+
+// false if the path doesn't fit
+static bool entry_path(TB_CodeCache* cache, const TB_CodeCacheKey* key, char path[FILENAME_MAX]) {
+    char hex[33];
+    FOREACH_N(i, 0, 16) {
+        snprintf(&hex[i * 2], 3, "%02x", key->hash[i]);
+    }
+
+    return snprintf(path, FILENAME_MAX, "%s/%s", cache->dir, hex) < FILENAME_MAX;
+}
+
+static uint8_t* read_whole_file(const char* path, size_t* out_size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = NULL;
+    if (size > 0) {
+        data = tb_platform_heap_alloc(size);
+        if (fread(data, 1, size, file) != (size_t) size) {
+            tb_platform_heap_free(data);
+            data = NULL;
+        }
+    }
+
+    fclose(file);
+    *out_size = size;
+    return data;
+}
+
+// the stack slot names & types come from the IR, the entry only knows where they went
+static TB_StackSlot rebuild_stack_slot(TB_Module* m, TB_Function* f, TB_Reg r, int pos) {
+    TB_StackSlot slot = { r, pos };
+    if (r <= 0 || r >= f->node_count) return slot;
+
+    TB_Node* n = &f->nodes[r];
+    if (n->type == TB_PARAM_ADDR) {
+        const TB_PrototypeParam* proto_param = &f->prototype->params[f->nodes[n->param_addr.param].param.id];
+        slot.name = proto_param->name;
+        slot.storage_type = proto_param->debug_type ? proto_param->debug_type : tb_debug_get_void(m);
+    } else if (n->type == TB_LOCAL) {
+        for (TB_Attrib* attrib = n->first_attrib; attrib != NULL; attrib = attrib->next) {
+            if (attrib->type == TB_ATTRIB_VARIABLE) {
+                slot.name = attrib->var.name;
+                slot.storage_type = attrib->var.storage;
+                break;
+            }
+        }
+    }
+
+    return slot;
+}
+
+bool tb__code_cache_load(TB_Module* m, TB_Function* f, const TB_CodeCacheKey* key, TB_FunctionOutput* out) {
+    TB_CodeCache* cache = m->code_cache;
+
+    char path[FILENAME_MAX];
+    if (!entry_path(cache, key, path)) return false;
+
+    size_t size;
+    uint8_t* data = read_whole_file(path, &size);
+    if (data == NULL) return false;
+
+    EntryReader r = { data, size };
+    bool valid = false;
+
+    // the whole key is in there, this catches hash collisions & corrupted files
+    if (entry_read_u32(&r) != CODE_CACHE_MAGIC) goto done;
+    if (entry_read_u64(&r) != key->ir.count) goto done;
+    const void* stored_key = entry_read(&r, key->ir.count);
+    if (stored_key == NULL || memcmp(stored_key, key->ir.data, key->ir.count) != 0) goto done;
+
+    size_t code_size = entry_read_u64(&r);
+    uint8_t prologue_length = entry_read_u8(&r);
+    uint8_t epilogue_length = entry_read_u8(&r);
+    uint64_t meta = entry_read_u64(&r);
+    uint64_t stack_usage = entry_read_u64(&r);
+    const uint8_t* code = entry_read(&r, code_size);
+    if (code == NULL) goto done;
+
+    // check everything before any patches are emitted, those can't be taken back
+    size_t symbol_patch_count = entry_read_u32(&r);
+    const uint8_t* symbol_patches = entry_read(&r, symbol_patch_count * ENTRY_SYMBOL_PATCH_SIZE);
+
+    size_t const_patch_count = entry_read_u32(&r);
+    size_t const_patches_start = r.pos;
+    FOREACH_N(i, 0, const_patch_count) {
+        uint32_t pos = entry_read_u32(&r);
+        uint32_t len = entry_read_u32(&r);
+        if (entry_read(&r, len) == NULL || (size_t) prologue_length + pos + 4 > code_size) goto done;
+    }
+
+    size_t stack_slot_count = entry_read_u32(&r);
+    const uint8_t* stack_slots = entry_read(&r, stack_slot_count * ENTRY_STACK_SLOT_SIZE);
+
+    size_t line_count = entry_read_u32(&r);
+    const uint8_t* lines = entry_read(&r, line_count * ENTRY_LINE_SIZE);
+    if (r.failed || r.pos != r.size) goto done;
+
+    FOREACH_N(i, 0, symbol_patch_count) {
+        uint32_t pos, index;
+        memcpy(&pos, &symbol_patches[i*ENTRY_SYMBOL_PATCH_SIZE + 0], 4);
+        memcpy(&index, &symbol_patches[i*ENTRY_SYMBOL_PATCH_SIZE + 4], 4);
+        if (index >= key->symbol_count || (size_t) prologue_length + pos + 4 > code_size) goto done;
+    }
+
+    FOREACH_N(i, 0, line_count) {
+        uint32_t file;
+        memcpy(&file, &lines[i*ENTRY_LINE_SIZE + 0], 4);
+        if (file >= key->file_count) goto done;
+    }
+
+    // place the code
+    size_t capacity;
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+    TB_CodeRegion* region = info->code_region;
+    uint8_t* base = tb__code_region_grow(m, &region->data[region->size], 0, code_size, &capacity);
+    memcpy(base, code, code_size);
+
+    *out = (TB_FunctionOutput){
+        .linkage = f->linkage,
+        .prologue_length = prologue_length,
+        .epilogue_length = epilogue_length,
+        .prologue_epilogue_metadata = meta,
+        .stack_usage = stack_usage,
+        .code = base,
+        .code_size = code_size,
+        .stack_slots = dyn_array_create_with_initial_cap(TB_StackSlot, stack_slot_count ? stack_slot_count : 1),
+    };
+
+    FOREACH_N(i, 0, symbol_patch_count) {
+        uint32_t pos, index;
+        memcpy(&pos, &symbol_patches[i*ENTRY_SYMBOL_PATCH_SIZE + 0], 4);
+        memcpy(&index, &symbol_patches[i*ENTRY_SYMBOL_PATCH_SIZE + 4], 4);
+
+        tb_emit_symbol_patch(m, f, key->symbols[index], pos, symbol_patches[i*ENTRY_SYMBOL_PATCH_SIZE + 8]);
+    }
+
+    // constants get a new spot in the rdata section
+    r.pos = const_patches_start;
+    FOREACH_N(i, 0, const_patch_count) {
+        uint32_t pos = entry_read_u32(&r);
+        uint32_t len = entry_read_u32(&r);
+
+        void* payload = tb__arena_alloc(m, len);
+        memcpy(payload, entry_read(&r, len), len);
+
+        uint32_t disp = tb_emit_const_patch(m, f, pos, payload, len);
+        memcpy(&base[prologue_length + pos], &disp, sizeof(disp));
+    }
+
+    FOREACH_N(i, 0, stack_slot_count) {
+        int32_t source, pos;
+        memcpy(&source, &stack_slots[i*ENTRY_STACK_SLOT_SIZE + 0], 4);
+        memcpy(&pos, &stack_slots[i*ENTRY_STACK_SLOT_SIZE + 4], 4);
+
+        dyn_array_put(out->stack_slots, rebuild_stack_slot(m, f, source, pos));
+    }
+
+    f->line_count = line_count;
+    f->lines = tb__arena_alloc(m, line_count * sizeof(TB_Line));
+    FOREACH_N(i, 0, line_count) {
+        uint32_t file, pos;
+        int32_t line;
+        memcpy(&file, &lines[i*ENTRY_LINE_SIZE + 0], 4);
+        memcpy(&line, &lines[i*ENTRY_LINE_SIZE + 4], 4);
+        memcpy(&pos, &lines[i*ENTRY_LINE_SIZE + 8], 4);
+
+        f->lines[i] = (TB_Line){ key->files[file], line, pos };
+    }
+
+    valid = true;
+    tb_platform_touch_file(path);
+
+    done:
+    tb_platform_heap_free(data);
+    return valid;
+}
+
+void tb__code_cache_store(TB_Module* m, TB_Function* f, const TB_CodeCacheKey* key, const TB_FunctionOutput* out, TB_PatchMark symbol_mark, TB_PatchMark const_mark) {
+    TB_CodeCache* cache = m->code_cache;
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+
+    TB_Emitter entry = { 0 };
+    tb_out4b(&entry, CODE_CACHE_MAGIC);
+    tb_out8b(&entry, key->ir.count);
+    tb_outs(&entry, key->ir.count, key->ir.data);
+
+    tb_out8b(&entry, out->code_size);
+    tb_out1b(&entry, out->prologue_length);
+    tb_out1b(&entry, out->epilogue_length);
+    tb_out8b(&entry, out->prologue_epilogue_metadata);
+    tb_out8b(&entry, out->stack_usage);
+
+    size_t code_start = entry.count;
+    tb_outs(&entry, out->code_size, out->code);
+
+    size_t count_pos = entry.count;
+    uint32_t count = 0;
+    tb_out4b(&entry, 0);
+    for (TB_SymbolPatch* p; (p = tb__patch_mark_next(&info->symbol_patches, &symbol_mark, sizeof(TB_SymbolPatch))) != NULL;) {
+        // the codegen went and referenced something that's not in the IR, can't store that
+        ptrdiff_t index = key_find_symbol(key, p->target);
+        if (index < 0) goto done;
+
+        tb_out4b(&entry, p->pos);
+        tb_out4b(&entry, index);
+        tb_out1b(&entry, p->is_function);
+        count++;
+    }
+    tb_patch4b(&entry, count_pos, count);
+
+    count_pos = entry.count, count = 0;
+    tb_out4b(&entry, 0);
+    for (TB_ConstPoolPatch* p; (p = tb__patch_mark_next(&info->const_patches, &const_mark, sizeof(TB_ConstPoolPatch))) != NULL;) {
+        tb_out4b(&entry, p->pos);
+        tb_out4b(&entry, p->length);
+        out_bytes(&entry, p->data, p->length);
+
+        // the rdata position is different every time, leave it out so the
+        // same function always makes the same entry.
+        memset(&entry.data[code_start + out->prologue_length + p->pos], 0, sizeof(uint32_t));
+        count++;
+    }
+    tb_patch4b(&entry, count_pos, count);
+
+    tb_out4b(&entry, dyn_array_length(out->stack_slots));
+    dyn_array_for(i, out->stack_slots) {
+        tb_out4b(&entry, out->stack_slots[i].source);
+        tb_out4b(&entry, out->stack_slots[i].position);
+    }
+
+    tb_out4b(&entry, f->line_count);
+    FOREACH_N(i, 0, f->line_count) {
+        size_t file = 0;
+        while (file < key->file_count && key->files[file] != f->lines[i].file) file++;
+        if (file == key->file_count) goto done;
+
+        tb_out4b(&entry, file);
+        tb_out4b(&entry, f->lines[i].line);
+        tb_out4b(&entry, f->lines[i].pos);
+    }
+
+    // the temporary is unique to the process & store so nobody else can be writing it
+    char path[FILENAME_MAX], temp_path[FILENAME_MAX];
+    if (!entry_path(cache, key, path)) goto done;
+    if (snprintf(temp_path, FILENAME_MAX, "%s.%d-%zu.tmp", path, tb_platform_process_id(), tb_atomic_size_add(&cache->temp_counter, 1)) >= FILENAME_MAX) goto done;
+
+    FILE* file = fopen(temp_path, "wb");
+    if (file == NULL) goto done;
+
+    bool written = fwrite(entry.data, 1, entry.count, file) == entry.count;
+    if (fclose(file) != 0) written = false;
+
+    if (!written || !tb_platform_replace_file(temp_path, path)) {
+        remove(temp_path);
+        goto done;
+    }
+
+    if (tb_atomic_size_add(&cache->size, entry.count) + entry.count > cache->max_size) {
+        code_cache_trim(cache);
+    }
+
+    done:
+    tb_platform_heap_free(entry.data);
+}
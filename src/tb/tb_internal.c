@@ -1,7 +1,146 @@
 #include "tb_internal.h"
 
 // IR ANALYSIS
-void tb_function_calculate_use_count(const TB_Function* f, int use_count[]) {
+static bool is_use_storage(TB_Function* f, TB_Reg* users) {
+    return users >= f->use_storage && users < &f->use_storage[f->use_storage_count];
+}
+
+static void use_list_add(TB_Function* f, TB_Reg def, TB_Reg user) {
+    TB_UseList* l = &f->uses[def];
+
+    if (l->count == l->capacity) {
+        int new_cap = l->capacity ? l->capacity * 2 : 4;
+
+        if (l->users == NULL || is_use_storage(f, l->users)) {
+            // move out of the shared storage
+            TB_Reg* users = tb_platform_heap_alloc(new_cap * sizeof(TB_Reg));
+            if (l->count) memcpy(users, l->users, l->count * sizeof(TB_Reg));
+            l->users = users;
+        } else {
+            l->users = tb_platform_heap_realloc(l->users, new_cap * sizeof(TB_Reg));
+        }
+
+        l->capacity = new_cap;
+    }
+
+    l->users[l->count++] = user;
+}
+
+static void use_list_remove(TB_Function* f, TB_Reg def, TB_Reg user) {
+    TB_UseList* l = &f->uses[def];
+
+    FOREACH_N(i, 0, l->count) {
+        if (l->users[i] == user) {
+            l->users[i] = l->users[--l->count];
+            return;
+        }
+    }
+}
+
+// registers all the nodes which were added since the last sync
+static void sync_uses(TB_Function* f) {
+    if (f->use_capacity < f->node_capacity) {
+        f->uses = tb_platform_heap_realloc(f->uses, f->node_capacity * sizeof(TB_UseList));
+        memset(&f->uses[f->use_capacity], 0, (f->node_capacity - f->use_capacity) * sizeof(TB_UseList));
+        f->use_capacity = f->node_capacity;
+    }
+
+    FOREACH_N(r, f->use_watermark, f->node_count) {
+        TB_FOR_INPUT_IN_REG(it, f, r) {
+            use_list_add(f, it.r, r);
+        }
+    }
+
+    f->use_watermark = f->node_count;
+}
+
+void tb_function_build_uses(TB_Function* f) {
+    if (f->uses != NULL) {
+        sync_uses(f);
+        return;
+    }
+
+    f->use_capacity = f->node_capacity;
+    f->uses = tb_platform_heap_alloc(f->use_capacity * sizeof(TB_UseList));
+    memset(f->uses, 0, f->use_capacity * sizeof(TB_UseList));
+
+    // count the uses first so that all the lists can share one allocation
+    size_t total = 0;
+    TB_FOR_BASIC_BLOCK(bb, f) {
+        TB_FOR_NODE(r, f, bb) {
+            TB_FOR_INPUT_IN_REG(it, f, r) {
+                f->uses[it.r].capacity += 1;
+                total += 1;
+            }
+        }
+    }
+
+    f->use_storage_count = total;
+    f->use_storage = total ? tb_platform_heap_alloc(total * sizeof(TB_Reg)) : NULL;
+
+    size_t pos = 0;
+    FOREACH_N(i, 0, f->node_count) {
+        if (f->uses[i].capacity) {
+            f->uses[i].users = &f->use_storage[pos];
+            pos += f->uses[i].capacity;
+        }
+    }
+
+    TB_FOR_BASIC_BLOCK(bb, f) {
+        TB_FOR_NODE(r, f, bb) {
+            TB_FOR_INPUT_IN_REG(it, f, r) {
+                TB_UseList* l = &f->uses[it.r];
+                l->users[l->count++] = r;
+            }
+        }
+    }
+
+    f->use_watermark = f->node_count;
+}
+
+void tb_function_free_uses(TB_Function* f) {
+    if (f->uses == NULL) return;
+
+    FOREACH_N(i, 0, f->use_capacity) {
+        TB_Reg* users = f->uses[i].users;
+        if (users != NULL && !is_use_storage(f, users)) tb_platform_heap_free(users);
+    }
+
+    tb_platform_heap_free(f->use_storage);
+    tb_platform_heap_free(f->uses);
+
+    f->uses = NULL;
+    f->use_storage = NULL;
+    f->use_storage_count = 0;
+    f->use_capacity = f->use_watermark = 0;
+}
+
+const TB_UseList* tb_function_get_uses(TB_Function* f, TB_Reg r) {
+    assert(f->uses != NULL);
+
+    sync_uses(f);
+    return &f->uses[r];
+}
+
+void tb__remove_input_uses(TB_Function* f, TB_Reg r) {
+    // it was never registered
+    if (r >= f->use_watermark) return;
+
+    TB_FOR_INPUT_IN_REG(it, f, r) {
+        use_list_remove(f, it.r, r);
+    }
+}
+
+void tb_function_calculate_use_count(TB_Function* f, int use_count[]) {
+    if (f->uses != NULL) {
+        sync_uses(f);
+
+        FOREACH_N(i, 0, f->node_count) {
+            use_count[i] = f->uses[i].count;
+        }
+        return;
+    }
+
     for (size_t i = 0; i < f->node_count; i++) {
         use_count[i] = 0;
     }
@@ -17,7 +156,14 @@ void tb_function_calculate_use_count(const TB_Function* f, int use_count[]) {
     }
 }
 
-int tb_function_find_uses_of_node(const TB_Function* f, TB_Reg def, TB_Reg uses[]) {
+int tb_function_find_uses_of_node(TB_Function* f, TB_Reg def, TB_Reg uses[]) {
+    if (f->uses != NULL) {
+        const TB_UseList* l = tb_function_get_uses(f, def);
+
+        memcpy(uses, l->users, l->count * sizeof(TB_Reg));
+        return l->count;
+    }
+
     size_t count = 0;
 
     TB_FOR_BASIC_BLOCK(bb, f) {
@@ -33,193 +179,256 @@ int tb_function_find_uses_of_node(const TB_Function* f, TB_Reg def, TB_Reg uses[
     return count;
 }
 
-void tb_function_find_replace_reg(TB_Function* f, TB_Reg find, TB_Reg replace) {
-    #define X(reg) if (reg == find) reg = replace;
-
-    TB_FOR_BASIC_BLOCK(bb, f) {
-        TB_FOR_NODE(r, f, bb) {
-            TB_Node* n = &f->nodes[r];
-
-            switch (n->type) {
-                case TB_NULL:
-                case TB_INTEGER_CONST:
-                case TB_FLOAT32_CONST:
-                case TB_FLOAT64_CONST:
-                case TB_STRING_CONST:
-                case TB_LOCAL:
-                case TB_PARAM:
-                case TB_GOTO:
-                case TB_LINE_INFO:
-                case TB_GET_SYMBOL_ADDRESS:
-                case TB_X86INTRIN_STMXCSR:
-                case TB_UNREACHABLE:
-                case TB_DEBUGBREAK:
-                case TB_TRAP:
-                case TB_POISON:
-                break;
-
-                case TB_INITIALIZE:
-                X(n->init.addr);
-                break;
-
-                case TB_KEEPALIVE:
-                case TB_VA_START:
-                case TB_NOT:
-                case TB_NEG:
-                case TB_X86INTRIN_SQRT:
-                case TB_X86INTRIN_RSQRT:
-                case TB_INT2PTR:
-                case TB_PTR2INT:
-                case TB_UINT2FLOAT:
-                case TB_FLOAT2UINT:
-                case TB_INT2FLOAT:
-                case TB_FLOAT2INT:
-                case TB_TRUNCATE:
-                case TB_X86INTRIN_LDMXCSR:
-                case TB_BITCAST:
-                case TB_CLZ:
-                X(n->unary.src);
-                break;
-
-                case TB_ATOMIC_LOAD:
-                case TB_ATOMIC_XCHG:
-                case TB_ATOMIC_ADD:
-                case TB_ATOMIC_SUB:
-                case TB_ATOMIC_AND:
-                case TB_ATOMIC_XOR:
-                case TB_ATOMIC_OR:
-                case TB_ATOMIC_CMPXCHG:
-                X(n->atomic.addr);
-                X(n->atomic.src);
-                break;
-
-                case TB_ATOMIC_CMPXCHG2:
-                X(n->atomic.src);
-                break;
+size_t tb_count_uses(TB_Function* f, TB_Reg find, size_t start, size_t end) {
+    size_t count = 0;
 
-                case TB_MEMCPY:
-                case TB_MEMSET:
-                X(n->mem_op.dst);
-                X(n->mem_op.src);
-                X(n->mem_op.size);
-                break;
+    if (f->uses != NULL) {
+        const TB_UseList* l = tb_function_get_uses(f, find);
 
-                case TB_MEMBER_ACCESS:
-                X(n->member_access.base);
-                break;
+        FOREACH_N(i, 0, l->count) {
+            count += (l->users[i] >= start && l->users[i] < end);
+        }
+        return count;
+    }
 
-                case TB_ARRAY_ACCESS:
-                X(n->array_access.base);
-                X(n->array_access.index);
-                break;
+    FOREACH_N(r, start, end) {
+        TB_FOR_INPUT_IN_REG(it, f, r) {
+            count += (it.r == find);
+        }
+    }
 
-                case TB_PARAM_ADDR:
-                X(n->param_addr.param);
-                break;
+    return count;
+}
 
-                case TB_PASS:
-                X(n->pass.value);
-                break;
+TB_Reg tb_find_first_use(TB_Function* f, TB_Reg find, size_t start, size_t end) {
+    if (f->uses != NULL) {
+        const TB_UseList* l = tb_function_get_uses(f, find);
 
-                case TB_PHI1:
-                X(n->phi1.inputs[0].val);
-                break;
+        TB_Reg first = TB_NULL_REG;
+        FOREACH_N(i, 0, l->count) {
+            TB_Reg r = l->users[i];
+            if (r >= start && r < end && (first == TB_NULL_REG || r < first)) first = r;
+        }
+        return first;
+    }
 
-                case TB_PHI2:
-                FOREACH_N(it, 0, 2) {
-                    X(n->phi2.inputs[it].val);
-                }
-                break;
+    FOREACH_N(r, start, end) {
+        TB_FOR_INPUT_IN_REG(it, f, r) {
+            if (it.r == find) return r;
+        }
+    }
 
-                case TB_PHIN:
-                FOREACH_N(it, 0, n->phi.count) {
-                    X(n->phi.inputs[it].val);
-                }
-                break;
+    return TB_NULL_REG;
+}
 
-                case TB_LOAD:
-                X(n->load.address);
-                break;
+static void replace_in_node(TB_Function* f, TB_Node* n, TB_Reg find, TB_Reg replace) {
+    #define X(reg) if (reg == find) reg = replace;
 
-                case TB_STORE:
-                X(n->store.address);
-                X(n->store.value);
-                break;
+    switch (n->type) {
+        case TB_NULL:
+        case TB_INTEGER_CONST:
+        case TB_FLOAT32_CONST:
+        case TB_FLOAT64_CONST:
+        case TB_STRING_CONST:
+        case TB_LOCAL:
+        case TB_PARAM:
+        case TB_GOTO:
+        case TB_LINE_INFO:
+        case TB_GET_SYMBOL_ADDRESS:
+        case TB_X86INTRIN_STMXCSR:
+        case TB_UNREACHABLE:
+        case TB_DEBUGBREAK:
+        case TB_TRAP:
+        case TB_POISON:
+        break;
+
+        case TB_INITIALIZE:
+        X(n->init.addr);
+        break;
+
+        case TB_KEEPALIVE:
+        case TB_VA_START:
+        case TB_NOT:
+        case TB_NEG:
+        case TB_X86INTRIN_SQRT:
+        case TB_X86INTRIN_RSQRT:
+        case TB_INT2PTR:
+        case TB_PTR2INT:
+        case TB_UINT2FLOAT:
+        case TB_FLOAT2UINT:
+        case TB_INT2FLOAT:
+        case TB_FLOAT2INT:
+        case TB_TRUNCATE:
+        case TB_X86INTRIN_LDMXCSR:
+        case TB_BITCAST:
+        case TB_CLZ:
+        X(n->unary.src);
+        break;
+
+        case TB_ATOMIC_LOAD:
+        case TB_ATOMIC_XCHG:
+        case TB_ATOMIC_ADD:
+        case TB_ATOMIC_SUB:
+        case TB_ATOMIC_AND:
+        case TB_ATOMIC_XOR:
+        case TB_ATOMIC_OR:
+        case TB_ATOMIC_CMPXCHG:
+        X(n->atomic.addr);
+        X(n->atomic.src);
+        break;
+
+        case TB_ATOMIC_CMPXCHG2:
+        X(n->atomic.src);
+        break;
+
+        case TB_MEMCPY:
+        case TB_MEMSET:
+        X(n->mem_op.dst);
+        X(n->mem_op.src);
+        X(n->mem_op.size);
+        break;
+
+        case TB_MEMBER_ACCESS:
+        X(n->member_access.base);
+        break;
+
+        case TB_ARRAY_ACCESS:
+        X(n->array_access.base);
+        X(n->array_access.index);
+        break;
+
+        case TB_PARAM_ADDR:
+        X(n->param_addr.param);
+        break;
+
+        case TB_PASS:
+        X(n->pass.value);
+        break;
+
+        case TB_PHI1:
+        X(n->phi1.inputs[0].val);
+        break;
+
+        case TB_PHI2:
+        FOREACH_N(it, 0, 2) {
+            X(n->phi2.inputs[it].val);
+        }
+        break;
 
-                case TB_ZERO_EXT:
-                case TB_SIGN_EXT:
-                case TB_FLOAT_EXT:
-                X(n->unary.src);
-                break;
+        case TB_PHIN:
+        FOREACH_N(it, 0, n->phi.count) {
+            X(n->phi.inputs[it].val);
+        }
+        break;
+
+        case TB_LOAD:
+        X(n->load.address);
+        break;
+
+        case TB_STORE:
+        X(n->store.address);
+        X(n->store.value);
+        break;
+
+        case TB_ZERO_EXT:
+        case TB_SIGN_EXT:
+        case TB_FLOAT_EXT:
+        X(n->unary.src);
+        break;
+
+        case TB_AND:
+        case TB_OR:
+        case TB_XOR:
+        case TB_ADD:
+        case TB_SUB:
+        case TB_MUL:
+        case TB_UDIV:
+        case TB_SDIV:
+        case TB_UMOD:
+        case TB_SMOD:
+        case TB_SAR:
+        case TB_SHL:
+        case TB_SHR:
+        X(n->i_arith.a);
+        X(n->i_arith.b);
+        break;
+
+        case TB_FADD:
+        case TB_FSUB:
+        case TB_FMUL:
+        case TB_FDIV:
+        X(n->f_arith.a);
+        X(n->f_arith.b);
+        break;
+
+        case TB_CMP_EQ:
+        case TB_CMP_NE:
+        case TB_CMP_SLT:
+        case TB_CMP_SLE:
+        case TB_CMP_ULT:
+        case TB_CMP_ULE:
+        case TB_CMP_FLT:
+        case TB_CMP_FLE:
+        X(n->cmp.a);
+        X(n->cmp.b);
+        break;
+
+        case TB_SCALL: {
+            X(n->scall.target);
+
+            FOREACH_N(it, n->scall.param_start, n->scall.param_end) {
+                X(f->vla.data[it]);
+            }
+            break;
+        }
 
-                case TB_AND:
-                case TB_OR:
-                case TB_XOR:
-                case TB_ADD:
-                case TB_SUB:
-                case TB_MUL:
-                case TB_UDIV:
-                case TB_SDIV:
-                case TB_UMOD:
-                case TB_SMOD:
-                case TB_SAR:
-                case TB_SHL:
-                case TB_SHR:
-                X(n->i_arith.a);
-                X(n->i_arith.b);
-                break;
+        case TB_VCALL: {
+            X(n->vcall.target);
 
-                case TB_FADD:
-                case TB_FSUB:
-                case TB_FMUL:
-                case TB_FDIV:
-                X(n->f_arith.a);
-                X(n->f_arith.b);
-                break;
+            FOREACH_N(it, n->vcall.param_start, n->vcall.param_end) {
+                X(f->vla.data[it]);
+            }
+            break;
+        }
 
-                case TB_CMP_EQ:
-                case TB_CMP_NE:
-                case TB_CMP_SLT:
-                case TB_CMP_SLE:
-                case TB_CMP_ULT:
-                case TB_CMP_ULE:
-                case TB_CMP_FLT:
-                case TB_CMP_FLE:
-                X(n->cmp.a);
-                X(n->cmp.b);
-                break;
+        case TB_CALL:
+        case TB_ICALL: {
+            FOREACH_N(it, n->call.param_start, n->call.param_end) {
+                X(f->vla.data[it]);
+            }
+            break;
+        }
 
-                case TB_SCALL: {
-                    X(n->scall.target);
+        case TB_SWITCH: X(n->switch_.key); break;
+        case TB_IF: X(n->if_.cond); break;
+        case TB_RET: X(n->ret.value); break;
 
-                    FOREACH_N(it, n->scall.param_start, n->scall.param_end) {
-                        X(f->vla.data[it]);
-                    }
-                    break;
-                }
+        default: tb_todo();
+    }
 
-                case TB_VCALL: {
-                    X(n->vcall.target);
+    #undef X
+}
 
-                    FOREACH_N(it, n->vcall.param_start, n->vcall.param_end) {
-                        X(f->vla.data[it]);
-                    }
-                    break;
-                }
+void tb_function_find_replace_reg(TB_Function* f, TB_Reg find, TB_Reg replace) {
+    if (f->uses != NULL) {
+        if (find == replace) return;
+        sync_uses(f);
 
-                case TB_CALL:
-                case TB_ICALL: {
-                    FOREACH_N(it, n->call.param_start, n->call.param_end) {
-                        X(f->vla.data[it]);
-                    }
-                    break;
-                }
+        // move all the users over to replace
+        TB_UseList* l = &f->uses[find];
+        FOREACH_N(i, 0, l->count) {
+            TB_Reg user = l->users[i];
 
-                case TB_SWITCH: X(n->switch_.key); break;
-                case TB_IF: X(n->if_.cond); break;
-                case TB_RET: X(n->ret.value); break;
+            replace_in_node(f, &f->nodes[user], find, replace);
+            use_list_add(f, replace, user);
+        }
+        l->count = 0;
+    }
 
-                default: tb_todo();
+    TB_FOR_BASIC_BLOCK(bb, f) {
+        if (f->uses == NULL) {
+            TB_FOR_NODE(r, f, bb) {
+                replace_in_node(f, &f->nodes[r], find, replace);
             }
         }
 
@@ -232,8 +441,6 @@ void tb_function_find_replace_reg(TB_Function* f, TB_Reg find, TB_Reg replace) {
             f->bbs[bb].end = tb_node_get_previous(f, f->bbs[bb].end);
         }
     }
-
-    #undef X
 }
 
 TB_Label tb_find_label_from_reg(TB_Function* f, TB_Reg target) {
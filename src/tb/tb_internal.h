@@ -41,10 +41,6 @@
 // Constraints
 // ***********************************
 // TODO: get rid of all these
-#ifndef TB_MAX_THREADS
-#define TB_MAX_THREADS 64
-#endif
-
 // Per-thread
 #ifndef TB_TEMPORARY_STORAGE_SIZE
 #define TB_TEMPORARY_STORAGE_SIZE (1 << 20)
@@ -72,8 +68,11 @@ size_t tb_atomic_size_store(size_t* dst, size_t src);
 void* tb_atomic_ptr_exchange(void** address, void* new_value);
 bool tb_atomic_ptr_cmpxchg(void** address, void* old_value, void* new_value);
 
-#define PROTOTYPES_ARENA_SIZE   (32u << 20u)
-#define CODE_REGION_BUFFER_SIZE (256 * 1024 * 1024)
+
+// code regions reserve this much address space and commit it in
+// CODE_REGION_COMMIT_SIZE steps as the code gen fills it up.
+#define CODE_REGION_RESERVE_SIZE (64 * 1024 * 1024)
+#define CODE_REGION_COMMIT_SIZE  (256 * 1024)
 
 typedef struct TB_Emitter {
     size_t capacity, count;
@@ -113,15 +112,67 @@ typedef struct TB_ConstPoolPatch {
 
     size_t length;
     const void* data;
+
+    // the source was compiled again, see tb__kill_function_patches
+    bool dead;
 } TB_ConstPoolPatch;
 
 typedef struct TB_SymbolPatch {
     TB_Function* source;
     uint32_t pos; // relative to the start of the function body
     bool is_function;
+    bool dead;
     const TB_Symbol* target;
 } TB_SymbolPatch;
 
+// Append-only list of chunks, patches never move once they're placed so growing it
+// never copies and there's nothing allocated until the first push. The first chunk
+// is small and each one after it doubles up to PATCH_CHUNK_MAX elements.
+enum {
+    PATCH_CHUNK_MIN = 16,
+    PATCH_CHUNK_MAX = 4096,
+};
+
+typedef struct TB_PatchChunk {
+    struct TB_PatchChunk* next;
+    size_t count, capacity;
+    char data[];
+} TB_PatchChunk;
+
+// count is everything that was pushed (only the owning thread touches it), dead is how
+// many of those belong to an older compile of their function. Those stay in the list
+// but everything walking them skips over them.
+typedef struct {
+    TB_PatchChunk* first;
+    TB_PatchChunk* last;
+    size_t count;
+    tb_atomic_size_t dead;
+} TB_PatchList;
+
+#define TB_PATCH_LIVE_COUNT(list) ((list).count - (list).dead)
+
+#define TB_FOR_PATCHES(T, it, list) \
+for (TB_PatchChunk* c_ = (list).first; c_ != NULL; c_ = c_->next) \
+for (T *it = (T*) c_->data, *end_ = it + c_->count; it != end_; it++) \
+if (it->dead) {} else
+
+// where a patch list ended at some point, used to find what got pushed after it
+typedef struct {
+    // NULL if the list was empty
+    TB_PatchChunk* chunk;
+    size_t index;
+} TB_PatchMark;
+
+#define TB_PATCH_MARK(list) ((TB_PatchMark){ (list).last, (list).last ? (list).last->count : 0 })
+
+// where the patches from a function's latest compile are, they're all on the
+// list of the thread which compiled it.
+typedef struct {
+    struct TB_ThreadInfo* info;
+    TB_PatchMark symbol_start, const_start;
+    size_t symbol_count, const_count;
+} TB_FunctionPatches;
+
 typedef struct TB_File {
     char* path;
 } TB_File;
@@ -142,18 +193,13 @@ struct TB_Global {
     uint32_t pos;
 };
 
-typedef struct TB_PrototypeParam {
-    TB_DataType dt;
-    char* name;
-    TB_DebugType* debug_type;
-} TB_PrototypeParam;
-
-// function prototypes are stored
-// in streams as inplace arrays:
+// function prototypes live in the thread arenas with
+// their params inplace:
 //
-// PROTOTYPE0, arg0, arg1, PROTOTYPE1, arg0, arg1
+// PROTOTYPE, arg0, arg1...
 struct TB_FunctionPrototype {
     // header
+    TB_Module* module;
     TB_CallingConv call_conv;
 
     short param_capacity;
@@ -308,6 +354,11 @@ typedef struct TB_FunctionOutput {
     DynArray(TB_StackSlot) stack_slots;
 } TB_FunctionOutput;
 
+typedef struct {
+    int count, capacity;
+    TB_Reg* users;
+} TB_UseList;
+
 struct TB_Function {
     TB_Symbol super;
 
@@ -348,6 +399,26 @@ struct TB_Function {
     size_t line_count;
     TB_Line* lines;
 
+    // Def-use chains, these are optional (uses is NULL when they're not built).
+    // uses[r] has every node which reads r (once per operand so a node might
+    // show up twice). Nodes past use_watermark haven't been registered yet, that
+    // way the builder can keep filling in operands after tb_make_reg and they'll
+    // get picked up on the next query.
+    TB_UseList* uses;
+    TB_Reg use_capacity, use_watermark;
+
+    // the initial lists are carved out of this, anything that outgrows it
+    // moves onto the heap.
+    size_t use_storage_count;
+    TB_Reg* use_storage;
+
+    // Cached CFG analyses, analysis_valid holds the TB_AnalysisKind bits which
+    // are up to date. see tb_function_invalidate_analyses
+    uint32_t analysis_valid;
+    TB_Predeccesors cached_preds;
+    TB_DominatorTree cached_doms;
+    TB_LoopInfo cached_loops;
+
     // Compilation output
     union {
         void* compiled_pos;
@@ -355,6 +426,7 @@ struct TB_Function {
     };
 
     TB_FunctionOutput* output;
+    TB_FunctionPatches patches;
 };
 
 typedef struct {
@@ -363,13 +435,51 @@ typedef struct {
     uint32_t pos; // relative to the start of the function
 } TB_LabelSymbol;
 
-typedef struct {
-    size_t capacity, size;
-    uint8_t data[CODE_REGION_BUFFER_SIZE - sizeof(size_t)];
-} TB_CodeRegion;
+// Once a region's reservation runs out a new one is made and the older ones
+// are kept around (function outputs still point into them).
+typedef struct TB_CodeRegion TB_CodeRegion;
+struct TB_CodeRegion {
+    TB_CodeRegion* prev;
+
+    // reserved & committed cover the whole mapping (header included),
+    // size is how much of the data has been used.
+    size_t reserved, committed, size;
+    uint8_t data[];
+};
+
+// Everything a thread needs to work on a module without stepping on other
+// threads, these are created the first time a thread slot (tb__get_local_tid)
+// touches the module. Slots get recycled once a thread calls
+// tb_free_thread_resources so the next thread to get the slot picks up
+// where the last one left off.
+typedef struct TB_ThreadInfo TB_ThreadInfo;
+struct TB_ThreadInfo {
+    int tid;
+    TB_ThreadInfo* next_in_module;
+
+    // persistent allocations (function outputs, line info...),
+    // created lazily by tb__arena_alloc.
+    TB_Arena* arena;
+
+    // The code is stored into big buffers, there's one per thread
+    // so that each can work at the same time without locking, it's
+    // committed as it's used (see tb__code_region_grow).
+    TB_CodeRegion* code_region;
+
+    Pool(TB_DebugType) debug_types;
+    Pool(TB_Global) globals;
+    Pool(TB_External) externals;
+
+    // of TB_ConstPoolPatch & TB_SymbolPatch
+    TB_PatchList const_patches;
+    TB_PatchList symbol_patches;
+};
+
+#define TB_FOR_THREAD_INFO(it, m) for (TB_ThreadInfo* it = m->first_thread_info; it != NULL; it = it->next_in_module)
 
 struct TB_Module {
-    int max_threads;
+    // unique across every module ever made, the thread info lookup caches on it
+    uint64_t uid;
     bool is_jit;
 
     TB_ABI target_abi;
@@ -381,9 +491,23 @@ struct TB_Module {
     // of a _tls_index
     TB_Symbol* tls_index_extern;
 
-    // Convert this into a dynamic memory arena... maybe
-    tb_atomic_size_t prototypes_arena_size;
-    uint64_t* prototypes_arena;
+    // TB_JITProfiling flags for the JIT contexts made after it's set
+    int jit_profiling;
+
+    // see tb_module_set_code_cache
+    TB_CodeCache* code_cache;
+    tb_atomic_size_t code_cache_hits, code_cache_misses;
+
+    // interned names (symbols, files, params...), it's a NL_Strmap(char*)
+    // from string_map.h, the strings themselves live in the thread arenas.
+    tb_atomic_int strings_lock;
+    char** strings;
+
+    // hash-consed prototypes (see tb_prototype_get), open addressing
+    // with a power of two capacity.
+    tb_atomic_int prototypes_lock;
+    size_t prototype_count, prototype_capacity;
+    TB_FunctionPrototype** prototypes;
 
     tb_atomic_size_t compiled_function_count;
 
@@ -392,14 +516,8 @@ struct TB_Module {
     TB_Symbol* first_symbol_of_tag[TB_SYMBOL_MAX];
     TB_Symbol* last_symbol_of_tag[TB_SYMBOL_MAX];
 
-    alignas(64) struct {
-        Pool(TB_DebugType) debug_types;
-        Pool(TB_Global) globals;
-        Pool(TB_External) externals;
-
-        DynArray(TB_ConstPoolPatch) const_patches;
-        DynArray(TB_SymbolPatch) symbol_patches;
-    } thread_info[TB_MAX_THREADS];
+    // every thread which has touched the module
+    TB_ThreadInfo* first_thread_info;
 
     struct {
         size_t count;
@@ -407,20 +525,10 @@ struct TB_Module {
         TB_File* data;
     } files;
 
-    void* jit_region;
-    size_t jit_region_size;
-
     // we need to keep track of these for layout reasons
     tb_atomic_size_t data_region_size;
     tb_atomic_size_t rdata_region_size;
     tb_atomic_size_t tls_region_size;
-
-    // The code is stored into giant buffers
-    // there's on per code gen thread so that
-    // each can work at the same time without
-    // making any allocations within the code
-    // gen.
-    TB_CodeRegion* code_regions[TB_MAX_THREADS];
 };
 
 typedef struct {
@@ -451,8 +559,8 @@ typedef struct {
     // NULLable if doesn't apply
     void (*emit_win64eh_unwind_info)(TB_Emitter* e, TB_FunctionOutput* out_f, uint64_t saved, uint64_t stack_usage);
 
-    TB_FunctionOutput (*fast_path)(TB_Function* f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity, size_t local_thread_id);
-    TB_FunctionOutput (*complex_path)(TB_Function* f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity, size_t local_thread_id);
+    TB_FunctionOutput (*fast_path)(TB_Function* f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity);
+    TB_FunctionOutput (*complex_path)(TB_Function* f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity);
 } ICodeGen;
 
 // All debug formats i know of boil down to adding some extra sections to the object file
@@ -570,6 +678,9 @@ bool tb_tls_can_fit(TB_TemporaryStorage* store, size_t size);
 
 ICodeGen* tb__find_code_generator(TB_Module* m);
 
+// runs function level passes (and below) on a single function, see tb_module_optimize
+bool tb__function_optimize(TB_Function* f, size_t pass_count, const TB_Pass passes[]);
+
 void* tb_out_reserve(TB_Emitter* o, size_t count);
 void tb_out_commit(TB_Emitter* o, size_t count);
 
@@ -606,23 +717,36 @@ uint32_t tb_get4b(TB_Emitter* o, uint32_t pos);
 // IR ANALYSIS
 ////////////////////////////////
 TB_Label tb_find_label_from_reg(TB_Function* f, TB_Reg target);
-TB_Reg tb_find_first_use(const TB_Function* f, TB_Reg find, size_t start, size_t end);
 void tb_function_find_replace_reg(TB_Function* f, TB_Reg find, TB_Reg replace);
-size_t tb_count_uses(const TB_Function* f, TB_Reg find, size_t start, size_t end);
+
+// these only look at the nodes in the range [start, end)
+TB_Reg tb_find_first_use(TB_Function* f, TB_Reg find, size_t start, size_t end);
+size_t tb_count_uses(TB_Function* f, TB_Reg find, size_t start, size_t end);
+
+// Def-use chains, once built tb_function_find_replace_reg and the tb_murder_*
+// helpers keep them up to date along with the builder. Passes which poke at the
+// node inputs directly need to free them first (or rebuild them after).
+void tb_function_build_uses(TB_Function* f);
+void tb_function_free_uses(TB_Function* f);
+const TB_UseList* tb_function_get_uses(TB_Function* f, TB_Reg r);
+void tb__remove_input_uses(TB_Function* f, TB_Reg r);
 void tb_function_reserve_nodes(TB_Function* f, size_t extra);
 TB_Reg tb_insert_copy_ops(TB_Function* f, const TB_Reg* params, TB_Reg at, const TB_Function* src_func, TB_Reg src_base, int count);
 TB_Reg tb_function_insert_before(TB_Function* f, TB_Reg at);
 TB_Reg tb_function_insert_after(TB_Function* f, TB_Label bb, TB_Reg at);
 
 inline static void tb_murder_node(TB_Function* f, TB_Node* n) {
+    if (f->uses) tb__remove_input_uses(f, n - f->nodes);
     n->type = TB_NULL;
 }
 
 inline static void tb_murder_reg(TB_Function* f, TB_Reg r) {
+    if (f->uses) tb__remove_input_uses(f, r);
     f->nodes[r].type = TB_NULL;
 }
 
 inline static void tb_kill_op(TB_Function* f, TB_Reg at) {
+    if (f->uses) tb__remove_input_uses(f, at);
     f->nodes[at].type = TB_NULL;
 }
 
@@ -685,28 +809,120 @@ size_t tb_helper_write_data_section(size_t write_pos, TB_Module* m, uint8_t* out
 size_t tb_helper_write_rodata_section(size_t write_pos, TB_Module* m, uint8_t* output, uint32_t pos);
 size_t tb_helper_get_text_section_layout(TB_Module* m, size_t symbol_id_start);
 
+// an exported file as the pieces it's made of in order, they point at memory which
+// already exists (the code stays in the functions' outputs) so a file can be streamed
+// out without being put together in one buffer first.
+typedef struct {
+    size_t count, capacity;
+    size_t total;
+    TB_IOVec* vecs;
+} TB_GatherList;
+
+void tb_helper_gather(TB_GatherList* list, const void* data, size_t length);
+void tb_helper_gather_text_section(TB_GatherList* list, TB_Module* m);
+uint8_t* tb_helper_gather_join(const TB_GatherList* list);
+bool tb_helper_gather_write_file(const TB_GatherList* list, const char* path);
+
+// code the JIT already placed, tb__elf64_write_jit_image describes it to debuggers
+typedef struct {
+    uint8_t* base;
+    size_t size;
+} TB_JITImageRegion;
+
+typedef struct {
+    const char* name;
+    uint32_t region;
+    size_t offset, size;
+
+    // starts with push rbp, mov rbp, rsp (otherwise it never moved rsp)
+    bool has_frame;
+} TB_JITImageSymbol;
+
+// in-memory ELF object with the symbols & unwind info, it's heap allocated
+uint8_t* tb__elf64_write_jit_image(TB_Module* m, size_t region_count, const TB_JITImageRegion* regions, size_t symbol_count, const TB_JITImageSymbol* symbols, size_t* out_size);
+
 ////////////////////////////////
 // ANALYSIS
 ////////////////////////////////
+// thread slots are handed out on first use and given back by
+// tb_free_thread_resources so they stay small & dense.
 int tb__get_local_tid(void);
+
+// the calling thread's state for this module, made on first use.
+TB_ThreadInfo* tb__get_thread_info(TB_Module* m);
+
+// allocates from the calling thread's arena in the module, it's freed
+// in bulk by tb_module_destroy.
+void* tb__arena_alloc(TB_Module* m, size_t size);
+
+// makes room for `extra` more bytes after the `used` bytes of the function being
+// emitted at `code` in the calling thread's code region. If the region is out
+// of space the function is moved to a new one, returns where the code lives now
+// and how many bytes it's got to work with.
+uint8_t* tb__code_region_grow(TB_Module* m, uint8_t* code, size_t used, size_t extra, size_t* out_capacity);
+
+// returns a copy of str owned by the module, equal strings share one
+// copy. It's thread-safe and lives until tb_module_destroy.
+char* tb__intern_string(TB_Module* m, const char* str);
 TB_Symbol* tb_symbol_alloc(TB_Module* m, enum TB_SymbolTag tag, const char* name, size_t size);
 void tb_symbol_append(TB_Module* m, TB_Symbol* s);
 
 // TODO(NeGate): refactor this stuff such that it starts with two underscores, it makes
 // it more clear that these are TB private
-void tb_function_calculate_use_count(const TB_Function* f, int use_count[]);
-int tb_function_find_uses_of_node(const TB_Function* f, TB_Reg def, TB_Reg uses[]);
+void tb_function_calculate_use_count(TB_Function* f, int use_count[]);
+int tb_function_find_uses_of_node(TB_Function* f, TB_Reg def, TB_Reg uses[]);
 
 // if tls is NULL then the return value is heap allocated
 TB_Label* tb_calculate_immediate_predeccessors(TB_Function* f, TB_TemporaryStorage* tls, TB_Label l, int* dst_count);
+TB_CFG tb_get_temp_cfg(TB_Function* f, TB_TemporaryStorage* tls);
 TB_Predeccesors tb_get_temp_predeccesors(TB_Function* f, TB_TemporaryStorage* tls);
 void tb_free_temp_predeccesors(TB_TemporaryStorage* tls, TB_Predeccesors preds);
 
-uint32_t tb_emit_const_patch(TB_Module* m, TB_Function* source, size_t pos, const void* ptr,size_t len, size_t local_thread_id);
-void tb_emit_symbol_patch(TB_Module* m, TB_Function* source, const TB_Symbol* target, size_t pos, bool is_function, size_t local_thread_id);
+// returns a new (uninitialized) slot at the end of the list
+void* tb__patch_list_push(TB_PatchList* list, size_t type_size);
+void tb__patch_list_free(TB_PatchList* list);
+
+// walks the patches pushed since mark, gives back NULL once it's caught up
+void* tb__patch_mark_next(const TB_PatchList* list, TB_PatchMark* mark, size_t type_size);
+
+// marks the patches from f's last compile as dead, tb_module_compile_function
+// does this when f is compiled again (JIT tier ups) so nobody applies them to
+// the new code.
+void tb__kill_function_patches(TB_Function* f);
+
+uint32_t tb_emit_const_patch(TB_Module* m, TB_Function* source, size_t pos, const void* ptr,size_t len);
+void tb_emit_symbol_patch(TB_Module* m, TB_Function* source, const TB_Symbol* target, size_t pos, bool is_function);
 
 TB_Reg* tb_vla_reserve(TB_Function* f, size_t count);
 
+// Code cache (see tb_cache.c), the key is the function's IR along with everything
+// else that goes into the codegen. Building it fails if there's something in the
+// function which can't be cached.
+typedef struct TB_CodeCacheKey {
+    // the entries keep the whole thing so a hash collision can't hand back the wrong code
+    TB_Emitter ir;
+    uint8_t hash[16];
+
+    // symbols & files the IR refers to in the order they first show up, the entries
+    // store patches & lines as indices into these so they mean the same thing in any module.
+    size_t symbol_count;
+    const TB_Symbol** symbols;
+    // open addressing, the slots hold index+1
+    size_t symbol_table_capacity;
+    uint32_t* symbol_table;
+
+    size_t file_count, file_capacity;
+    TB_FileID* files;
+} TB_CodeCacheKey;
+
+bool tb__code_cache_key(TB_Module* m, TB_Function* f, TB_ISelMode isel_mode, TB_CodeCacheKey* key);
+void tb__code_cache_key_free(TB_CodeCacheKey* key);
+
+// load places the code into the thread's code region but doesn't bump its size, store
+// takes the patches which were pushed after the marks as the function's.
+bool tb__code_cache_load(TB_Module* m, TB_Function* f, const TB_CodeCacheKey* key, TB_FunctionOutput* out);
+void tb__code_cache_store(TB_Module* m, TB_Function* f, const TB_CodeCacheKey* key, const TB_FunctionOutput* out, TB_PatchMark symbol_mark, TB_PatchMark const_mark);
+
 // trusty lil hash functions
 uint32_t tb__crc32(uint32_t crc, size_t length, const void* data);
 
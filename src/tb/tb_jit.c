@@ -5,234 +5,2162 @@ size_t tb_helper_write_text_section(size_t write_pos, TB_Module* m, uint8_t* out
 size_t tb_helper_write_data_section(size_t write_pos, TB_Module* m, uint8_t* output, uint32_t pos);
 size_t tb_helper_write_rodata_section(size_t write_pos, TB_Module* m, uint8_t* output, uint32_t pos);
 
+// JIT heap, chunks of memory are mapped twice (see tb_platform_valloc_dual) and
+// cut into pages. Small allocations come out of single page slabs in power of two
+// size classes (16 to 2048 bytes), anything bigger gets its own run of pages which
+// are found first-fit and coalesced with their neighbors when freed.
+//
+// Each thread keeps a small cache of blocks per size class so most allocations and
+// frees don't touch the heap lock.
 enum {
-    SLAB_SIZE = 0x1000,
-    BITMAP_GRANULARITY = 16,
+    JIT_PAGE_SIZE = 0x1000,
 
-    USED_BITMAP_COUNT = (SLAB_SIZE / BITMAP_GRANULARITY) / 8,
+    JIT_MIN_CLASS_SHIFT = 4,
+    JIT_CLASS_COUNT = 8,
+    JIT_MAX_SMALL = 1 << (JIT_MIN_CLASS_SHIFT + JIT_CLASS_COUNT - 1),
+
+    JIT_SLAB_WORDS = (JIT_PAGE_SIZE >> JIT_MIN_CLASS_SHIFT) / 64,
+    JIT_PROTECT_COUNT = TB_PAGE_READEXECUTE + 1,
+
+    // per thread, per size class
+    JIT_CACHE_SIZE = 16,
 };
 
-typedef struct Slab {
-    TB_MemProtect protect;
-    uint64_t used_bitmap[USED_BITMAP_COUNT];
-} Slab;
+typedef enum {
+    // only the first and last page of a free run are kept up to date
+    JIT_PAGE_FREE,
+    JIT_PAGE_SLAB,
+    // first page of an allocated run, the rest are JIT_PAGE_RUN_BODY
+    JIT_PAGE_RUN,
+    JIT_PAGE_RUN_BODY,
+} JITPageState;
+
+typedef struct JITChunk JITChunk;
+typedef struct JITPage JITPage;
+
+struct JITPage {
+    JITChunk* chunk;
+    uint32_t index;
+
+    uint8_t state;
+    uint8_t protect;
+
+    // free runs (on the first and last page) and allocated runs (first page)
+    uint32_t run_length;
+
+    // slabs
+    uint8_t size_class;
+    uint8_t in_partial;
+    uint16_t used;
+    JITPage* prev_partial;
+    JITPage* next_partial;
+    uint64_t used_bitmap[JIT_SLAB_WORDS];
+};
+
+struct JITChunk {
+    JITChunk* next;
+
+    // base is where the code lives and rw is the writable alias
+    uint8_t* base;
+    uint8_t* rw;
+
+    size_t page_count;
+    JITPage pages[];
+};
+
+typedef struct {
+    int count;
+    void* items[JIT_CACHE_SIZE];
+} JITCacheBin;
+
+typedef struct JITCache JITCache;
+struct JITCache {
+    JITCache* next;
+    int tid;
+
+    JITCacheBin bins[JIT_PROTECT_COUNT][JIT_CLASS_COUNT];
+};
 
 typedef struct {
-    size_t capacity;
-    uint8_t* block;
+    uint64_t uid;
+    size_t chunk_size;
 
-    size_t slab_count;
-    Slab* slabs;
+    // guards the chunks & slabs, the caches are pushed atomically
+    tb_atomic_int lock;
+    JITChunk* chunks;
+    JITPage* partial[JIT_PROTECT_COUNT][JIT_CLASS_COUNT];
+
+    JITCache* caches;
 } TB_JITHeap;
 
+enum {
+    S_TEXT, S_RDATA, S_DATA, S_TLS, S_MAX
+};
+
+typedef struct {
+    uint8_t* ptr;
+    size_t size;
+    TB_MemProtect protect;
+} TB_JITSection;
+
+// code replaced by tb_jit_redefine, it's freed by tb_jit_reclaim once the
+// user says no thread could still be running it.
+typedef struct TB_JITRetired TB_JITRetired;
+struct TB_JITRetired {
+    TB_JITRetired* next;
+    void* code;
+    uint64_t epoch;
+};
+
+// per lazily compiled function in tiered mode, it's in the data section
+// since the counting stubs write to it.
+typedef struct {
+    int32_t counter;
+    int32_t queued;
+    void* tier0;
+} JITTierData;
+
+typedef struct JITTierItem JITTierItem;
+struct JITTierItem {
+    JITTierItem* next;
+    TB_Function* f;
+    size_t stub;
+};
+
+// see the GDB JIT interface
+typedef struct JITDebugImage JITDebugImage;
+
+// a function body linked after tb_module_begin_jit, f's output might change (tier ups)
+// before it's registered so we keep what the image needs.
+typedef struct {
+    uint8_t* code;
+    size_t size;
+    const char* name;
+    bool has_frame;
+
+    JITDebugImage* image;
+} JITDebugBody;
+
 struct TB_JITContext {
+    TB_Module* module;
     TB_JITHeap heap;
+
+    // everything tb_module_begin_jit linked, each section is a separate heap allocation.
+    TB_JITSection sections[S_MAX];
+    size_t global_data_size;
+
+    // one per linked function, entries are thunks in the text section which
+    // jump through the entry slots (in the data section).
+    size_t entry_count;
+    uint8_t* entries;
+    void** entry_slots;
+
+    // only in lazy mode, the functions which weren't compiled start off at a
+    // stub in [lazy_stubs, lazy_stubs_end) and the locks keep two threads from
+    // compiling the same one.
+    TB_ISelMode lazy_isel;
+    uint8_t* lazy_stubs;
+    uint8_t* lazy_stubs_end;
+    tb_atomic_int* entry_locks;
+
+    // only in tiered mode, lazily compiled functions are entered through a counting
+    // stub (parallel to the lazy stubs) until they're hot and then they're recompiled
+    // on a background thread which only runs while there's something queued.
+    bool tiered;
+    int32_t tier_threshold;
+    uint8_t* count_stubs;
+    uint8_t* count_stubs_end;
+    JITTierData* tier_data;
+
+    TB_ISelMode tier_isel;
+    size_t tier_pass_count;
+    TB_Pass* tier_passes;
+
+    tb_atomic_int tier_lock;
+    bool tier_running, tier_stop;
+    TB_Thread* tier_thread;
+    JITTierItem* tier_queue;
+
+    tb_atomic_int retired_lock;
+    uint64_t epoch;
+    TB_JITRetired* retired;
+
+    // holds a reference on the perf files
+    bool profiling;
+
+    // only with TB_JIT_GDB, everything tb_module_begin_jit linked is one image and the
+    // bodies after it are registered in batches. The bodies are sorted by address so
+    // their image can be found when they're freed, the ones without an image are
+    // waiting on the next batch.
+    bool debugging;
+    JITDebugImage* debug_text;
+
+    tb_atomic_int debug_lock;
+    size_t debug_body_count, debug_body_cap, debug_pending;
+    JITDebugBody* debug_bodies;
 };
 
-static TB_JITHeap tb_jitheap_create(size_t size) {
-    assert(size == (uint32_t) size);
+// same idea as the module uids, the thread's cache is remembered across
+// calls but the heap might've been freed and another one put in its place.
+static thread_local uint64_t cached_heap_uid;
+static thread_local int cached_heap_tid;
+static thread_local JITCache* cached_heap_cache;
+
+static tb_atomic_size_t heap_uid_counter;
+
+static void tb_jitheap_init(TB_JITHeap* h, size_t chunk_size) {
+    *h = (TB_JITHeap){ 0 };
+    h->uid = tb_atomic_size_add(&heap_uid_counter, 1) + 1;
+    h->chunk_size = align_up(chunk_size, JIT_PAGE_SIZE);
+}
+
+static void jit_mark_free(JITChunk* c, size_t start, size_t count) {
+    JITPage* first = &c->pages[start];
+    JITPage* last = &c->pages[start + count - 1];
+
+    first->state = last->state = JIT_PAGE_FREE;
+    first->run_length = last->run_length = count;
+}
 
-    // align to page size
-    size = (size + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
-    uint32_t slab_count = size / SLAB_SIZE;
+static JITChunk* jit_add_chunk(TB_JITHeap* h, size_t min_pages) {
+    size_t page_count = h->chunk_size / JIT_PAGE_SIZE;
+    if (page_count < min_pages) page_count = min_pages;
 
-    TB_JITHeap h = { 0 };
-    h.capacity = size;
-    h.block = tb_platform_valloc(size);
-    h.slab_count = slab_count;
-    h.slabs = malloc(slab_count * sizeof(Slab));
+    JITChunk* c = tb_platform_heap_alloc(sizeof(JITChunk) + (page_count * sizeof(JITPage)));
+    c->base = tb_platform_valloc_dual(page_count * JIT_PAGE_SIZE, (void**) &c->rw);
+    if (c->base == NULL) {
+        tb_panic("tb_jitheap: out of memory!");
+    }
 
-    FOREACH_N(i, 0, slab_count) {
-        h.slabs[i] = (Slab){ i * SLAB_SIZE };
+    c->page_count = page_count;
+    memset(c->pages, 0, page_count * sizeof(JITPage));
+    FOREACH_N(i, 0, page_count) {
+        c->pages[i].chunk = c;
+        c->pages[i].index = i;
+        c->pages[i].protect = TB_PAGE_INVALID;
     }
-    return h;
+    jit_mark_free(c, 0, page_count);
+
+    // frees look up chunks without the lock so publish it once it's ready
+    c->next = h->chunks;
+    tb_atomic_ptr_exchange((void**) &h->chunks, c);
+    return c;
 }
 
-static void* tb_jitheap_alloc_region(TB_JITHeap* c, size_t s, TB_MemProtect protect) {
-    // align to alloc granularity
-    size_t block_count = (s + 15) / 16;
-    assert(block_count < 64 && "TODO: support bigger allocations");
+static void jit_protect_pages(JITPage* p, size_t count, TB_MemProtect protect) {
+    if (count == 1 && p->protect == protect) return;
 
-    FOREACH_N(i, 0, c->slab_count) {
-        if (c->slabs[i].protect != TB_PAGE_INVALID) {
-            if (c->slabs[i].protect != protect) continue;
-        } else {
-            c->slabs[i].protect = protect;
+    JITChunk* c = p->chunk;
+    tb_platform_vprotect(c->base + (p->index * JIT_PAGE_SIZE), count * JIT_PAGE_SIZE, protect);
+    FOREACH_N(i, 0, count) p[i].protect = protect;
+}
 
-            // virtual protect these new pages
-            tb_platform_vprotect(c->block + (i * SLAB_SIZE), SLAB_SIZE, protect);
-        }
+// lock must be held
+static JITPage* jit_alloc_pages(TB_JITHeap* h, size_t count) {
+    for (JITChunk* c = h->chunks; c != NULL; c = c->next) {
+        size_t i = 0;
+        while (i < c->page_count) {
+            JITPage* p = &c->pages[i];
+            if (p->state == JIT_PAGE_FREE) {
+                size_t length = p->run_length;
+                if (length >= count) {
+                    if (length > count) {
+                        jit_mark_free(c, i + count, length - count);
+                    }
 
-        // find first free slot
-        uint64_t* bitmap = c->slabs[i].used_bitmap;
-        size_t j = 0;
-        for (; j < USED_BITMAP_COUNT; j++) {
-            if (bitmap[j] != UINT64_MAX) break;
+                    p->state = JIT_PAGE_RUN;
+                    p->run_length = count;
+                    FOREACH_N(j, 1, count) p[j].state = JIT_PAGE_RUN_BODY;
+                    return p;
+                }
+
+                i += length;
+            } else if (p->state == JIT_PAGE_RUN) {
+                i += p->run_length;
+            } else {
+                i += 1;
+            }
         }
+    }
 
-        // find empty bit
-        assert(j != USED_BITMAP_COUNT);
-        uint64_t bits = bitmap[j];
+    // nothing fits, the new chunk goes first in the list
+    jit_add_chunk(h, count);
+    return jit_alloc_pages(h, count);
+}
 
-        size_t k = bits ? tb_ffs64(~bits) - 1 : 0;
-        if (k + block_count >= 64) {
-            // goes across uint64 chunks
-            tb_todo();
-        } else {
-            uint64_t mask = ((1u << block_count) - 1) << k;
-            if ((bits & mask) == 0) {
-                // it's free
-                bitmap[j] |= mask;
+// lock must be held
+static void jit_free_pages(JITChunk* c, size_t start, size_t count) {
+    // coalesce with the free runs on either side
+    if (start + count < c->page_count && c->pages[start + count].state == JIT_PAGE_FREE) {
+        count += c->pages[start + count].run_length;
+    }
 
-                printf("Allocated to [%zu][%zu]\n", i, j*64 + k);
-                return c->block + (i * SLAB_SIZE) + (j * 64 * BITMAP_GRANULARITY) + (k * BITMAP_GRANULARITY);
-            }
+    if (start > 0 && c->pages[start - 1].state == JIT_PAGE_FREE) {
+        size_t length = c->pages[start - 1].run_length;
+        start -= length, count += length;
+    }
+
+    jit_mark_free(c, start, count);
+}
+
+static void jit_unlink_partial(TB_JITHeap* h, JITPage* p) {
+    JITPage** list = &h->partial[p->protect][p->size_class];
+    if (p->prev_partial) p->prev_partial->next_partial = p->next_partial;
+    else *list = p->next_partial;
+    if (p->next_partial) p->next_partial->prev_partial = p->prev_partial;
+
+    p->prev_partial = p->next_partial = NULL;
+    p->in_partial = 0;
+}
+
+static void jit_push_partial(TB_JITHeap* h, JITPage* p) {
+    JITPage** list = &h->partial[p->protect][p->size_class];
+    p->prev_partial = NULL;
+    p->next_partial = *list;
+    if (*list) (*list)->prev_partial = p;
+    *list = p;
+    p->in_partial = 1;
+}
+
+// lock must be held
+static void* jit_slab_alloc(TB_JITHeap* h, int size_class, TB_MemProtect protect) {
+    JITPage* p = h->partial[protect][size_class];
+    if (p == NULL) {
+        p = jit_alloc_pages(h, 1);
+        p->state = JIT_PAGE_SLAB;
+        p->size_class = size_class;
+        p->used = 0;
+        memset(p->used_bitmap, 0, sizeof(p->used_bitmap));
+
+        jit_protect_pages(p, 1, protect);
+        jit_push_partial(h, p);
+    }
+
+    // the slab isn't full so the lowest clear bit is a real slot
+    int shift = JIT_MIN_CLASS_SHIFT + size_class;
+    size_t i = 0;
+    while (p->used_bitmap[i] == UINT64_MAX) i++;
+
+    int bit = tb_ffs64(~p->used_bitmap[i]) - 1;
+    p->used_bitmap[i] |= (1ull << bit);
+
+    if (++p->used == (JIT_PAGE_SIZE >> shift)) {
+        jit_unlink_partial(h, p);
+    }
+
+    size_t slot = (i * 64) + bit;
+    return p->chunk->base + (p->index * JIT_PAGE_SIZE) + (slot << shift);
+}
+
+// lock must be held
+static void jit_slab_free(TB_JITHeap* h, JITPage* p, void* ptr) {
+    JITChunk* c = p->chunk;
+    size_t offset = ((uint8_t*) ptr - c->base) & (JIT_PAGE_SIZE - 1);
+    size_t slot = offset >> (JIT_MIN_CLASS_SHIFT + p->size_class);
+
+    assert(p->used_bitmap[slot / 64] & (1ull << (slot % 64)) && "tb_jitheap: double free");
+    p->used_bitmap[slot / 64] &= ~(1ull << (slot % 64));
+
+    if (--p->used == 0) {
+        // empty slabs go back to the page pool
+        if (p->in_partial) jit_unlink_partial(h, p);
+        jit_free_pages(c, p->index, 1);
+    } else if (!p->in_partial) {
+        jit_push_partial(h, p);
+    }
+}
+
+static JITChunk* jit_find_chunk(TB_JITHeap* h, void* ptr) {
+    for (JITChunk* c = h->chunks; c != NULL; c = c->next) {
+        if ((uint8_t*) ptr >= c->base && (uint8_t*) ptr < c->base + (c->page_count * JIT_PAGE_SIZE)) {
+            return c;
         }
     }
 
+    tb_panic("tb_jitheap: pointer isn't from this heap");
     return NULL;
 }
 
-void tb_jitheap_free_region(TB_JITHeap* c, void* ptr, size_t s) {
-    ptrdiff_t offset = ((uint8_t*) ptr) - c->block;
-    assert(offset >= 0 && offset < c->capacity);
+static JITPage* jit_find_page(TB_JITHeap* h, void* ptr) {
+    JITChunk* c = jit_find_chunk(h, ptr);
+    return &c->pages[((uint8_t*) ptr - c->base) / JIT_PAGE_SIZE];
+}
+
+static JITCache* jit_get_cache(TB_JITHeap* h) {
+    int id = tb__get_local_tid();
+    if (cached_heap_uid == h->uid && cached_heap_tid == id) {
+        return cached_heap_cache;
+    }
+
+    // a thread which gave its slot back might've left a cache behind, only one
+    // thread owns a slot at a time so we can just pick it up.
+    JITCache* cache = h->caches;
+    while (cache != NULL && cache->tid != id) cache = cache->next;
 
-    size_t block_count = (s + 15) / 16;
-    assert(block_count < 64 && "TODO: bigger freeing operations");
+    if (cache == NULL) {
+        cache = tb_platform_heap_alloc(sizeof(JITCache));
+        memset(cache, 0, sizeof(JITCache));
+        cache->tid = id;
 
-    size_t slab_id = (offset / SLAB_SIZE);
-    size_t bitmap_id = offset % USED_BITMAP_COUNT;
-    size_t bit_id = (offset / BITMAP_GRANULARITY) % 64;
+        do {
+            cache->next = h->caches;
+        } while (!tb_atomic_ptr_cmpxchg((void**) &h->caches, cache->next, cache));
+    }
 
-    uint64_t mask = ((1u << block_count) - 1) << bit_id;
-    c->slabs[slab_id].used_bitmap[bitmap_id] &= ~mask;
+    cached_heap_uid = h->uid;
+    cached_heap_tid = id;
+    cached_heap_cache = cache;
+    return cache;
 }
 
-TB_API TB_JITContext* tb_module_begin_jit(TB_Module* m, size_t jit_heap_capacity) {
-    // ICodeGen* restrict codegen = tb__find_code_generator(m);
+static void* tb_jitheap_alloc_region(TB_JITHeap* h, size_t size, TB_MemProtect protect) {
+    assert(protect > TB_PAGE_INVALID && (int) protect < JIT_PROTECT_COUNT);
 
-    TB_JITContext* jit = tb_platform_heap_alloc(sizeof(TB_JITContext));
-    jit->heap = tb_jitheap_create(jit_heap_capacity);
-    return jit;
+    if (size > JIT_MAX_SMALL) {
+        size_t count = (size + JIT_PAGE_SIZE - 1) / JIT_PAGE_SIZE;
 
-    #if 0
-    /*TB_JITHeap heap = tb_jitheap_create(4*1024*1024);
-    tb_jitheap_alloc_region(&heap, 256, true);
-    void* a = tb_jitheap_alloc_region(&heap, 42, true);
-    tb_jitheap_alloc_region(&heap, 81, false);
-    tb_jitheap_alloc_region(&heap, 10, true);
-    tb_jitheap_free_region(&heap, a, 42);
-    tb_jitheap_alloc_region(&heap, 10, true);
-    __debugbreak();*/
+        while (tb_atomic_int_store(&h->lock, 1)) {}
+        JITPage* p = jit_alloc_pages(h, count);
+        jit_protect_pages(p, count, protect);
+        tb_atomic_int_store(&h->lock, 0);
 
-    size_t page_size = 4096;
-    size_t text_section_size = tb_helper_get_text_section_layout(m, 0);
+        return p->chunk->base + (p->index * JIT_PAGE_SIZE);
+    }
+
+    int size_class = 0;
+    while ((1u << (JIT_MIN_CLASS_SHIFT + size_class)) < size) size_class++;
+
+    JITCache* cache = jit_get_cache(h);
+    JITCacheBin* bin = &cache->bins[protect][size_class];
+    if (bin->count == 0) {
+        // refill half the cache so we don't come back for the lock right away
+        while (tb_atomic_int_store(&h->lock, 1)) {}
+        FOREACH_N(i, 0, JIT_CACHE_SIZE / 2) {
+            bin->items[bin->count++] = jit_slab_alloc(h, size_class, protect);
+        }
+        tb_atomic_int_store(&h->lock, 0);
+    }
 
-    // Target specific: resolve internal call patches
-    codegen->emit_call_patches(m);
+    return bin->items[--bin->count];
+}
 
-    size_t rdata_section_size = align_up(m->rdata_region_size, page_size);
+static void tb_jitheap_free_region(TB_JITHeap* h, void* ptr) {
+    // a live allocation keeps its page's state from changing under us
+    JITPage* p = jit_find_page(h, ptr);
+    if (p->state == JIT_PAGE_RUN) {
+        assert((uint8_t*) ptr == p->chunk->base + (p->index * JIT_PAGE_SIZE));
 
-    size_t external_count = 0;
-    FOREACH_N(i, 0, m->max_threads) {
-        external_count += pool_popcount(m->thread_info[i].externals);
+        while (tb_atomic_int_store(&h->lock, 1)) {}
+        jit_free_pages(p->chunk, p->index, p->run_length);
+        tb_atomic_int_store(&h->lock, 0);
+        return;
     }
-    rdata_section_size += align_up(external_count * sizeof(void*), page_size);
 
-    typedef struct {
-        size_t offset;
-        size_t size;
-        TB_MemProtect protect;
-    } Section;
+    assert(p->state == JIT_PAGE_SLAB && "tb_jitheap: pointer isn't an allocation");
+    JITCache* cache = jit_get_cache(h);
+    JITCacheBin* bin = &cache->bins[p->protect][p->size_class];
+    if (bin->count == JIT_CACHE_SIZE) {
+        // give the older half back to the slabs
+        while (tb_atomic_int_store(&h->lock, 1)) {}
+        FOREACH_N(i, 0, JIT_CACHE_SIZE / 2) {
+            void* item = bin->items[i];
+            jit_slab_free(h, jit_find_page(h, item), item);
+        }
+        tb_atomic_int_store(&h->lock, 0);
 
-    enum {
-        S_RDATA, S_TEXT, S_DATA
-    };
+        memmove(&bin->items[0], &bin->items[JIT_CACHE_SIZE / 2], (JIT_CACHE_SIZE / 2) * sizeof(void*));
+        bin->count = JIT_CACHE_SIZE / 2;
+    }
 
-    int section_count = 3;
-    Section sections[] = {
-        [S_RDATA] = { .size = rdata_section_size,  .protect = TB_PAGE_READONLY    }, // .rdata
-        [S_TEXT]  = { .size = text_section_size,   .protect = TB_PAGE_READEXECUTE }, // .text
-        [S_DATA]  = { .size = m->data_region_size, .protect = TB_PAGE_READWRITE   }, // .data
-    };
+    bin->items[bin->count++] = ptr;
+}
+
+// where to write to since the allocations themselves might not be writable
+static void* tb_jitheap_writable(TB_JITHeap* h, void* ptr) {
+    JITChunk* c = jit_find_chunk(h, ptr);
+    return c->rw + ((uint8_t*) ptr - c->base);
+}
+
+static void tb_jitheap_destroy(TB_JITHeap* h) {
+    for (JITChunk* c = h->chunks; c != NULL;) {
+        JITChunk* next = c->next;
+        tb_platform_vfree_dual(c->base, c->rw, c->page_count * JIT_PAGE_SIZE);
+        tb_platform_heap_free(c);
+        c = next;
+    }
+
+    for (JITCache* cache = h->caches; cache != NULL;) {
+        JITCache* next = cache->next;
+        tb_platform_heap_free(cache);
+        cache = next;
+    }
+
+    *h = (TB_JITHeap){ 0 };
+}
+
+// every external gets a slot holding its address and a thunk which jumps
+// through it, calls go to the thunk and address loads go to the slot.
+//
+// functions get the same treatment except their slots are writable, every call
+// and address goes to the function's entry thunk so tb_jit_redefine only has to
+// swap the slot for the new code to be picked up.
+enum {
+    JIT_THUNK_SIZE = 8,
+
+    JIT_LAZY_STUB_SIZE = 16,
+    JIT_LAZY_RESOLVER_SIZE = 224,
+
+    JIT_COUNT_STUB_SIZE = 32,
+    JIT_DEFAULT_TIER_THRESHOLD = 1000,
+
+    // bodies per debug image, each registration stops the world when gdb's attached
+    JIT_DEBUG_BATCH = 64,
+};
+
+// rw is where the field gets written and loc is where it'll be run from
+static void jit_patch_rel32(uint8_t* rw, uint8_t* loc, uint8_t* target) {
+    // the bytes already in there are an addend (for immediates after the
+    // displacement), x64 is relative to the end of the 4 byte field.
+    int32_t addend;
+    memcpy(&addend, rw, sizeof(addend));
+
+    ptrdiff_t disp = (target - (loc + 4)) + addend;
+    if (disp != (int32_t) disp) {
+        tb_panic("TB JIT: relocation out of range!");
+    }
+
+    int32_t disp32 = disp;
+    memcpy(rw, &disp32, sizeof(disp32));
+}
+
+static void jit_patch_abs64(uint8_t* loc, uintptr_t target) {
+    uint64_t addend;
+    memcpy(&addend, loc, sizeof(addend));
+
+    addend += target;
+    memcpy(loc, &addend, sizeof(addend));
+}
+
+// jmp qword [rip + slot]
+static void jit_write_thunk(uint8_t* rw, uint8_t* loc, void** slot) {
+    rw[0] = 0xFF, rw[1] = 0x25;
+    memset(&rw[2], 0, 4);
+    jit_patch_rel32(&rw[2], &loc[2], (uint8_t*) slot);
+
+    // pad with int3
+    memset(&rw[6], 0xCC, JIT_THUNK_SIZE - 6);
+}
 
-    // Layout sections
-    size_t jit_region_size = 0;
-    FOREACH_N(i, 0, section_count) {
-        sections[i].offset = jit_region_size;
-        jit_region_size = align_up(jit_region_size + sections[i].size, page_size);
+// the absolute addresses which jit_link_sections writes into the image, snapshots
+// turn these into relocations. import is the external's number or JIT_RELOC_BASE
+// when it's pointing into the image itself.
+typedef struct {
+    uint8_t* loc;
+    uint32_t import;
+} JITAbsReloc;
+
+enum { JIT_RELOC_BASE = UINT32_MAX };
+
+static void jit_add_abs(DynArray(JITAbsReloc)* relocs, uint8_t* loc, uint32_t import) {
+    if (relocs != NULL) {
+        DynArray(JITAbsReloc) arr = *relocs;
+        dyn_array_put(arr, (JITAbsReloc){ loc, import });
+        *relocs = arr;
     }
-    uint8_t* jit_region = tb_platform_valloc(jit_region_size);
+}
 
-    // .RDATA
-    size_t write_pos = 0;
-    {
-        write_pos = tb_helper_write_rodata_section(write_pos, m, jit_region, sections[S_RDATA].offset);
+// when there's relocs the externals are left out of the addresses (they're filled in at load)
+static void jit_write_globals(TB_Module* m, TB_StorageClass storage, uint8_t* output, uint8_t* data, void** slots, DynArray(JITAbsReloc)* relocs) {
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
+            TB_Initializer* init = g->init;
+            if (g->storage != storage || init == NULL) continue;
 
-        // last region is a jump table
-        uint8_t* import_table = jit_region + align_up(m->rdata_region_size, page_size);
-        size_t count = 0;
-        FOREACH_N(i, 0, m->max_threads) {
-            pool_for(TB_External, ext, m->thread_info[i].externals) {
-                // replace the ext->address with the jump table
-                void* old = ext->super.address;
-                void* new = import_table + (count * sizeof(void*));
+            memset(&output[g->pos], 0, init->size);
+            FOREACH_N(k, 0, init->obj_count) {
+                const TB_InitObj* o = &init->objects[k];
+                uint8_t* loc = &output[g->pos + o->offset];
 
-                memcpy(new, old, sizeof(void*));
-                ext->super.address = new;
-                count += 1;
+                switch (o->type) {
+                    case TB_INIT_OBJ_REGION:
+                    memcpy(loc, o->region.ptr, o->region.size);
+                    break;
+
+                    case TB_INIT_OBJ_RELOC_GLOBAL:
+                    jit_patch_abs64(loc, (uintptr_t) &data[o->reloc_global->pos]);
+                    jit_add_abs(relocs, loc, JIT_RELOC_BASE);
+                    break;
+
+                    case TB_INIT_OBJ_RELOC_FUNCTION:
+                    jit_patch_abs64(loc, (uintptr_t) o->reloc_function->compiled_pos);
+                    jit_add_abs(relocs, loc, JIT_RELOC_BASE);
+                    break;
+
+                    case TB_INIT_OBJ_RELOC_EXTERN: {
+                        size_t id = o->reloc_extern->super.symbol_id;
+                        jit_patch_abs64(loc, relocs ? 0 : (uintptr_t) slots[id]);
+                        jit_add_abs(relocs, loc, id);
+                        break;
+                    }
+
+                    default: tb_todo();
+                }
             }
         }
+    }
+}
 
-        write_pos += count * sizeof(void*);
+// _tls_index is filled in once the host image is loaded and never changes after,
+// the code loads it with a rel32 which can't reach the host's copy so it reads one
+// we put next to it.
+static uint64_t jit_tls_index_value(const TB_External* e) {
+    if (e->super.address == NULL) {
+        tb_panic("TB JIT: the tls_index '%s' isn't bound (tb_symbol_bind_ptr)", e->super.name);
     }
 
-    // .TEXT
-    {
-        uint8_t* text_section = jit_region + sections[S_TEXT].offset;
-        TB_FOR_FUNCTIONS(f, m) {
-            TB_FunctionOutput* out_f = f->output;
-            if (out_f != NULL) {
-                f->compiled_pos = &text_section[out_f->code_pos];
-                memcpy(&text_section[out_f->code_pos], out_f->code, out_f->code_size);
+    uint32_t value;
+    memcpy(&value, e->super.address, sizeof(value));
+    return value;
+}
+
+// thunk & slot are the import entry when the target is an external (for the tls_index
+// the slot holds its value, see jit_tls_index_value), data is where the first
+// data_size bytes of the data section (the globals) were placed.
+static void jit_patch_symbol(uint8_t* data, size_t data_size, const TB_SymbolPatch* p, uint8_t* rw, uint8_t* loc, uint8_t* thunk, void** slot) {
+    switch (p->target->tag) {
+        case TB_SYMBOL_FUNCTION: {
+            const TB_Function* target = (const TB_Function*) p->target;
+            if (target->compiled_pos == NULL) {
+                tb_panic("TB JIT: '%s' is referenced but was never linked", target->super.name);
+            }
+
+            // there's no addend on calls or function addresses
+            memset(rw, 0, 4);
+            jit_patch_rel32(rw, loc, target->compiled_pos);
+            break;
+        }
+
+        case TB_SYMBOL_EXTERNAL: {
+            if (p->is_function) {
+                jit_patch_rel32(rw, loc, thunk);
+            } else {
+                jit_patch_rel32(rw, loc, (uint8_t*) slot);
             }
+            break;
         }
 
-        // Emit external patches
-        // These have dealt with the jump table so none of our relocations should
-        // cross the 2GB limit.
-        FOREACH_N(i, 0, m->max_threads) {
-            dyn_array_for(j, m->thread_info[i].symbol_patches) {
-                TB_SymbolPatch* p = &m->thread_info[i].symbol_patches[j];
+        case TB_SYMBOL_GLOBAL: {
+            const TB_Global* g = (const TB_Global*) p->target;
+            if (g->storage == TB_STORAGE_TLS) {
+                // offset into the thread's TLS block
+                uint32_t secrel;
+                memcpy(&secrel, rw, sizeof(secrel));
+                secrel += g->pos;
+                memcpy(rw, &secrel, sizeof(secrel));
+            } else {
+                if (g->pos >= data_size) {
+                    tb_panic("TB JIT: global '%s' was made after tb_module_begin_jit", g->super.name);
+                }
+                jit_patch_rel32(rw, loc, &data[g->pos]);
+            }
+            break;
+        }
+
+        default: tb_todo();
+    }
+}
+
+// perf support (see tb_module_set_jit_profiling), there's only one perf map & jitdump
+// per process so the JIT contexts which want them share the files. The jitdump
+// layout is from tools/perf/Documentation/jitdump-specification.txt in the linux tree.
+enum {
+    JITDUMP_MAGIC   = 0x4A695444,
+    JITDUMP_VERSION = 1,
+    JITDUMP_EM_X86_64 = 62,
+
+    JITDUMP_CODE_LOAD       = 0,
+    JITDUMP_CODE_DEBUG_INFO = 2,
+    JITDUMP_CODE_CLOSE      = 3,
+};
+
+typedef struct {
+    uint32_t magic, version, total_size, elf_mach;
+    uint32_t pad, pid;
+    uint64_t timestamp, flags;
+} JITDumpHeader;
+
+typedef struct {
+    uint32_t id, total_size;
+    uint64_t timestamp;
+} JITDumpRecord;
+
+// followed by the name (null terminated) and then the code
+typedef struct {
+    JITDumpRecord rec;
+    uint32_t pid, tid;
+    uint64_t vma, code_addr, code_size, code_index;
+} JITDumpCodeLoad;
+
+// followed by the entries, each is a JITDumpLine & its file name (null terminated)
+typedef struct {
+    JITDumpRecord rec;
+    uint64_t code_addr, count;
+} JITDumpDebugInfo;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t line, discrim;
+} JITDumpLine;
+
+static struct {
+    tb_atomic_int lock;
+    int users;
+
+    // the files are only truncated the first time, anyone after that is
+    // appending to what the earlier contexts wrote.
+    bool started;
 
-                if (p->target->tag == TB_SYMBOL_EXTERNAL) {
-                    TB_FunctionOutput* out_f = p->source->output;
+    FILE* perf_map;
+    FILE* jitdump;
+    void* marker;
+    uint64_t code_index;
+} jit_profile;
 
-                    size_t actual_pos = out_f->code_pos + out_f->prologue_length + p->pos + 4;
+static void jit_profile_open(int flags) {
+    while (tb_atomic_int_store(&jit_profile.lock, 1)) {}
+    if (jit_profile.users++ == 0) {
+        const char* mode = jit_profile.started ? "ab" : "wb";
+        int pid = tb_platform_process_id();
+        char path[64];
 
-                    ptrdiff_t displacement = (uint8_t*)p->target->address - &text_section[actual_pos];
-                    int32_t disp32 = displacement;
+        if (flags & TB_JIT_PERF_MAP) {
+            snprintf(path, sizeof(path), "/tmp/perf-%d.map", pid);
+            jit_profile.perf_map = fopen(path, mode);
+            if (jit_profile.perf_map == NULL) {
+                fprintf(stderr, "TB warning: couldn't open '%s', the JIT'd code won't be in it.\n", path);
+            }
+        }
 
-                    assert(displacement == disp32);
-                    memcpy(&text_section[actual_pos], &disp32, sizeof(disp32));
+        if (flags & TB_JIT_JITDUMP) {
+            snprintf(path, sizeof(path), "/tmp/jit-%d.dump", pid);
+            jit_profile.jitdump = fopen(path, mode);
+            if (jit_profile.jitdump == NULL) {
+                fprintf(stderr, "TB warning: couldn't open '%s', the JIT'd code won't be in it.\n", path);
+            } else {
+                if (!jit_profile.started) {
+                    JITDumpHeader header = {
+                        .magic = JITDUMP_MAGIC, .version = JITDUMP_VERSION,
+                        .total_size = sizeof(JITDumpHeader), .elf_mach = JITDUMP_EM_X86_64,
+                        .pid = pid, .timestamp = tb_platform_perf_timestamp(),
+                    };
+                    fwrite(&header, sizeof(header), 1, jit_profile.jitdump);
+                    fflush(jit_profile.jitdump);
                 }
+
+                jit_profile.marker = tb_platform_jitdump_marker(jit_profile.jitdump, JIT_PAGE_SIZE);
             }
         }
+
+        jit_profile.started = true;
     }
+    tb_atomic_int_store(&jit_profile.lock, 0);
+}
+
+static void jit_profile_close(void) {
+    while (tb_atomic_int_store(&jit_profile.lock, 1)) {}
+    if (--jit_profile.users == 0) {
+        if (jit_profile.perf_map != NULL) {
+            fclose(jit_profile.perf_map);
+            jit_profile.perf_map = NULL;
+        }
+
+        if (jit_profile.jitdump != NULL) {
+            JITDumpRecord rec = { JITDUMP_CODE_CLOSE, sizeof(JITDumpRecord), tb_platform_perf_timestamp() };
+            fwrite(&rec, sizeof(rec), 1, jit_profile.jitdump);
+            fclose(jit_profile.jitdump);
+            jit_profile.jitdump = NULL;
 
-    // .DATA
-    write_pos = tb_helper_write_data_section(sections[S_DATA].offset, m, jit_region, sections[S_DATA].offset);
-    FOREACH_N(i, 0, section_count) {
-        tb_platform_vprotect(jit_region + sections[i].offset, sections[i].size, sections[i].protect);
+            if (jit_profile.marker != NULL) {
+                tb_platform_jitdump_marker_free(jit_profile.marker, JIT_PAGE_SIZE);
+                jit_profile.marker = NULL;
+            }
+        }
     }
+    tb_atomic_int_store(&jit_profile.lock, 0);
+}
 
-    m->jit_region_size = jit_region_size;
-    m->jit_region = jit_region;
-    #endif
+// the line info is only written once per run of the same line (like the codeview tables)
+static bool jit_profile_line_starts(TB_Function* f, size_t i) {
+    TB_Line* l = &f->lines[i];
+    return l->file != 0 && (i == 0 || l->line != l[-1].line || l->file != l[-1].file);
 }
 
-TB_API void tb_module_end_jit(TB_JITContext* jit) {
-    tb_platform_vfree(jit->heap.block, jit->heap.capacity);
-    tb_platform_heap_free(jit);
+static void jit_profile_debug_info(TB_Function* f, uint8_t* code, uint64_t timestamp) {
+    TB_Module* m = f->super.module;
+    uint64_t count = 0, size = sizeof(JITDumpDebugInfo);
+    FOREACH_N(i, 0, f->line_count) if (jit_profile_line_starts(f, i)) {
+        count += 1;
+        size += sizeof(JITDumpLine) + strlen(m->files.data[f->lines[i].file].path) + 1;
+    }
+
+    if (count == 0) return;
+
+    JITDumpDebugInfo info = { { JITDUMP_CODE_DEBUG_INFO, size, timestamp }, (uintptr_t) code, count };
+    fwrite(&info, sizeof(info), 1, jit_profile.jitdump);
+
+    // the positions are relative to the body except for the first line
+    size_t body_start = f->output->prologue_length;
+    FOREACH_N(i, 0, f->line_count) if (jit_profile_line_starts(f, i)) {
+        TB_Line* line = &f->lines[i];
+        JITDumpLine entry = { (uintptr_t) &code[line->pos ? body_start + line->pos : 0], line->line };
+        const char* path = m->files.data[line->file].path;
+
+        fwrite(&entry, sizeof(entry), 1, jit_profile.jitdump);
+        fwrite(path, strlen(path) + 1, 1, jit_profile.jitdump);
+    }
+}
+
+// f's code was just placed at code (and is done being patched)
+static void jit_profile_code(TB_JITContext* jit, TB_Function* f, uint8_t* code) {
+    if (!jit->profiling) return;
+
+    const char* name = f->super.name;
+    size_t code_size = f->output->code_size;
+
+    while (tb_atomic_int_store(&jit_profile.lock, 1)) {}
+    if (jit_profile.perf_map != NULL) {
+        fprintf(jit_profile.perf_map, "%llx %llx %s\n", (unsigned long long) (uintptr_t) code, (unsigned long long) code_size, name);
+        fflush(jit_profile.perf_map);
+    }
+
+    if (jit_profile.jitdump != NULL) {
+        // the debug info goes before the code load it's talking about
+        uint64_t timestamp = tb_platform_perf_timestamp();
+        jit_profile_debug_info(f, code, timestamp);
+
+        size_t name_size = strlen(name) + 1;
+        JITDumpCodeLoad load = {
+            .rec = { JITDUMP_CODE_LOAD, sizeof(JITDumpCodeLoad) + name_size + code_size, timestamp },
+            .pid = tb_platform_process_id(), .tid = tb_platform_thread_id(),
+            .vma = (uintptr_t) code, .code_addr = (uintptr_t) code, .code_size = code_size,
+            .code_index = jit_profile.code_index++,
+        };
+        fwrite(&load, sizeof(load), 1, jit_profile.jitdump);
+        fwrite(name, name_size, 1, jit_profile.jitdump);
+        fwrite(code, code_size, 1, jit_profile.jitdump);
+        fflush(jit_profile.jitdump);
+    }
+    tb_atomic_int_store(&jit_profile.lock, 0);
+}
+
+// GDB JIT interface, the debugger breaks on __jit_debug_register_code and walks the
+// descriptor's list of in-memory objects whenever it's called. The names & layouts are
+// fixed and there's one list per process so every JIT context shares it.
+typedef enum {
+    JIT_DEBUG_NOACTION,
+    JIT_DEBUG_REGISTER,
+    JIT_DEBUG_UNREGISTER,
+} JITDebugAction;
+
+struct JITDebugImage {
+    // gdb's jit_code_entry
+    JITDebugImage* next;
+    JITDebugImage* prev;
+    const uint8_t* symfile;
+    uint64_t symfile_size;
+
+    // bodies in it which haven't been freed
+    size_t live;
+};
+
+typedef struct {
+    uint32_t version;
+    uint32_t action_flag;
+    JITDebugImage* relevant_entry;
+    JITDebugImage* first_entry;
+} JITDebugDescriptor;
+
+JITDebugDescriptor __jit_debug_descriptor = { 1, JIT_DEBUG_NOACTION, NULL, NULL };
+
+#ifdef _MSC_VER
+__declspec(noinline) void __jit_debug_register_code(void) { _ReadWriteBarrier(); }
+#else
+__attribute__((noinline)) void __jit_debug_register_code(void) { __asm__ volatile("" ::: "memory"); }
+#endif
+
+static tb_atomic_int jit_debug_lock;
+
+static void jit_debug_register(JITDebugImage* image) {
+    while (tb_atomic_int_store(&jit_debug_lock, 1)) {}
+    image->prev = NULL;
+    image->next = __jit_debug_descriptor.first_entry;
+    if (image->next != NULL) image->next->prev = image;
+    __jit_debug_descriptor.first_entry = image;
+
+    __jit_debug_descriptor.relevant_entry = image;
+    __jit_debug_descriptor.action_flag = JIT_DEBUG_REGISTER;
+    __jit_debug_register_code();
+    tb_atomic_int_store(&jit_debug_lock, 0);
+}
+
+static void jit_debug_unregister(JITDebugImage* image) {
+    while (tb_atomic_int_store(&jit_debug_lock, 1)) {}
+    if (image->prev != NULL) image->prev->next = image->next;
+    else __jit_debug_descriptor.first_entry = image->next;
+    if (image->next != NULL) image->next->prev = image->prev;
+
+    __jit_debug_descriptor.relevant_entry = image;
+    __jit_debug_descriptor.action_flag = JIT_DEBUG_UNREGISTER;
+    __jit_debug_register_code();
+    tb_atomic_int_store(&jit_debug_lock, 0);
+
+    tb_platform_heap_free((void*) image->symfile);
+    tb_platform_heap_free(image);
+}
+
+static JITDebugImage* jit_debug_image(TB_Module* m, size_t region_count, const TB_JITImageRegion* regions, size_t symbol_count, const TB_JITImageSymbol* symbols) {
+    JITDebugImage* image = tb_platform_heap_alloc(sizeof(JITDebugImage));
+    *image = (JITDebugImage){ .live = symbol_count };
+    image->symfile = tb__elf64_write_jit_image(m, region_count, regions, symbol_count, symbols, &image->symfile_size);
+
+    jit_debug_register(image);
+    return image;
+}
+
+// where code is in the sorted bodies (or where it'd go)
+static size_t jit_debug_find(TB_JITContext* jit, uint8_t* code) {
+    size_t lo = 0, hi = jit->debug_body_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (jit->debug_bodies[mid].code < code) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+// makes an image out of the bodies waiting on a batch, the caller holds the debug lock
+static void jit_debug_flush(TB_JITContext* jit) {
+    size_t count = jit->debug_pending;
+    if (count == 0) return;
+
+    TB_JITImageRegion* regions = tb_platform_heap_alloc(count * sizeof(TB_JITImageRegion));
+    TB_JITImageSymbol* symbols = tb_platform_heap_alloc(count * sizeof(TB_JITImageSymbol));
+
+    size_t j = 0;
+    FOREACH_N(i, 0, jit->debug_body_count) if (jit->debug_bodies[i].image == NULL) {
+        JITDebugBody* b = &jit->debug_bodies[i];
+        regions[j] = (TB_JITImageRegion){ b->code, b->size };
+        symbols[j] = (TB_JITImageSymbol){ b->name, j, 0, b->size, b->has_frame };
+        j += 1;
+    }
+
+    JITDebugImage* image = jit_debug_image(jit->module, count, regions, count, symbols);
+    FOREACH_N(i, 0, jit->debug_body_count) if (jit->debug_bodies[i].image == NULL) {
+        jit->debug_bodies[i].image = image;
+    }
+    jit->debug_pending = 0;
+
+    tb_platform_heap_free(regions);
+    tb_platform_heap_free(symbols);
+}
+
+static void jit_debug_add_body(TB_JITContext* jit, TB_Function* f, uint8_t* code) {
+    if (!jit->debugging) return;
+
+    while (tb_atomic_int_store(&jit->debug_lock, 1)) {}
+    if (jit->debug_body_count == jit->debug_body_cap) {
+        jit->debug_body_cap = jit->debug_body_cap ? jit->debug_body_cap * 2 : JIT_DEBUG_BATCH;
+        jit->debug_bodies = tb_platform_heap_realloc(jit->debug_bodies, jit->debug_body_cap * sizeof(JITDebugBody));
+    }
+
+    size_t i = jit_debug_find(jit, code);
+    memmove(&jit->debug_bodies[i + 1], &jit->debug_bodies[i], (jit->debug_body_count - i) * sizeof(JITDebugBody));
+    jit->debug_bodies[i] = (JITDebugBody){ code, f->output->code_size, f->super.name, f->output->prologue_length > 0 };
+    jit->debug_body_count += 1;
+
+    if (++jit->debug_pending >= JIT_DEBUG_BATCH) {
+        jit_debug_flush(jit);
+    }
+    tb_atomic_int_store(&jit->debug_lock, 0);
 }
 
+// code is about to be freed, the image goes once none of its bodies are left
+static void jit_debug_remove_body(TB_JITContext* jit, uint8_t* code) {
+    if (!jit->debugging) return;
+
+    while (tb_atomic_int_store(&jit->debug_lock, 1)) {}
+    size_t i = jit_debug_find(jit, code);
+    if (i < jit->debug_body_count && jit->debug_bodies[i].code == code) {
+        JITDebugImage* image = jit->debug_bodies[i].image;
+        if (image == NULL) {
+            jit->debug_pending -= 1;
+        } else if (--image->live == 0) {
+            jit_debug_unregister(image);
+        }
+
+        memmove(&jit->debug_bodies[i], &jit->debug_bodies[i + 1], (jit->debug_body_count - (i + 1)) * sizeof(JITDebugBody));
+        jit->debug_body_count -= 1;
+    }
+    tb_atomic_int_store(&jit->debug_lock, 0);
+}
+
+// patches which were pushed by one thread from some point on, a NULL info
+// means every thread's patches from the start.
+typedef struct {
+    TB_ThreadInfo* info;
+    size_t const_start, symbol_start;
+} JITPatchRange;
+
+typedef struct {
+    TB_PatchChunk* chunk;
+    size_t index;
+} JITPatchIter;
+
+static JITPatchIter jit_patch_iter(TB_PatchList* list, size_t start) {
+    TB_PatchChunk* c = list->first;
+    while (c != NULL && start >= c->count) {
+        start -= c->count;
+        c = c->next;
+    }
+
+    return (JITPatchIter){ c, start };
+}
+
+static void* jit_patch_next(JITPatchIter* it, size_t type_size) {
+    while (it->chunk != NULL && it->index >= it->chunk->count) {
+        it->chunk = it->chunk->next, it->index = 0;
+    }
+
+    if (it->chunk == NULL) return NULL;
+    return &it->chunk->data[(it->index++) * type_size];
+}
+
+#define JIT_FOR_RANGE_INFO(it, m, r) \
+for (TB_ThreadInfo* it = (r).info ? (r).info : (m)->first_thread_info; it != NULL; it = (r).info ? NULL : it->next_in_module)
+
+// links a function compiled after tb_module_begin_jit into its own allocation, it only
+// has the patches which came from it so the externals get an import per patch and
+// the constants are placed right after the code:
+//
+//   [code] [constants] [import thunks] [import slots]
+static uint8_t* jit_link_body(TB_JITContext* jit, TB_Function* f, JITPatchRange r) {
+    TB_Module* m = f->super.module;
+    TB_FunctionOutput* out_f = f->output;
+
+    size_t const_size = 0, import_count = 0;
+    JIT_FOR_RANGE_INFO(info, m, r) {
+        JITPatchIter it = jit_patch_iter(&info->const_patches, r.info ? r.const_start : 0);
+        for (TB_ConstPoolPatch* p; (p = jit_patch_next(&it, sizeof(TB_ConstPoolPatch)));) {
+            if (p->source == f && !p->dead) {
+                const_size = align_up(const_size, p->length > 8 ? 16 : 1) + p->length;
+            }
+        }
+
+        it = jit_patch_iter(&info->symbol_patches, r.info ? r.symbol_start : 0);
+        for (TB_SymbolPatch* p; (p = jit_patch_next(&it, sizeof(TB_SymbolPatch)));) {
+            if (p->source == f && !p->dead && p->target->tag == TB_SYMBOL_EXTERNAL) {
+                import_count += 1;
+            }
+        }
+    }
+
+    size_t consts_pos = align_up(out_f->code_size, 16);
+    size_t thunks_pos = align_up(consts_pos + const_size, JIT_THUNK_SIZE);
+    size_t slots_pos = thunks_pos + (import_count * JIT_THUNK_SIZE);
+    size_t size = slots_pos + (import_count * sizeof(void*));
+
+    uint8_t* code = tb_jitheap_alloc_region(&jit->heap, size, TB_PAGE_READEXECUTE);
+    uint8_t* code_rw = tb_jitheap_writable(&jit->heap, code);
+    memcpy(code_rw, out_f->code, out_f->code_size);
+
+    size_t const_pos = consts_pos, import = 0;
+    JIT_FOR_RANGE_INFO(info, m, r) {
+        JITPatchIter it = jit_patch_iter(&info->const_patches, r.info ? r.const_start : 0);
+        for (TB_ConstPoolPatch* p; (p = jit_patch_next(&it, sizeof(TB_ConstPoolPatch)));) {
+            if (p->source != f || p->dead) continue;
+
+            const_pos = align_up(const_pos, p->length > 8 ? 16 : 1);
+            memcpy(&code_rw[const_pos], p->data, p->length);
+
+            // the addend is the rdata_pos so we offset the target to cancel it out
+            size_t pos = out_f->prologue_length + p->pos;
+            jit_patch_rel32(&code_rw[pos], &code[pos], &code[const_pos] - p->rdata_pos);
+            const_pos += p->length;
+        }
+
+        it = jit_patch_iter(&info->symbol_patches, r.info ? r.symbol_start : 0);
+        for (TB_SymbolPatch* p; (p = jit_patch_next(&it, sizeof(TB_SymbolPatch)));) {
+            if (p->source != f || p->dead) continue;
+
+            uint8_t* thunk = NULL;
+            void** slot = NULL;
+            if (p->target->tag == TB_SYMBOL_EXTERNAL) {
+                size_t thunk_pos = thunks_pos + (import * JIT_THUNK_SIZE);
+                size_t slot_pos = slots_pos + (import * sizeof(void*));
+                import += 1;
+
+                thunk = &code[thunk_pos];
+                slot = (void**) &code[slot_pos];
+
+                if (p->target == m->tls_index_extern) {
+                    uint64_t value = jit_tls_index_value((const TB_External*) p->target);
+                    memcpy(&code_rw[slot_pos], &value, sizeof(value));
+                } else {
+                    memcpy(&code_rw[slot_pos], &p->target->address, sizeof(void*));
+                }
+                jit_write_thunk(&code_rw[thunk_pos], thunk, slot);
+            }
+
+            size_t pos = out_f->prologue_length + p->pos;
+            jit_patch_symbol(jit->sections[S_DATA].ptr, jit->global_data_size, p, &code_rw[pos], &code[pos], thunk, slot);
+        }
+    }
+
+    jit_profile_code(jit, f, code);
+    jit_debug_add_body(jit, f, code);
+    return code;
+}
+
+// code which other threads might still be running, it's freed by tb_jit_reclaim
+static uint64_t jit_retire(TB_JITContext* jit, uint8_t* old) {
+    while (tb_atomic_int_store(&jit->retired_lock, 1)) {}
+    uint64_t epoch = ++jit->epoch;
+
+    // the code from tb_module_begin_jit (lazy stubs included) is one big
+    // allocation so it's only the separately linked bodies that can be freed.
+    uint8_t* text = jit->sections[S_TEXT].ptr;
+    if (old < text || old >= text + jit->sections[S_TEXT].size) {
+        TB_JITRetired* r = tb_platform_heap_alloc(sizeof(TB_JITRetired));
+        r->next = jit->retired;
+        r->code = old;
+        r->epoch = epoch;
+        jit->retired = r;
+    }
+    tb_atomic_int_store(&jit->retired_lock, 0);
+
+    return epoch;
+}
+
+// swaps the entry over to the new code, anyone calling through it from now on gets it
+static uint64_t jit_install(TB_JITContext* jit, size_t index, uint8_t* code) {
+    uint8_t* old = tb_atomic_ptr_exchange(&jit->entry_slots[index], code);
+    return jit_retire(jit, old);
+}
+
+static size_t jit_entry_index(TB_JITContext* jit, TB_Function* f) {
+    return ((uint8_t*) f->compiled_pos - jit->entries) / JIT_THUNK_SIZE;
+}
+
+// recompiles a hot function with the optimizer, runs on the tier up thread
+static void jit_tier_up(TB_JITContext* jit, TB_Function* f, size_t stub) {
+    TB_Module* m = f->super.module;
+    size_t index = jit_entry_index(jit, f);
+
+    // tier 0 was already linked so the old output isn't needed anymore
+    tb__function_optimize(f, jit->tier_pass_count, jit->tier_passes);
+
+    TB_ThreadInfo* info = tb__get_thread_info(m);
+    JITPatchRange r = { info, info->const_patches.count, info->symbol_patches.count };
+
+    dyn_array_destroy(f->output->stack_slots);
+    f->output = NULL;
+    tb_module_compile_function(m, f, jit->tier_isel);
+    uint8_t* code = jit_link_body(jit, f, r);
+
+    // it only goes in if the entry is still counting, tb_jit_redefine might've beaten us
+    uint8_t* count_stub = &jit->count_stubs[stub * JIT_COUNT_STUB_SIZE];
+    while (tb_atomic_int_store(&jit->entry_locks[index], 1)) {}
+    bool installed = tb_atomic_ptr_cmpxchg(&jit->entry_slots[index], count_stub, code);
+    tb_atomic_int_store(&jit->entry_locks[index], 0);
+
+    if (!installed) {
+        // nobody could've seen it
+        jit_debug_remove_body(jit, code);
+        tb_jitheap_free_region(&jit->heap, code);
+    }
+
+    // either way nothing goes through the counting stub anymore
+    jit_retire(jit, jit->tier_data[stub].tier0);
+}
+
+static void jit_tier_worker(void* arg) {
+    TB_JITContext* jit = arg;
+    for (;;) {
+        while (tb_atomic_int_store(&jit->tier_lock, 1)) {}
+        JITTierItem* item = jit->tier_stop ? NULL : jit->tier_queue;
+        if (item == NULL) {
+            jit->tier_running = false;
+            tb_atomic_int_store(&jit->tier_lock, 0);
+            break;
+        }
+        jit->tier_queue = item->next;
+        tb_atomic_int_store(&jit->tier_lock, 0);
+
+        jit_tier_up(jit, item->f, item->stub);
+        tb_platform_heap_free(item);
+    }
+
+    tb_free_thread_resources();
+}
+
+static void jit_tier_enqueue(TB_JITContext* jit, TB_Function* f, size_t stub) {
+    JITTierItem* item = tb_platform_heap_alloc(sizeof(JITTierItem));
+    item->f = f;
+    item->stub = stub;
+
+    while (tb_atomic_int_store(&jit->tier_lock, 1)) {}
+    item->next = jit->tier_queue;
+    jit->tier_queue = item;
+
+    if (!jit->tier_running && !jit->tier_stop) {
+        // the last worker saw an empty queue so it's done (or just about)
+        if (jit->tier_thread != NULL) {
+            tb_platform_thread_join(jit->tier_thread);
+        }
+
+        // if we can't make a thread the queue waits for the next hot function
+        jit->tier_thread = tb_platform_thread_create(jit_tier_worker, jit);
+        jit->tier_running = (jit->tier_thread != NULL);
+    }
+    tb_atomic_int_store(&jit->tier_lock, 0);
+}
+
+// the lazy stubs land here, f's entry is swapped over to the real code before jumping to it
+static void* jit_lazy_compile(TB_JITContext* jit, TB_Function* f) {
+    TB_Module* m = f->super.module;
+    size_t index = jit_entry_index(jit, f);
+
+    // someone else might've gotten here first (or it was redefined)
+    while (tb_atomic_int_store(&jit->entry_locks[index], 1)) {}
+    uint8_t* code = jit->entry_slots[index];
+    if (code >= jit->lazy_stubs && code < jit->lazy_stubs_end) {
+        size_t stub = (code - jit->lazy_stubs) / JIT_LAZY_STUB_SIZE;
+
+        // the compile pushes its patches onto this thread's lists so we only look at those
+        TB_ThreadInfo* info = tb__get_thread_info(m);
+        JITPatchRange r = { info, info->const_patches.count, info->symbol_patches.count };
+
+        tb_module_compile_function(m, f, jit->lazy_isel);
+        code = jit_link_body(jit, f, r);
+
+        if (jit->tiered) {
+            // count the calls until it's hot
+            jit->tier_data[stub].tier0 = code;
+            jit->tier_data[stub].counter = jit->tier_threshold;
+
+            jit_install(jit, index, &jit->count_stubs[stub * JIT_COUNT_STUB_SIZE]);
+        } else {
+            jit_install(jit, index, code);
+        }
+    } else if (code >= jit->count_stubs && code < jit->count_stubs_end) {
+        // the counter ran out, it's left huge so we don't come back while it's queued
+        size_t stub = (code - jit->count_stubs) / JIT_COUNT_STUB_SIZE;
+        JITTierData* t = &jit->tier_data[stub];
+        t->counter = INT32_MAX;
+        code = t->tier0;
+
+        if (!t->queued) {
+            t->queued = 1;
+            jit_tier_enqueue(jit, f, stub);
+        }
+    }
+    tb_atomic_int_store(&jit->entry_locks[index], 0);
+
+    return code;
+}
+
+// saves the argument registers (and rax for varargs), calls jit_lazy_compile(jit, r11)
+// and jumps to whatever it returned. r11 is the TB_Function* which the stubs load.
+static size_t jit_write_lazy_resolver(uint8_t* out, TB_JITContext* jit) {
+    static const uint8_t save[] = {
+        0x55,                                     // push rbp
+        0x48, 0x89, 0xE5,                         // mov rbp, rsp
+        0x57, 0x56, 0x52, 0x51,                   // push rdi, rsi, rdx, rcx
+        0x41, 0x50, 0x41, 0x51, 0x50,             // push r8, r9, rax
+        0x48, 0x81, 0xEC, 0xA8, 0x00, 0x00, 0x00, // sub rsp, 168
+    };
+
+    static const uint8_t restore[] = {
+        0x48, 0x81, 0xC4, 0xA8, 0x00, 0x00, 0x00, // add rsp, 168
+        0x58, 0x41, 0x59, 0x41, 0x58,             // pop rax, r9, r8
+        0x59, 0x5A, 0x5E, 0x5F,                   // pop rcx, rdx, rsi, rdi
+        0x5D,                                     // pop rbp
+        0x41, 0xFF, 0xE3,                         // jmp r11
+    };
+
+    #if _WIN32
+    static const uint8_t args[] = { 0x48, 0xB9, 0x4C, 0x89, 0xDA }; // mov rcx, imm64 / mov rdx, r11
+    #else
+    static const uint8_t args[] = { 0x48, 0xBF, 0x4C, 0x89, 0xDE }; // mov rdi, imm64 / mov rsi, r11
+    #endif
+
+    // the 32 bytes past rsp are the shadow space on win64, the xmm args go after
+    size_t n = 0;
+    memcpy(&out[n], save, sizeof(save)), n += sizeof(save);
+    FOREACH_N(i, 0, 8) {
+        // movdqu [rsp + 32 + i*16], xmmi
+        uint32_t disp = 32 + (i * 16);
+        out[n++] = 0xF3, out[n++] = 0x0F, out[n++] = 0x7F;
+        out[n++] = 0x84 | (i << 3), out[n++] = 0x24;
+        memcpy(&out[n], &disp, 4), n += 4;
+    }
+
+    uint64_t jit_imm = (uintptr_t) jit, fn_imm = (uintptr_t) jit_lazy_compile;
+    memcpy(&out[n], &args[0], 2), n += 2;
+    memcpy(&out[n], &jit_imm, 8), n += 8;
+    memcpy(&out[n], &args[2], 3), n += 3;
+
+    out[n++] = 0x48, out[n++] = 0xB8; // mov rax, imm64
+    memcpy(&out[n], &fn_imm, 8), n += 8;
+    out[n++] = 0xFF, out[n++] = 0xD0; // call rax
+    out[n++] = 0x49, out[n++] = 0x89, out[n++] = 0xC3; // mov r11, rax
+
+    FOREACH_N(i, 0, 8) {
+        // movdqu xmmi, [rsp + 32 + i*16]
+        uint32_t disp = 32 + (i * 16);
+        out[n++] = 0xF3, out[n++] = 0x0F, out[n++] = 0x6F;
+        out[n++] = 0x84 | (i << 3), out[n++] = 0x24;
+        memcpy(&out[n], &disp, 4), n += 4;
+    }
+
+    memcpy(&out[n], restore, sizeof(restore)), n += sizeof(restore);
+    assert(n <= JIT_LAZY_RESOLVER_SIZE);
+    return n;
+}
+
+// mov r11, f / jmp resolver
+static void jit_write_lazy_stub(uint8_t* rw, uint8_t* loc, TB_Function* f, uint8_t* resolver) {
+    uint64_t imm = (uintptr_t) f;
+    rw[0] = 0x49, rw[1] = 0xBB;
+    memcpy(&rw[2], &imm, 8);
+
+    rw[10] = 0xE9;
+    memset(&rw[11], 0, 4);
+    jit_patch_rel32(&rw[11], &loc[11], resolver);
+
+    memset(&rw[15], 0xCC, JIT_LAZY_STUB_SIZE - 15);
+}
+
+// dec dword [rip + counter] / jz lazy_stub / jmp qword [rip + tier0]
+//
+// the decrement isn't atomic, we only need a rough count
+static void jit_write_count_stub(uint8_t* rw, uint8_t* loc, JITTierData* t, uint8_t* lazy_stub) {
+    rw[0] = 0xFF, rw[1] = 0x0D;
+    memset(&rw[2], 0, 4);
+    jit_patch_rel32(&rw[2], &loc[2], (uint8_t*) &t->counter);
+
+    rw[6] = 0x0F, rw[7] = 0x84;
+    memset(&rw[8], 0, 4);
+    jit_patch_rel32(&rw[8], &loc[8], lazy_stub);
+
+    rw[12] = 0xFF, rw[13] = 0x25;
+    memset(&rw[14], 0, 4);
+    jit_patch_rel32(&rw[14], &loc[14], (uint8_t*) &t->tier0);
+
+    memset(&rw[18], 0xCC, JIT_COUNT_STUB_SIZE - 18);
+}
+
+// where everything linked in one go is placed, the import thunks & entries go after
+// the code, the import slots (and the tls_index copy) after the constants and the entry
+// slots after the globals since they're written to.
+typedef struct {
+    size_t external_count, entry_count, lazy_count, tier_count;
+
+    size_t thunks_pos, entries_pos, resolver_pos, stubs_pos, count_stubs_pos;
+    size_t slots_pos, tls_index_pos;
+    size_t entry_slots_pos, tier_data_pos;
+
+    size_t sizes[S_MAX];
+} JITLayout;
+
+static JITLayout jit_layout(TB_Module* m, bool lazy, bool tiered) {
+    JITLayout l = { 0 };
+
+    // we don't run emit_call_patches, calls are resolved
+    // to the entry thunks down below.
+    size_t text_size = tb_helper_get_text_section_layout(m, 0);
+
+    TB_FOR_THREAD_INFO(info, m) {
+        l.external_count += pool_popcount(info->externals);
+    }
+
+    // when we're lazy the functions which haven't been compiled get entries too,
+    // they start off pointing at a stub.
+    TB_FOR_FUNCTIONS(f, m) {
+        if (f->output != NULL) l.entry_count++;
+        else if (lazy) l.entry_count++, l.lazy_count++;
+    }
+
+    l.thunks_pos = align_up(text_size, JIT_THUNK_SIZE);
+    l.entries_pos = l.thunks_pos + (l.external_count * JIT_THUNK_SIZE);
+    l.resolver_pos = align_up(l.entries_pos + (l.entry_count * JIT_THUNK_SIZE), 16);
+    l.stubs_pos = l.resolver_pos + (l.lazy_count ? JIT_LAZY_RESOLVER_SIZE : 0);
+    l.count_stubs_pos = l.stubs_pos + (l.lazy_count * JIT_LAZY_STUB_SIZE);
+    l.tier_count = tiered ? l.lazy_count : 0;
+
+    l.slots_pos = align_up(m->rdata_region_size, sizeof(void*));
+    l.tls_index_pos = l.slots_pos + (l.external_count * sizeof(void*));
+    l.entry_slots_pos = align_up(m->data_region_size, sizeof(void*));
+    l.tier_data_pos = l.entry_slots_pos + (l.entry_count * sizeof(void*));
+
+    l.sizes[S_TEXT]  = l.count_stubs_pos + (l.tier_count * JIT_COUNT_STUB_SIZE);
+    l.sizes[S_RDATA] = l.tls_index_pos + (m->tls_index_extern ? sizeof(uint64_t) : 0);
+    l.sizes[S_DATA]  = l.tier_data_pos + (l.tier_count * sizeof(JITTierData));
+    l.sizes[S_TLS]   = m->tls_region_size;
+    return l;
+}
+
+// writes everything in the layout except for the lazy & counting stubs, base is where
+// each section runs from and views is where it gets written. The functions with entries
+// get their compiled_pos and while we're linking the externals are numbered (the address
+// shares a union with the symbol_id) and their addresses live in the import slots.
+//
+// with relocs every absolute address that's written gets recorded and the externals
+// are left out of them, they're filled in whenever the image is loaded.
+static void jit_link_sections(TB_Module* m, const JITLayout* l, uint8_t* base[S_MAX], uint8_t* views[S_MAX], bool lazy, DynArray(JITAbsReloc)* relocs) {
+    uint8_t* text  = base[S_TEXT];
+    uint8_t* rdata = base[S_RDATA];
+    uint8_t* data  = base[S_DATA];
+
+    uint8_t* text_rw = views[S_TEXT];
+    if (text_rw != NULL) {
+        tb_helper_write_text_section(0, m, text_rw, 0);
+    }
+
+    if (views[S_RDATA] != NULL) {
+        tb_helper_write_rodata_section(0, m, views[S_RDATA], 0);
+    }
+
+    // before the import table since that's where the address gets swapped for the symbol_id
+    void** tls_index_slot = NULL;
+    if (m->tls_index_extern != NULL) {
+        uint64_t value = jit_tls_index_value((const TB_External*) m->tls_index_extern);
+        memcpy(&views[S_RDATA][l->tls_index_pos], &value, sizeof(value));
+        tls_index_slot = (void**) &rdata[l->tls_index_pos];
+    }
+
+    // import table
+    uint8_t* thunks = &text[l->thunks_pos];
+    void** slots = (void**) &rdata[l->slots_pos];
+    void** slots_rw = (void**) &views[S_RDATA][l->slots_pos];
+    size_t i = 0;
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
+            if (relocs == NULL && ext->super.address == NULL) {
+                fprintf(stderr, "TB warning: external '%s' isn't bound (tb_symbol_bind_ptr), calling it will crash.\n", ext->super.name);
+            }
+            slots_rw[i] = ext->super.address;
+            ext->super.symbol_id = i;
+            jit_add_abs(relocs, (uint8_t*) &slots_rw[i], i);
+
+            jit_write_thunk(&text_rw[l->thunks_pos + (i * JIT_THUNK_SIZE)], &thunks[i * JIT_THUNK_SIZE], &slots[i]);
+            i += 1;
+        }
+    }
+
+    // entries, the functions are called through these from now on
+    uint8_t* entries = &text[l->entries_pos];
+    void** entry_slots = (void**) &data[l->entry_slots_pos];
+    void** entry_slots_rw = (void**) &views[S_DATA][l->entry_slots_pos];
+
+    i = 0;
+    size_t stub = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        if (f->output != NULL) {
+            entry_slots_rw[i] = &text[f->output->code_pos];
+        } else if (lazy) {
+            entry_slots_rw[i] = &text[l->stubs_pos + (stub * JIT_LAZY_STUB_SIZE)];
+            stub += 1;
+        } else {
+            continue;
+        }
+
+        jit_add_abs(relocs, (uint8_t*) &entry_slots_rw[i], JIT_RELOC_BASE);
+        jit_write_thunk(&text_rw[l->entries_pos + (i * JIT_THUNK_SIZE)], &entries[i * JIT_THUNK_SIZE], &entry_slots[i]);
+        f->compiled_pos = &entries[i * JIT_THUNK_SIZE];
+        i += 1;
+    }
+
+    jit_write_globals(m, TB_STORAGE_DATA, views[S_DATA], data, slots_rw, relocs);
+    jit_write_globals(m, TB_STORAGE_TLS, views[S_TLS], data, slots_rw, relocs);
+
+    // Code patches
+    TB_FOR_THREAD_INFO(info, m) {
+        TB_FOR_PATCHES(TB_SymbolPatch, p, info->symbol_patches) {
+            TB_FunctionOutput* out_f = p->source->output;
+            size_t pos = out_f->code_pos + out_f->prologue_length + p->pos;
+
+            uint8_t* thunk = NULL;
+            void** slot = NULL;
+            if (p->target->tag == TB_SYMBOL_EXTERNAL) {
+                thunk = &thunks[p->target->symbol_id * JIT_THUNK_SIZE];
+                slot = p->target == m->tls_index_extern ? tls_index_slot : &slots[p->target->symbol_id];
+            }
+
+            jit_patch_symbol(data, m->data_region_size, p, &text_rw[pos], &text[pos], thunk, slot);
+        }
+
+        TB_FOR_PATCHES(TB_ConstPoolPatch, p, info->const_patches) {
+            TB_FunctionOutput* out_f = p->source->output;
+            size_t pos = out_f->code_pos + out_f->prologue_length + p->pos;
+
+            // the codegen already wrote the rdata_pos in as the addend
+            jit_patch_rel32(&text_rw[pos], &text[pos], rdata);
+        }
+    }
+
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
+            ext->super.address = slots_rw[ext->super.symbol_id];
+        }
+    }
+}
+
+// tiering implies lazy
+static TB_JITContext* jit_link_module(TB_Module* m, size_t jit_heap_capacity, bool lazy, TB_ISelMode isel_mode, const TB_JITTiering* tiering) {
+    if (!m->is_jit) {
+        tb_panic("tb_module_begin_jit: the module wasn't created for JIT (see tb_module_create)");
+    }
+
+    if (m->target_arch != TB_ARCH_X86_64) {
+        tb_panic("tb_module_begin_jit: only x64 is supported");
+    }
+
+    TB_JITContext* jit = tb_platform_heap_alloc(sizeof(TB_JITContext));
+    *jit = (TB_JITContext){ .module = m };
+    tb_jitheap_init(&jit->heap, jit_heap_capacity ? jit_heap_capacity : 4*1024*1024);
+
+    JITLayout l = jit_layout(m, lazy, tiering != NULL);
+
+    TB_JITSection* sections = jit->sections;
+    sections[S_TEXT]  = (TB_JITSection){ .size = l.sizes[S_TEXT],  .protect = TB_PAGE_READEXECUTE };
+    sections[S_RDATA] = (TB_JITSection){ .size = l.sizes[S_RDATA], .protect = TB_PAGE_READONLY    };
+    sections[S_DATA]  = (TB_JITSection){ .size = l.sizes[S_DATA],  .protect = TB_PAGE_READWRITE   };
+    sections[S_TLS]   = (TB_JITSection){ .size = l.sizes[S_TLS],   .protect = TB_PAGE_READONLY    };
+    jit->global_data_size = m->data_region_size;
+
+    // each section is its own allocation so they can be protected separately, we
+    // write everything through the heap's writable alias so the code is never
+    // writable where it runs.
+    uint8_t* base[S_MAX] = { 0 };
+    uint8_t* views[S_MAX] = { 0 };
+    FOREACH_N(i, 0, S_MAX) {
+        if (sections[i].size > 0) {
+            base[i] = sections[i].ptr = tb_jitheap_alloc_region(&jit->heap, sections[i].size, sections[i].protect);
+            views[i] = tb_jitheap_writable(&jit->heap, sections[i].ptr);
+        }
+    }
+
+    uint8_t* text = base[S_TEXT];
+    uint8_t* data = base[S_DATA];
+    uint8_t* text_rw = views[S_TEXT];
+
+    jit->entries = &text[l.entries_pos];
+    jit->entry_slots = (void**) &data[l.entry_slots_pos];
+    jit->entry_count = l.entry_count;
+
+    if (l.lazy_count > 0) {
+        jit->lazy_isel = isel_mode;
+        jit->lazy_stubs = &text[l.stubs_pos];
+        jit->lazy_stubs_end = &text[l.stubs_pos + (l.lazy_count * JIT_LAZY_STUB_SIZE)];
+        jit->entry_locks = tb_platform_heap_alloc(l.entry_count * sizeof(tb_atomic_int));
+        memset(jit->entry_locks, 0, l.entry_count * sizeof(tb_atomic_int));
+
+        jit_write_lazy_resolver(&text_rw[l.resolver_pos], jit);
+    }
+
+    if (l.tier_count > 0) {
+        jit->tiered = true;
+        jit->tier_threshold = tiering->threshold ? tiering->threshold : JIT_DEFAULT_TIER_THRESHOLD;
+        jit->count_stubs = &text[l.count_stubs_pos];
+        jit->count_stubs_end = &text[l.count_stubs_pos + (l.tier_count * JIT_COUNT_STUB_SIZE)];
+        jit->tier_data = (JITTierData*) &data[l.tier_data_pos];
+        memset(jit->tier_data, 0, l.tier_count * sizeof(JITTierData));
+
+        jit->tier_isel = tiering->isel_mode;
+        jit->tier_pass_count = tiering->pass_count;
+        jit->tier_passes = tb_platform_heap_alloc(tiering->pass_count * sizeof(TB_Pass));
+        memcpy(jit->tier_passes, tiering->passes, tiering->pass_count * sizeof(TB_Pass));
+    }
+
+    jit_link_sections(m, &l, base, views, lazy, NULL);
+
+    // the entries of the functions which weren't compiled point at these
+    if (l.lazy_count > 0) {
+        size_t stub = 0;
+        TB_FOR_FUNCTIONS(f, m) {
+            if (f->output != NULL) continue;
+
+            size_t stub_pos = l.stubs_pos + (stub * JIT_LAZY_STUB_SIZE);
+            jit_write_lazy_stub(&text_rw[stub_pos], &text[stub_pos], f, &text[l.resolver_pos]);
+
+            if (l.tier_count > 0) {
+                size_t count_pos = l.count_stubs_pos + (stub * JIT_COUNT_STUB_SIZE);
+                jit_write_count_stub(&text_rw[count_pos], &text[count_pos], &jit->tier_data[stub], &text[stub_pos]);
+            }
+            stub += 1;
+        }
+    }
+
+    if (m->jit_profiling & (TB_JIT_PERF_MAP | TB_JIT_JITDUMP)) {
+        jit_profile_open(m->jit_profiling);
+        jit->profiling = true;
+
+        TB_FOR_FUNCTIONS(f, m) {
+            if (f->output != NULL) {
+                jit_profile_code(jit, f, &text[f->output->code_pos]);
+            }
+        }
+    }
+
+    if (m->jit_profiling & TB_JIT_GDB) {
+        jit->debugging = true;
+
+        // the whole text section is one region, the resolver sets up a frame like the functions
+        size_t symbol_count = l.lazy_count > 0 ? 1 : 0;
+        TB_FOR_FUNCTIONS(f, m) {
+            symbol_count += (f->output != NULL);
+        }
+
+        TB_JITImageRegion region = { text, sections[S_TEXT].size };
+        TB_JITImageSymbol* symbols = tb_platform_heap_alloc(symbol_count * sizeof(TB_JITImageSymbol));
+
+        size_t j = 0;
+        TB_FOR_FUNCTIONS(f, m) {
+            TB_FunctionOutput* out_f = f->output;
+            if (out_f != NULL) {
+                symbols[j++] = (TB_JITImageSymbol){ f->super.name, 0, out_f->code_pos, out_f->code_size, out_f->prologue_length > 0 };
+            }
+        }
+
+        if (l.lazy_count > 0) {
+            symbols[j++] = (TB_JITImageSymbol){ "tb_jit_lazy_resolver", 0, l.resolver_pos, JIT_LAZY_RESOLVER_SIZE, true };
+        }
+
+        if (symbol_count > 0) {
+            jit->debug_text = jit_debug_image(m, 1, &region, symbol_count, symbols);
+        }
+        tb_platform_heap_free(symbols);
+    }
+
+    return jit;
+}
+
+TB_API TB_JITContext* tb_module_begin_jit(TB_Module* m, size_t jit_heap_capacity) {
+    return jit_link_module(m, jit_heap_capacity, false, TB_ISEL_FAST, NULL);
+}
+
+TB_API TB_JITContext* tb_module_begin_lazy_jit(TB_Module* m, size_t jit_heap_capacity, TB_ISelMode isel_mode) {
+    return jit_link_module(m, jit_heap_capacity, true, isel_mode, NULL);
+}
+
+TB_API TB_JITContext* tb_module_begin_tiered_jit(TB_Module* m, size_t jit_heap_capacity, const TB_JITTiering* tiering) {
+    FOREACH_N(i, 0, tiering->pass_count) {
+        if (tiering->passes[i].mode > TB_FUNCTION_PASS) {
+            tb_panic("tb_module_begin_tiered_jit: only function level passes (and below) can be used when tiering");
+        }
+    }
+
+    return jit_link_module(m, jit_heap_capacity, true, TB_ISEL_FAST, tiering);
+}
+
+TB_API uint64_t tb_jit_redefine(TB_JITContext* jit, TB_Function* f, TB_Function* new_body) {
+    uint8_t* entry = f->compiled_pos;
+    if (entry < jit->entries || entry >= &jit->entries[jit->entry_count * JIT_THUNK_SIZE]) {
+        tb_panic("tb_jit_redefine: '%s' wasn't linked by this JIT context", f->super.name);
+    }
+
+    if (new_body->output == NULL) {
+        tb_panic("tb_jit_redefine: the new body of '%s' hasn't been compiled", f->super.name);
+    }
+
+    if (new_body != f && new_body->compiled_pos != NULL) {
+        tb_panic("tb_jit_redefine: the new body of '%s' is already linked", f->super.name);
+    }
+
+    // calls to the new body (recursion) go through the same entry
+    new_body->compiled_pos = entry;
+
+    uint8_t* code = jit_link_body(jit, new_body, (JITPatchRange){ 0 });
+    size_t index = (entry - jit->entries) / JIT_THUNK_SIZE;
+
+    // a lazy compile of f might be running, it installs under the entry's lock so
+    // we wait for it and go in after (otherwise it'd stomp on us).
+    if (jit->entry_locks == NULL) {
+        return jit_install(jit, index, code);
+    }
+
+    while (tb_atomic_int_store(&jit->entry_locks[index], 1)) {}
+    uint64_t epoch = jit_install(jit, index, code);
+    tb_atomic_int_store(&jit->entry_locks[index], 0);
+    return epoch;
+}
+
+TB_API void tb_jit_reclaim(TB_JITContext* jit, uint64_t epoch) {
+    while (tb_atomic_int_store(&jit->retired_lock, 1)) {}
+    TB_JITRetired** prev = &jit->retired;
+    for (TB_JITRetired* r = jit->retired; r != NULL;) {
+        TB_JITRetired* next = r->next;
+        if (r->epoch <= epoch) {
+            jit_debug_remove_body(jit, r->code);
+            tb_jitheap_free_region(&jit->heap, r->code);
+            tb_platform_heap_free(r);
+            *prev = next;
+        } else {
+            prev = &r->next;
+        }
+        r = next;
+    }
+    tb_atomic_int_store(&jit->retired_lock, 0);
+}
+
+TB_API uint64_t tb_jit_get_epoch(TB_JITContext* jit) {
+    while (tb_atomic_int_store(&jit->retired_lock, 1)) {}
+    uint64_t epoch = jit->epoch;
+    tb_atomic_int_store(&jit->retired_lock, 0);
+
+    return epoch;
+}
+
+TB_API void tb_jit_flush_debug_info(TB_JITContext* jit) {
+    if (!jit->debugging) return;
+
+    while (tb_atomic_int_store(&jit->debug_lock, 1)) {}
+    jit_debug_flush(jit);
+    tb_atomic_int_store(&jit->debug_lock, 0);
+}
+
+TB_API void* tb_jit_get_tls_template(TB_JITContext* jit, size_t* out_size) {
+    *out_size = jit->sections[S_TLS].size;
+    return jit->sections[S_TLS].ptr;
+}
+
+TB_API void tb_module_end_jit(TB_JITContext* jit) {
+    // anything which is still queued doesn't get recompiled
+    while (tb_atomic_int_store(&jit->tier_lock, 1)) {}
+    jit->tier_stop = true;
+    TB_Thread* tier_thread = jit->tier_thread;
+    tb_atomic_int_store(&jit->tier_lock, 0);
+
+    if (tier_thread != NULL) {
+        tb_platform_thread_join(tier_thread);
+    }
+
+    for (JITTierItem* item = jit->tier_queue; item != NULL;) {
+        JITTierItem* next = item->next;
+        tb_platform_heap_free(item);
+        item = next;
+    }
+
+    if (jit->profiling) {
+        jit_profile_close();
+    }
+
+    if (jit->debugging) {
+        // the bodies waiting on a batch were never registered
+        FOREACH_N(i, 0, jit->debug_body_count) {
+            JITDebugImage* image = jit->debug_bodies[i].image;
+            if (image != NULL && --image->live == 0) {
+                jit_debug_unregister(image);
+            }
+        }
+
+        if (jit->debug_text != NULL) {
+            jit_debug_unregister(jit->debug_text);
+        }
+        tb_platform_heap_free(jit->debug_bodies);
+    }
+
+    tb_platform_heap_free(jit->tier_passes);
+    tb_platform_heap_free(jit->entry_locks);
+    for (TB_JITRetired* r = jit->retired; r != NULL;) {
+        TB_JITRetired* next = r->next;
+        tb_platform_heap_free(r);
+        r = next;
+    }
+
+    // the entries go away with the heap, if these stuck around the next JIT on this
+    // module would think the functions are still linked.
+    TB_FOR_FUNCTIONS(f, jit->module) {
+        f->compiled_pos = NULL;
+    }
+
+    tb_jitheap_destroy(&jit->heap);
+    tb_platform_heap_free(jit);
+}
+
+// JIT snapshots, everything tb_module_begin_jit would've linked in one file:
+//
+//   header, symbols (sorted by name), imports, relocations, strings
+//   text, rdata, data, tls (each of them starts on a page)
+//
+// positions are from the start of the file. The sections are linked where they'll sit
+// in the mapping so the code doesn't need touching, only the absolute addresses do and
+// those either get the image's address or an import's added to them.
+enum {
+    // bump this whenever the layout changes
+    JIT_SNAPSHOT_FORMAT = 1,
+
+    // "TBJS"
+    JIT_SNAPSHOT_MAGIC = 0x534A4254,
+};
+
+typedef struct {
+    uint32_t magic, format;
+    uint32_t version, arch;
+
+    uint32_t symbol_count, import_count;
+    uint64_t reloc_count;
+
+    uint64_t symbols_pos, imports_pos, relocs_pos;
+    uint64_t strings_pos, strings_size;
+
+    uint64_t section_pos[S_MAX];
+    uint64_t section_size[S_MAX];
+} JITSnapshotHeader;
+
+// functions point at their entry, the imports are just a name each
+typedef struct {
+    uint64_t name;
+    uint64_t pos;
+} JITSnapshotSymbol;
+
+typedef struct {
+    // JIT_RELOC_BASE when it's the image's address
+    uint32_t import;
+    uint32_t _pad;
+    uint64_t pos;
+} JITSnapshotReloc;
+
+struct TB_JITSnapshot {
+    uint8_t* image;
+    size_t size;
+};
+
+typedef struct {
+    const char* name;
+    uint64_t pos;
+} JITSnapshotName;
+
+static int jit_snapshot_name_cmp(const void* a, const void* b) {
+    return strcmp(((const JITSnapshotName*) a)->name, ((const JITSnapshotName*) b)->name);
+}
+
+static const TB_MemProtect jit_section_protect[S_MAX] = {
+    [S_TEXT]  = TB_PAGE_READEXECUTE,
+    [S_RDATA] = TB_PAGE_READONLY,
+    [S_DATA]  = TB_PAGE_READWRITE,
+    [S_TLS]   = TB_PAGE_READONLY,
+};
+
+TB_API bool tb_module_write_jit_snapshot(TB_Module* m, const char* path) {
+    if (!m->is_jit) {
+        tb_panic("tb_module_write_jit_snapshot: the module wasn't created for JIT (see tb_module_create)");
+    }
+
+    if (m->target_arch != TB_ARCH_X86_64) {
+        tb_panic("tb_module_write_jit_snapshot: only x64 is supported");
+    }
+
+    // it's loaded straight out of the slot which we don't know until the snapshot is loaded
+    if (m->tls_index_extern != NULL) {
+        tb_panic("tb_module_write_jit_snapshot: the tls_index can't be used with snapshots");
+    }
+
+    JITLayout l = jit_layout(m, false, false);
+
+    size_t section_pos[S_MAX], image_size = 0;
+    FOREACH_N(i, 0, S_MAX) {
+        section_pos[i] = image_size;
+        image_size += align_up(l.sizes[i], JIT_PAGE_SIZE);
+    }
+
+    uint8_t* image = tb_platform_heap_alloc(image_size + 1);
+    memset(image, 0, image_size);
+
+    uint8_t* base[S_MAX];
+    FOREACH_N(i, 0, S_MAX) {
+        base[i] = &image[section_pos[i]];
+    }
+
+    // the module might be JIT'd already, those entries are put back once we're done
+    size_t function_count = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        function_count++;
+    }
+
+    void** compiled_pos = tb_platform_heap_alloc((function_count + 1) * sizeof(void*));
+    size_t i = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        compiled_pos[i++] = f->compiled_pos;
+    }
+
+    DynArray(JITAbsReloc) relocs = dyn_array_create(JITAbsReloc);
+    jit_link_sections(m, &l, base, base, false, &relocs);
+
+    // the import slots are filled in at load
+    memset(&base[S_RDATA][l.slots_pos], 0, l.external_count * sizeof(void*));
+
+    size_t symbol_count = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        symbol_count += (f->output != NULL && f->super.name != NULL);
+    }
+
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
+            symbol_count += (g->storage == TB_STORAGE_DATA && g->super.name != NULL);
+        }
+    }
+
+    // the symbol positions are relative to the sections until we know where they start
+    JITSnapshotName* symbols = tb_platform_heap_alloc((symbol_count + 1) * sizeof(JITSnapshotName));
+    size_t strings_size = 0, j = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        if (f->output != NULL && f->super.name != NULL) {
+            symbols[j++] = (JITSnapshotName){ f->super.name, (uint8_t*) f->compiled_pos - image };
+            strings_size += strlen(f->super.name) + 1;
+        }
+    }
+
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_Global, g, info->globals) {
+            if (g->storage == TB_STORAGE_DATA && g->super.name != NULL) {
+                symbols[j++] = (JITSnapshotName){ g->super.name, section_pos[S_DATA] + g->pos };
+                strings_size += strlen(g->super.name) + 1;
+            }
+        }
+
+        pool_for(TB_External, ext, info->externals) {
+            strings_size += strlen(ext->super.name) + 1;
+        }
+    }
+    qsort(symbols, symbol_count, sizeof(JITSnapshotName), jit_snapshot_name_cmp);
+
+    i = 0;
+    TB_FOR_FUNCTIONS(f, m) {
+        f->compiled_pos = compiled_pos[i++];
+    }
+    tb_platform_heap_free(compiled_pos);
+
+    size_t reloc_count = dyn_array_length(relocs);
+    JITSnapshotHeader h = {
+        .magic = JIT_SNAPSHOT_MAGIC,
+        .format = JIT_SNAPSHOT_FORMAT,
+        .version = (TB_VERSION_MAJOR << 16) | (TB_VERSION_MINOR << 8) | TB_VERSION_PATCH,
+        .arch = m->target_arch,
+        .symbol_count = symbol_count,
+        .import_count = l.external_count,
+        .reloc_count = reloc_count,
+    };
+    h.symbols_pos = sizeof(JITSnapshotHeader);
+    h.imports_pos = h.symbols_pos + (symbol_count * sizeof(JITSnapshotSymbol));
+    h.relocs_pos = h.imports_pos + (l.external_count * sizeof(uint64_t));
+    h.strings_pos = h.relocs_pos + (reloc_count * sizeof(JITSnapshotReloc));
+    h.strings_size = strings_size;
+
+    size_t sections_start = align_up(h.strings_pos + strings_size, JIT_PAGE_SIZE);
+    FOREACH_N(k, 0, S_MAX) {
+        h.section_pos[k] = sections_start + section_pos[k];
+        h.section_size[k] = l.sizes[k];
+    }
+
+    TB_Emitter o = { 0 };
+    tb_outs(&o, sizeof(h), &h);
+
+    size_t string_pos = 0;
+    FOREACH_N(k, 0, symbol_count) {
+        JITSnapshotSymbol sym = { string_pos, sections_start + symbols[k].pos };
+        tb_outs(&o, sizeof(sym), &sym);
+        string_pos += strlen(symbols[k].name) + 1;
+    }
+
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
+            tb_out8b(&o, string_pos);
+            string_pos += strlen(ext->super.name) + 1;
+        }
+    }
+
+    // the addresses into the image become positions in the file
+    dyn_array_for(k, relocs) {
+        uint8_t* loc = relocs[k].loc;
+        if (relocs[k].import == JIT_RELOC_BASE) {
+            uint64_t addr;
+            memcpy(&addr, loc, sizeof(addr));
+            addr = (addr - (uintptr_t) image) + sections_start;
+            memcpy(loc, &addr, sizeof(addr));
+        }
+
+        JITSnapshotReloc r = { relocs[k].import, 0, sections_start + (loc - image) };
+        tb_outs(&o, sizeof(r), &r);
+    }
+
+    FOREACH_N(k, 0, symbol_count) {
+        tb_outs(&o, strlen(symbols[k].name) + 1, symbols[k].name);
+    }
+
+    TB_FOR_THREAD_INFO(info, m) {
+        pool_for(TB_External, ext, info->externals) {
+            tb_outs(&o, strlen(ext->super.name) + 1, ext->super.name);
+        }
+    }
+    tb_out_zero(&o, sections_start - o.count);
+
+    // written next to it & renamed into place, whoever has the old one mapped keeps it
+    char temp_path[FILENAME_MAX];
+    bool written = false;
+    if (snprintf(temp_path, FILENAME_MAX, "%s.%d.tmp", path, tb_platform_process_id()) < FILENAME_MAX) {
+        FILE* file = fopen(temp_path, "wb");
+        if (file != NULL) {
+            written = fwrite(o.data, 1, o.count, file) == o.count;
+            if (written && image_size > 0) {
+                written = fwrite(image, 1, image_size, file) == image_size;
+            }
+
+            if (fclose(file) != 0) written = false;
+            if (!written || !tb_platform_replace_file(temp_path, path)) {
+                remove(temp_path);
+                written = false;
+            }
+        }
+    }
+
+    dyn_array_destroy(relocs);
+    tb_platform_heap_free(symbols);
+    tb_platform_heap_free(image);
+    tb_platform_heap_free(o.data);
+    return written;
+}
+
+static bool jit_snapshot_in_file(uint64_t pos, uint64_t size, size_t file_size) {
+    return pos <= file_size && size <= file_size - pos;
+}
+
+static bool jit_snapshot_check(const uint8_t* image, size_t size) {
+    #if !defined(TB_HOST_X86_64)
+    return false;
+    #endif
+
+    const JITSnapshotHeader* h = (const JITSnapshotHeader*) image;
+    if (size < sizeof(JITSnapshotHeader) || h->magic != JIT_SNAPSHOT_MAGIC || h->format != JIT_SNAPSHOT_FORMAT) {
+        return false;
+    }
+
+    if (h->version != ((TB_VERSION_MAJOR << 16) | (TB_VERSION_MINOR << 8) | TB_VERSION_PATCH) || h->arch != TB_ARCH_X86_64) {
+        return false;
+    }
+
+    // everything we read has to be in the file and every name has to end in it
+    if (!jit_snapshot_in_file(h->symbols_pos, h->symbol_count * sizeof(JITSnapshotSymbol), size) ||
+        !jit_snapshot_in_file(h->imports_pos, h->import_count * sizeof(uint64_t), size) ||
+        h->reloc_count > size || !jit_snapshot_in_file(h->relocs_pos, h->reloc_count * sizeof(JITSnapshotReloc), size) ||
+        !jit_snapshot_in_file(h->strings_pos, h->strings_size, size) ||
+        h->strings_size == 0 || image[h->strings_pos + h->strings_size - 1] != 0) {
+        return false;
+    }
+
+    FOREACH_N(i, 0, S_MAX) {
+        if ((h->section_pos[i] % JIT_PAGE_SIZE) != 0 || !jit_snapshot_in_file(h->section_pos[i], align_up(h->section_size[i], JIT_PAGE_SIZE), size)) {
+            return false;
+        }
+    }
+
+    const JITSnapshotSymbol* symbols = (const JITSnapshotSymbol*) &image[h->symbols_pos];
+    FOREACH_N(i, 0, h->symbol_count) {
+        if (symbols[i].name >= h->strings_size || symbols[i].pos >= size) return false;
+    }
+
+    const uint64_t* imports = (const uint64_t*) &image[h->imports_pos];
+    FOREACH_N(i, 0, h->import_count) {
+        if (imports[i] >= h->strings_size) return false;
+    }
+
+    const JITSnapshotReloc* relocs = (const JITSnapshotReloc*) &image[h->relocs_pos];
+    FOREACH_N(i, 0, h->reloc_count) {
+        if (!jit_snapshot_in_file(relocs[i].pos, sizeof(uint64_t), size)) return false;
+        if (relocs[i].import != JIT_RELOC_BASE && relocs[i].import >= h->import_count) return false;
+    }
+
+    return true;
+}
+
+TB_API TB_JITSnapshot* tb_jit_snapshot_load(const char* path, TB_JITResolver* resolve, void* user_data) {
+    size_t size;
+    uint8_t* image = tb_platform_map_file(path, &size);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    if (!jit_snapshot_check(image, size)) {
+        tb_platform_unmap_file(image, size);
+        return NULL;
+    }
+
+    const JITSnapshotHeader* h = (const JITSnapshotHeader*) image;
+    const char* strings = (const char*) &image[h->strings_pos];
+    const uint64_t* imports = (const uint64_t*) &image[h->imports_pos];
+
+    void** addresses = tb_platform_heap_alloc((h->import_count + 1) * sizeof(void*));
+    FOREACH_N(i, 0, h->import_count) {
+        const char* name = &strings[imports[i]];
+        addresses[i] = resolve ? resolve(user_data, name) : NULL;
+
+        if (addresses[i] == NULL) {
+            fprintf(stderr, "TB warning: external '%s' couldn't be resolved, calling it will crash.\n", name);
+        }
+    }
+
+    // the relocations are the only pages we write to (besides the data)
+    const JITSnapshotReloc* relocs = (const JITSnapshotReloc*) &image[h->relocs_pos];
+    FOREACH_N(i, 0, h->reloc_count) {
+        uint32_t import = relocs[i].import;
+        jit_patch_abs64(&image[relocs[i].pos], import == JIT_RELOC_BASE ? (uintptr_t) image : (uintptr_t) addresses[import]);
+    }
+    tb_platform_heap_free(addresses);
+
+    bool ok = tb_platform_vprotect(image, h->section_pos[0], TB_PAGE_READONLY);
+    FOREACH_N(i, 0, S_MAX) {
+        if (h->section_size[i] > 0) {
+            ok &= tb_platform_vprotect(&image[h->section_pos[i]], align_up(h->section_size[i], JIT_PAGE_SIZE), jit_section_protect[i]);
+        }
+    }
+
+    if (!ok) {
+        tb_platform_unmap_file(image, size);
+        return NULL;
+    }
+
+    TB_JITSnapshot* snap = tb_platform_heap_alloc(sizeof(TB_JITSnapshot));
+    *snap = (TB_JITSnapshot){ image, size };
+    return snap;
+}
+
+TB_API void* tb_jit_snapshot_get_symbol(TB_JITSnapshot* snap, const char* name) {
+    const JITSnapshotHeader* h = (const JITSnapshotHeader*) snap->image;
+    const JITSnapshotSymbol* symbols = (const JITSnapshotSymbol*) &snap->image[h->symbols_pos];
+    const char* strings = (const char*) &snap->image[h->strings_pos];
+
+    size_t lo = 0, hi = h->symbol_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, &strings[symbols[mid].name]);
+
+        if (cmp == 0) return &snap->image[symbols[mid].pos];
+        else if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+TB_API void* tb_jit_snapshot_get_tls_template(TB_JITSnapshot* snap, size_t* out_size) {
+    const JITSnapshotHeader* h = (const JITSnapshotHeader*) snap->image;
+    *out_size = h->section_size[S_TLS];
+    return &snap->image[h->section_pos[S_TLS]];
+}
+
+TB_API void tb_jit_snapshot_unload(TB_JITSnapshot* snap) {
+    tb_platform_unmap_file(snap->image, snap->size);
+    tb_platform_heap_free(snap);
+}
@@ -104,7 +104,7 @@ static bool end_lua_pass(lua_State* L, int arg_count) {
 #endif
 
 #define TB_DEBUG_DIFF_TOOL 0
-static bool schedule_function_level_opts(TB_Module* m, size_t pass_count, const TB_Pass passes[]) {
+static bool schedule_function_level_opts(TB_Function* f, size_t pass_count, const TB_Pass passes[]) {
     bool changes = false;
 
     #if TB_DEBUG_DIFF_TOOL
@@ -115,113 +115,122 @@ static bool schedule_function_level_opts(TB_Module* m, size_t pass_count, const
     };
     #endif
 
-    TB_FOR_FUNCTIONS(f, m) {
-        // printf("ORIGINAL\n");
-        // tb_function_print(f, tb_default_print_callback, stdout, false);
-        // printf("\n\n");
+    // printf("ORIGINAL\n");
+    // tb_function_print(f, tb_default_print_callback, stdout, false);
+    // printf("\n\n");
 
-        if (tb_function_validate(f) > 0) {
-            fprintf(stderr, "Validator failed on %s on original IR\n", f->super.name);
-            abort();
-        }
+    if (tb_function_validate(f) > 0) {
+        fprintf(stderr, "Validator failed on %s on original IR\n", f->super.name);
+        abort();
+    }
 
-        #if TB_DEBUG_DIFF_TOOL
-        tb_function_print(f, print_to_buffer, buffers[buffer_num], false);
-        buffer_num = 1;
-        #endif
+    #if TB_DEBUG_DIFF_TOOL
+    tb_function_print(f, print_to_buffer, buffers[buffer_num], false);
+    buffer_num = 1;
+    #endif
 
-        FOREACH_N(j, 0, pass_count) {
-            switch (passes[j].mode) {
-                case TB_BASIC_BLOCK_PASS: {
-                    TB_FOR_BASIC_BLOCK(bb, f) {
-                        if (passes[j].l_state != NULL) {
-                            #ifdef TB_USE_LUAJIT
-                            lua_State* L = begin_lua_pass(passes[j].l_state);
-                            lua_pushlightuserdata(L, f);
-                            lua_pushinteger(L, bb);
-                            changes |= end_lua_pass(L, 2);
-                            #else
-                            tb_panic("Not compiled with luajit support");
-                            #endif
-                        } else {
-                            changes |= passes[j].bb_run(f, bb);
-                        }
+    FOREACH_N(j, 0, pass_count) {
+        bool pass_changes = false;
+
+        switch (passes[j].mode) {
+            case TB_BASIC_BLOCK_PASS: {
+                TB_FOR_BASIC_BLOCK(bb, f) {
+                    if (passes[j].l_state != NULL) {
+                        #ifdef TB_USE_LUAJIT
+                        lua_State* L = begin_lua_pass(passes[j].l_state);
+                        lua_pushlightuserdata(L, f);
+                        lua_pushinteger(L, bb);
+                        pass_changes |= end_lua_pass(L, 2);
+                        #else
+                        tb_panic("Not compiled with luajit support");
+                        #endif
+                    } else {
+                        pass_changes |= passes[j].bb_run(f, bb);
                     }
-                    break;
                 }
+                break;
+            }
 
-                case TB_LOOP_PASS: {
-                    // We probably want a function to get all this info together
-                    TB_TemporaryStorage* tls = tb_tls_allocate();
-                    TB_Predeccesors preds = tb_get_temp_predeccesors(f, tls);
-
-                    TB_Label* doms = tb_tls_push(tls, f->bb_count * sizeof(TB_Label));
-                    tb_get_dominators(f, preds, doms);
-
-                    // probably don't wanna do this using heap allocations
-                    TB_LoopInfo loops = tb_get_loop_info(f, preds, doms);
-
-                    FOREACH_N(k, 0, loops.count) {
-                        const TB_Loop* l = &loops.loops[k];
-
-                        if (passes[j].l_state != NULL) {
-                            #ifdef TB_USE_LUAJIT
-                            lua_State* L = begin_lua_pass(passes[j].l_state);
-                            lua_pushlightuserdata(L, f);
-                            lua_pushlightuserdata(L, (void*) l);
-                            changes |= end_lua_pass(L, 2);
-                            #else
-                            tb_panic("Not compiled with luajit support");
-                            #endif
-                        } else {
-                            changes |= passes[j].loop_run(f, l);
-                        }
+            case TB_LOOP_PASS: {
+                // we take the loop info out of the cache while we walk it, that way the
+                // pass can't free it out from under us by editing the CFG. if it stays
+                // valid it's handed back afterwards.
+                TB_LoopInfo loops = *tb_function_get_cached_loops(f);
+                f->cached_loops = (TB_LoopInfo){ 0 };
+                f->analysis_valid &= ~TB_ANALYSIS_LOOPS;
+
+                FOREACH_N(k, 0, loops.count) {
+                    const TB_Loop* l = &loops.loops[k];
+
+                    if (passes[j].l_state != NULL) {
+                        #ifdef TB_USE_LUAJIT
+                        lua_State* L = begin_lua_pass(passes[j].l_state);
+                        lua_pushlightuserdata(L, f);
+                        lua_pushlightuserdata(L, (void*) l);
+                        pass_changes |= end_lua_pass(L, 2);
+                        #else
+                        tb_panic("Not compiled with luajit support");
+                        #endif
+                    } else {
+                        pass_changes |= passes[j].loop_run(f, l);
                     }
-
-                    tb_free_loop_info(loops);
-                    break;
                 }
 
-                case TB_FUNCTION_PASS:
-                if (passes[j].l_state != NULL) {
-                    #ifdef TB_USE_LUAJIT
-                    lua_State* L = begin_lua_pass(passes[j].l_state);
-                    lua_pushlightuserdata(L, f);
-                    changes |= end_lua_pass(L, 1);
-                    #else
-                    tb_panic("Not compiled with luajit support");
-                    #endif
+                bool loops_valid = (f->analysis_valid & TB_ANALYSIS_DOMS) &&
+                    (!pass_changes || (passes[j].preserves & TB_ANALYSIS_LOOPS));
+                if (loops_valid) {
+                    f->cached_loops = loops;
+                    f->analysis_valid |= TB_ANALYSIS_LOOPS;
                 } else {
-                    changes |= passes[j].func_run(f);
-
-                    // printf("%s\n", passes[j].name);
-                    // tb_function_print(f, tb_default_print_callback, stdout, false);
-                    // printf("\n\n");
-
-                    if (tb_function_validate(f) > 0) {
-                        fprintf(stderr, "Validator failed on %s after %s\n", f->super.name, passes[j].name);
-                        abort();
-                    }
+                    tb_free_loop_info(loops);
                 }
                 break;
-
-                default: tb_unreachable();
             }
 
-            // tb_function_print(f, tb_default_print_callback, stdout, false);
+            case TB_FUNCTION_PASS:
+            if (passes[j].l_state != NULL) {
+                #ifdef TB_USE_LUAJIT
+                lua_State* L = begin_lua_pass(passes[j].l_state);
+                lua_pushlightuserdata(L, f);
+                pass_changes |= end_lua_pass(L, 1);
+                #else
+                tb_panic("Not compiled with luajit support");
+                #endif
+            } else {
+                pass_changes |= passes[j].func_run(f);
+
+                // printf("%s\n", passes[j].name);
+                // tb_function_print(f, tb_default_print_callback, stdout, false);
+                // printf("\n\n");
+
+                if (tb_function_validate(f) > 0) {
+                    fprintf(stderr, "Validator failed on %s after %s\n", f->super.name, passes[j].name);
+                    abort();
+                }
+            }
+            break;
 
-            #if TB_DEBUG_DIFF_TOOL
-            tb_function_print(f, print_to_buffer, buffers[buffer_num], false);
-            int next = (buffer_num + 1) % 2;
-            print_diff(passes[j].name, buffers[next], buffers[buffer_num]);
-            buffer_num = next;
-            #endif
+            default: tb_unreachable();
+        }
 
-            // pause
-            // printf("Was just %s\n", passes[j].name);
-            // getchar();
-            // printf("==================================================\n\n\n");
+        if (pass_changes) {
+            tb_function_invalidate_analyses(f, passes[j].preserves);
+            changes = true;
         }
+
+        // tb_function_print(f, tb_default_print_callback, stdout, false);
+
+        #if TB_DEBUG_DIFF_TOOL
+        tb_function_print(f, print_to_buffer, buffers[buffer_num], false);
+        int next = (buffer_num + 1) % 2;
+        print_diff(passes[j].name, buffers[next], buffers[buffer_num]);
+        buffer_num = next;
+        #endif
+
+        // pause
+        // printf("Was just %s\n", passes[j].name);
+        // getchar();
+        // printf("==================================================\n\n\n");
     }
 
     #if TB_DEBUG_DIFF_TOOL
@@ -232,6 +241,106 @@ static bool schedule_function_level_opts(TB_Module* m, size_t pass_count, const
     return changes;
 }
 
+typedef struct {
+    size_t pass_count;
+    const TB_Pass* passes;
+
+    size_t function_count;
+    TB_Function** functions;
+
+    // index of the next function to be picked up by a worker
+    size_t next;
+} FunctionLevelWork;
+
+typedef struct {
+    FunctionLevelWork* work;
+    bool changes;
+} FunctionLevelWorker;
+
+static void function_level_worker(void* arg) {
+    FunctionLevelWorker* worker = arg;
+    FunctionLevelWork* work = worker->work;
+
+    // function passes can't affect anything outside of the function they're
+    // run on so the order the functions are picked up in doesn't matter, the
+    // results are the same as the serial schedule.
+    for (;;) {
+        size_t i = tb_atomic_size_add(&work->next, 1);
+        if (i >= work->function_count) break;
+
+        worker->changes |= schedule_function_level_opts(work->functions[i], work->pass_count, work->passes);
+    }
+}
+
+static void function_level_worker_thread(void* arg) {
+    function_level_worker(arg);
+    tb_free_thread_resources();
+}
+
+static bool schedule_function_level_opts_mt(TB_Module* m, size_t pass_count, const TB_Pass passes[], int thread_count) {
+    // the lua states aren't thread safe so we just don't bother with threads
+    FOREACH_N(i, 0, pass_count) {
+        if (passes[i].l_state != NULL) {
+            thread_count = 1;
+            break;
+        }
+    }
+
+    if (thread_count <= 1) {
+        bool changes = false;
+        TB_FOR_FUNCTIONS(f, m) {
+            changes |= schedule_function_level_opts(f, pass_count, passes);
+        }
+        return changes;
+    }
+
+    size_t function_count = 0;
+    TB_FOR_FUNCTIONS(f, m) function_count++;
+
+    if (function_count == 0) return false;
+
+    FunctionLevelWork work = {
+        .pass_count = pass_count, .passes = passes,
+        .function_count = function_count,
+        .functions = tb_platform_heap_alloc(function_count * sizeof(TB_Function*)),
+    };
+
+    size_t j = 0;
+    TB_FOR_FUNCTIONS(f, m) work.functions[j++] = f;
+
+    if (thread_count > (int) function_count) thread_count = function_count;
+    if (thread_count < 1) thread_count = 1;
+
+    // the calling thread is worker 0
+    FunctionLevelWorker* workers = tb_platform_heap_alloc(thread_count * sizeof(FunctionLevelWorker));
+    TB_Thread** threads = tb_platform_heap_alloc(thread_count * sizeof(TB_Thread*));
+    FOREACH_N(i, 0, thread_count) {
+        workers[i] = (FunctionLevelWorker){ &work };
+        threads[i] = NULL;
+    }
+
+    FOREACH_N(i, 1, thread_count) {
+        // if we can't make a thread the rest of the workers will just pick up the slack
+        threads[i] = tb_platform_thread_create(function_level_worker_thread, &workers[i]);
+    }
+    function_level_worker(&workers[0]);
+
+    bool changes = false;
+    FOREACH_N(i, 0, thread_count) {
+        if (threads[i] != NULL) tb_platform_thread_join(threads[i]);
+        changes |= workers[i].changes;
+    }
+
+    tb_platform_heap_free(threads);
+    tb_platform_heap_free(workers);
+    tb_platform_heap_free(work.functions);
+    return changes;
+}
+
+bool tb__function_optimize(TB_Function* f, size_t pass_count, const TB_Pass passes[]) {
+    return schedule_function_level_opts(f, pass_count, passes);
+}
+
 static bool schedule_module_level_opt(TB_Module* m, const TB_Pass* pass) {
     // this is the only module level mode we have rn
     if (pass->mode != TB_MODULE_PASS) {
@@ -251,21 +360,21 @@ static bool schedule_module_level_opt(TB_Module* m, const TB_Pass* pass) {
     }
 }
 
-TB_API bool tb_module_optimize(TB_Module* m, size_t pass_count, const TB_Pass passes[]) {
+TB_API bool tb_module_optimize(TB_Module* m, size_t pass_count, const TB_Pass passes[], int thread_count) {
     bool changes = false;
 
     size_t i = 0;
     while (i < pass_count) {
         // anything below or equal to function-level passes can be trivially
-        // parallel and thus we handle this as a
+        // parallel and thus we handle this as a worker pool which splits up
+        // the functions
         size_t sync = i;
         for (; sync < pass_count; sync++) {
             if (passes[sync].mode > TB_FUNCTION_PASS) break;
         }
 
-        // TODO(NeGate): convert this into a trivial parallel dispatch
         if (sync != i) {
-            changes |= schedule_function_level_opts(m, sync - i, &passes[i]);
+            changes |= schedule_function_level_opts_mt(m, sync - i, &passes[i], thread_count);
             i = sync;
         }
 
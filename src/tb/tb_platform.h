@@ -19,6 +19,19 @@ void* tb_platform_valloc(size_t size);
 void  tb_platform_vfree(void* ptr, size_t size);
 bool tb_platform_vprotect(void* ptr, size_t size, TB_MemProtect prot);
 
+// reserves address space without backing it, pieces of it are made usable
+// (read-write) with tb_platform_vcommit and the whole thing is given back
+// with tb_platform_vfree.
+void* tb_platform_vreserve(size_t size);
+bool tb_platform_vcommit(void* ptr, size_t size);
+
+// maps the same memory twice, *out_rw is always read-write while the returned
+// view starts inaccessible and gets protected page by page with tb_platform_vprotect.
+// The JIT writes code through the first and runs it from the second so nothing
+// is ever writable & executable at the same address.
+void* tb_platform_valloc_dual(size_t size, void** out_rw);
+void tb_platform_vfree_dual(void* ptr, void* rw, size_t size);
+
 ////////////////////////////////
 // General Heap allocator
 ////////////////////////////////
@@ -29,19 +42,76 @@ void* tb_platform_heap_realloc(void* ptr, size_t size);
 void  tb_platform_heap_free(void* ptr);
 
 ////////////////////////////////
-// String arena
+// Threads
+////////////////////////////////
+typedef struct TB_Thread TB_Thread;
+typedef void TB_ThreadFunc(void* arg);
+
+// These are only used for the internal worker pools (parallel optimizer and
+// such), the threads are expected to be joined before the caller returns.
+TB_Thread* tb_platform_thread_create(TB_ThreadFunc* func, void* arg);
+void tb_platform_thread_join(TB_Thread* t);
+
+////////////////////////////////
+// Profiler support
 ////////////////////////////////
-char* tb_platform_string_alloc(const char* str);
-void  tb_platform_string_free();
+// used when the JIT tells perf about its code (see tb_module_set_jit_profiling), the
+// timestamps are CLOCK_MONOTONIC in nanoseconds to match perf record -k mono.
+int tb_platform_process_id(void);
+int tb_platform_thread_id(void);
+uint64_t tb_platform_perf_timestamp(void);
+
+// perf record only picks up a jitdump if the process maps it as executable, the
+// mapping is what ends up in the trace. Returns NULL if the platform can't.
+void* tb_platform_jitdump_marker(FILE* file, size_t size);
+void tb_platform_jitdump_marker_free(void* ptr, size_t size);
+
+////////////////////////////////
+// File system
+////////////////////////////////
+// used by the code cache (see tb_code_cache_open). make_dir is fine with the
+// directory already existing and replace_file atomically puts from where to
+// was (replacing it) so readers only ever see one or the other.
+bool tb_platform_make_dir(const char* path);
+bool tb_platform_replace_file(const char* from, const char* to);
+void tb_platform_touch_file(const char* path);
+
+// calls func on every regular file in the directory, mtime is in seconds and
+// only meant to be compared against other mtimes.
+typedef void TB_ListDirFunc(void* user_data, const char* name, uint64_t size, uint64_t mtime);
+bool tb_platform_list_dir(const char* path, TB_ListDirFunc* func, void* user_data);
+
+// a private (copy-on-write) read-write mapping of the whole file, it can be
+// protected with tb_platform_vprotect once it's been fixed up. Returns NULL if
+// the file can't be read.
+void* tb_platform_map_file(const char* path, size_t* out_size);
+void tb_platform_unmap_file(void* ptr, size_t size);
+
+// the exporters stream their files through these, a gather write puts the pieces
+// back to back after whatever's been written so far.
+typedef struct {
+    const void* data;
+    size_t length;
+} TB_IOVec;
+
+typedef struct TB_FileHandle TB_FileHandle;
+TB_FileHandle* tb_platform_file_create(const char* path);
+bool tb_platform_file_write_gather(TB_FileHandle* file, size_t count, const TB_IOVec* vecs);
+bool tb_platform_file_close(TB_FileHandle* file);
 
 ////////////////////////////////
 // Persistent arena allocator
 ////////////////////////////////
-void tb_platform_arena_init();
+typedef struct TB_Arena TB_Arena;
+
+// each thread gets one of these per module, everything allocated
+// from it lives until the module is destroyed.
+TB_Arena* tb_platform_arena_create(void);
 
 // this persistent arena allocator is used all of the backend
-// worker threads to store data until the end of compilation.
-void* tb_platform_arena_alloc(size_t size);
+// worker threads to store data until the end of compilation. It's
+// not thread-safe, only the owning thread may allocate from it.
+void* tb_platform_arena_alloc(TB_Arena* arena, size_t size);
 
 // NOTE(NeGate): Free is supposed to free all allocations.
-void tb_platform_arena_free(void);
+void tb_platform_arena_destroy(TB_Arena* arena);
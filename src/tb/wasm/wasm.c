@@ -1,9 +1,6 @@
 #include "../codegen/emitter.h"
 #include "../tb_internal.h"
 
-// used to add patches since there's separate arrays per thread
-static thread_local size_t s_local_thread_id;
-
 typedef struct WasmVal {
     int users_left;  // each time we use it, we decrement. it starts with all the direct users
     int local_slot;  // -1 when invalid
@@ -64,9 +61,7 @@ void push_val(WasmCtx* restrict ctx, TB_Reg r) {
 
 }
 
-TB_FunctionOutput wasm_fast_compile_function(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity, size_t local_thread_id) {
-    s_local_thread_id = local_thread_id;
-
+TB_FunctionOutput wasm_fast_compile_function(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity) {
     TB_TemporaryStorage* tls = tb_tls_allocate();
     int* use_count = tb_tls_push(tls, f->node_count * sizeof(WasmVal));
     WasmCtx ctx = { .vals = (WasmVal*) use_count };
@@ -6,9 +6,6 @@
 #define X64_OLD_PATH
 #include "x64.h"
 
-// used to add patches since there's separate arrays per thread
-static thread_local size_t s_local_thread_id;
-
 #include "x64_emitter.h"
 #include "x64_proepi.h"
 #include "x64_fast.h"
@@ -23,12 +20,8 @@ static thread_local size_t s_local_thread_id;
 
 static size_t x64_emit_call_patches(TB_Module* restrict m) {
     size_t r = 0;
-    FOREACH_N(i, 0, m->max_threads) {
-        TB_SymbolPatch* patches = m->thread_info[i].symbol_patches;
-
-        dyn_array_for(j, patches) {
-            TB_SymbolPatch* patch = &patches[j];
-
+    TB_FOR_THREAD_INFO(info, m) {
+        TB_FOR_PATCHES(TB_SymbolPatch, patch, info->symbol_patches) {
             if (patch->target->tag == TB_SYMBOL_FUNCTION) {
                 TB_FunctionOutput* out_f = patch->source->output;
                 assert(out_f && "Patch cannot be applied to function with no compiled output");
@@ -680,8 +680,7 @@ static Val complex_resolve_operand(X64_ComplexCtx* restrict ctx, TB_Function* f,
     tb_todo();
 }
 
-TB_FunctionOutput x64_complex_compile_function(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity, size_t local_thread_id) {
-    s_local_thread_id = local_thread_id;
+TB_FunctionOutput x64_complex_compile_function(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity) {
 
     TB_TemporaryStorage* tls = tb_tls_allocate();
 
@@ -742,7 +741,7 @@ TB_FunctionOutput x64_complex_compile_function(TB_Function* restrict f, const TB
         ctx->is_sysv = (f->super.module->target_abi == TB_ABI_SYSTEMV);
 
         f->line_count = 0;
-        f->lines = tb_platform_arena_alloc(tally.line_info_count * sizeof(TB_Line));
+        f->lines = tb__arena_alloc(f->super.module, tally.line_info_count * sizeof(TB_Line));
     }
 
     ////////////////////////////////
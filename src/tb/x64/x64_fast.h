@@ -380,7 +380,7 @@ static Val fast_eval(X64_FastCtx* ctx, TB_Function* f, TB_Reg r) {
 
                 if (dst.gpr >= 8) EMIT1(&ctx->emit, 0x41);
                 EMIT1(&ctx->emit, 0x8B), EMIT1(&ctx->emit, ((dst.gpr & 7) << 3) | RBP), EMIT4(&ctx->emit, 0x00);
-                tb_emit_symbol_patch(f->super.module, f, m->tls_index_extern, GET_CODE_POS(&ctx->emit) - 4, false, s_local_thread_id);
+                tb_emit_symbol_patch(f->super.module, f, m->tls_index_extern, GET_CODE_POS(&ctx->emit) - 4, false);
 
                 // mov t1, qword gs:[58h]
                 Val t1 = val_gpr(TB_TYPE_PTR, fast_alloc_gpr(ctx, f, TB_TEMP_REG));
@@ -404,7 +404,7 @@ static Val fast_eval(X64_FastCtx* ctx, TB_Function* f, TB_Reg r) {
                     EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT_DISP32, dst.gpr, t1.gpr));
                 }
                 EMIT4(&ctx->emit, 0);
-                tb_emit_symbol_patch(f->super.module, f, (TB_Symbol*) n->global.value, GET_CODE_POS(&ctx->emit) - 4, false, s_local_thread_id);
+                tb_emit_symbol_patch(f->super.module, f, (TB_Symbol*) n->global.value, GET_CODE_POS(&ctx->emit) - 4, false);
 
                 fast_def_gpr(ctx, f, r, dst.gpr, TB_TYPE_PTR);
                 fast_kill_temp_gpr(ctx, f, t1.gpr);
@@ -774,16 +774,18 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
                 fast_def_gpr(ctx, f, r, dst_gpr, TB_TYPE_PTR);
 
                 // On SystemV it's a mov because of the GOT,
-                // on Windows it's a lea.
+                // on Windows it's a lea. The JIT doesn't have a
+                // GOT, only externals go through a slot.
                 //
                 // mov dst, [rip + some_disp]
                 // lea
+                bool is_load = f->super.module->is_jit ? n->sym.value->tag == TB_SYMBOL_EXTERNAL : ctx->is_sysv;
                 EMIT1(&ctx->emit, rex(true, dst_gpr, RBP, 0));
-                EMIT1(&ctx->emit, ctx->is_sysv ? 0x8B : 0x8D);
+                EMIT1(&ctx->emit, is_load ? 0x8B : 0x8D);
                 EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT, dst_gpr, RBP));
                 EMIT4(&ctx->emit, 0);
 
-                tb_emit_symbol_patch(f->super.module, f, n->sym.value, GET_CODE_POS(&ctx->emit) - 4, false, s_local_thread_id);
+                tb_emit_symbol_patch(f->super.module, f, n->sym.value, GET_CODE_POS(&ctx->emit) - 4, false);
                 break;
             }
 
@@ -826,13 +828,12 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
                     EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT, dst_xmm, RBP));
                     EMIT4(&ctx->emit, 0);
 
-                    uint32_t* rdata_payload = tb_platform_arena_alloc(sizeof(uint32_t));
+                    uint32_t* rdata_payload = tb__arena_alloc(f->super.module, sizeof(uint32_t));
                     *rdata_payload = imm;
 
                     uint32_t pos = tb_emit_const_patch(
                         f->super.module, f, GET_CODE_POS(&ctx->emit) - 4,
-                        rdata_payload, sizeof(uint32_t),
-                        s_local_thread_id
+                        rdata_payload, sizeof(uint32_t)
                     );
                     PATCH4(&ctx->emit, GET_CODE_POS(&ctx->emit) - 4, pos);
                 }
@@ -863,13 +864,12 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
                     EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT, dst_xmm, RBP));
                     EMIT4(&ctx->emit, 0);
 
-                    uint64_t* rdata_payload = tb_platform_arena_alloc(sizeof(uint64_t));
+                    uint64_t* rdata_payload = tb__arena_alloc(f->super.module, sizeof(uint64_t));
                     *rdata_payload = imm;
 
                     uint32_t pos = tb_emit_const_patch(
                         f->super.module, f, GET_CODE_POS(&ctx->emit) - 4,
-                        rdata_payload, sizeof(uint64_t),
-                        s_local_thread_id
+                        rdata_payload, sizeof(uint64_t)
                     );
                     PATCH4(&ctx->emit, GET_CODE_POS(&ctx->emit) - 4, pos);
                 }
@@ -886,7 +886,7 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
                 EMIT1(&ctx->emit, 0x8D);
                 EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT, dst_gpr, RBP));
 
-                uint32_t disp = tb_emit_const_patch(f->super.module, f, GET_CODE_POS(&ctx->emit), str, len, s_local_thread_id);
+                uint32_t disp = tb_emit_const_patch(f->super.module, f, GET_CODE_POS(&ctx->emit), str, len);
                 EMIT4(&ctx->emit, disp);
                 break;
             }
@@ -1784,12 +1784,12 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
 
                     void* payload = NULL;
                     if (dt.data == TB_FLT_64) {
-                        uint64_t* rdata_payload = tb_platform_arena_alloc(2 * sizeof(uint64_t));
+                        uint64_t* rdata_payload = tb__arena_alloc(f->super.module, 2 * sizeof(uint64_t));
                         rdata_payload[0] = (1ull << 63ull);
                         rdata_payload[1] = (1ull << 63ull);
                         payload = rdata_payload;
                     } else {
-                        uint32_t* rdata_payload = tb_platform_arena_alloc(4 * sizeof(uint32_t));
+                        uint32_t* rdata_payload = tb__arena_alloc(f->super.module, 4 * sizeof(uint32_t));
                         rdata_payload[0] = (1ull << 31ull);
                         rdata_payload[1] = (1ull << 31ull);
                         rdata_payload[2] = (1ull << 31ull);
@@ -1797,7 +1797,7 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
                         payload = rdata_payload;
                     }
 
-                    uint32_t disp = tb_emit_const_patch(f->super.module, f, GET_CODE_POS(&ctx->emit), payload, 2 * sizeof(uint64_t), s_local_thread_id);
+                    uint32_t disp = tb_emit_const_patch(f->super.module, f, GET_CODE_POS(&ctx->emit), payload, 2 * sizeof(uint64_t));
                     EMIT4(&ctx->emit, disp);
                 } else {
                     // we probably want some recycling eventually...
@@ -2002,7 +2002,7 @@ static void fast_eval_basic_block(X64_FastCtx* restrict ctx, TB_Function* f, TB_
                 // CALL instruction and patch
                 if (reg_type == TB_CALL) {
                     const TB_Symbol* target = n->call.target;
-                    tb_emit_symbol_patch(f->super.module, f, target, GET_CODE_POS(&ctx->emit) + 1, true, s_local_thread_id);
+                    tb_emit_symbol_patch(f->super.module, f, target, GET_CODE_POS(&ctx->emit) + 1, true);
 
                     // CALL rel32
                     EMIT1(&ctx->emit, 0xE8);
@@ -2398,14 +2398,13 @@ static FunctionTallySimple tally_memory_usage_simple(TB_Function* restrict f) {
 // entry point to the x64 fast isel, it's got some nice features like when the
 // temporary storage can't fit the necessary memory, it'll fallback to the heap
 // to avoid just crashing.
-TB_FunctionOutput x64_fast_compile_function(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity, size_t local_thread_id) {
+TB_FunctionOutput x64_fast_compile_function(TB_Function* restrict f, const TB_FeatureSet* features, uint8_t* out, size_t out_capacity) {
     typedef struct {
         // pos, origin is relative to the function body.
         // target is label
         uint32_t pos, origin, target;
     } JumpTablePatch;
 
-    s_local_thread_id = local_thread_id;
 
     TB_TemporaryStorage* tls = tb_tls_allocate();
     DynArray(JumpTablePatch) jump_table_patches = NULL;
@@ -2450,7 +2449,7 @@ TB_FunctionOutput x64_fast_compile_function(TB_Function* restrict f, const TB_Fe
         }
 
         f->line_count = 0;
-        f->lines = tb_platform_arena_alloc(tally.line_info_count * sizeof(TB_Line));
+        f->lines = tb__arena_alloc(f->super.module, tally.line_info_count * sizeof(TB_Line));
 
         ctx->gpr_available = 14;
         ctx->xmm_available = 16;
@@ -564,9 +564,9 @@ static void x64v2_call(Ctx* restrict ctx, TB_Function* f, TB_Reg r) {
         case TB_CALL: {
             const TB_Symbol* target = n->call.target;
             if (target->tag == TB_SYMBOL_FUNCTION) {
-                tb_emit_symbol_patch(f->super.module, f, target, GET_CODE_POS(&ctx->emit) + 1, true, s_local_thread_id);
+                tb_emit_symbol_patch(f->super.module, f, target, GET_CODE_POS(&ctx->emit) + 1, true);
             } else if (target->tag == TB_SYMBOL_EXTERNAL) {
-                tb_emit_symbol_patch(f->super.module, f, target, GET_CODE_POS(&ctx->emit) + 1, true, s_local_thread_id);
+                tb_emit_symbol_patch(f->super.module, f, target, GET_CODE_POS(&ctx->emit) + 1, true);
             } else {
                 tb_todo();
             }
@@ -656,7 +656,7 @@ static Val x64v2_eval(Ctx* restrict ctx, TB_Function* f, TB_Reg r) {
             EMIT1(&ctx->emit, 0x8D);
             EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT, dst.gpr, RBP));
 
-            uint32_t disp = tb_emit_const_patch(f->super.module, f, GET_CODE_POS(&ctx->emit), str, len, s_local_thread_id);
+            uint32_t disp = tb_emit_const_patch(f->super.module, f, GET_CODE_POS(&ctx->emit), str, len);
             EMIT4(&ctx->emit, disp);
             return dst;
         }
@@ -705,7 +705,7 @@ static Val x64v2_eval(Ctx* restrict ctx, TB_Function* f, TB_Reg r) {
 
                     if (dst.gpr >= 8) EMIT1(&ctx->emit, 0x41);
                     EMIT1(&ctx->emit, 0x8B), EMIT1(&ctx->emit, ((dst.gpr & 7) << 3) | RBP), EMIT4(&ctx->emit, 0x00);
-                    tb_emit_symbol_patch(f->super.module, f, m->tls_index_extern, GET_CODE_POS(&ctx->emit) - 4, false, s_local_thread_id);
+                    tb_emit_symbol_patch(f->super.module, f, m->tls_index_extern, GET_CODE_POS(&ctx->emit) - 4, false);
 
                     // mov t1, qword gs:[58h]
                     GAD_VAL t1 = { 0 }; // GAD_FN(alloc_reg)(ctx, f, X64_REG_CLASS_GPR, TB_TEMP_REG);
@@ -730,7 +730,7 @@ static Val x64v2_eval(Ctx* restrict ctx, TB_Function* f, TB_Reg r) {
                         EMIT1(&ctx->emit, mod_rx_rm(MOD_INDIRECT_DISP32, dst.gpr, t1.gpr));
                     }
                     EMIT4(&ctx->emit, 0);
-                    tb_emit_symbol_patch(f->super.module, f, (TB_Symbol*) n->global.value, GET_CODE_POS(&ctx->emit) - 4, false, s_local_thread_id);
+                    tb_emit_symbol_patch(f->super.module, f, (TB_Symbol*) n->global.value, GET_CODE_POS(&ctx->emit) - 4, false);
 
                     // GAD_FN(unlock_register)(ctx, f, X64_REG_CLASS_GPR, t1.gpr);
                     return dst;
@@ -1039,12 +1039,8 @@ static Val x64v2_eval(Ctx* restrict ctx, TB_Function* f, TB_Reg r) {
 
 static size_t GAD_FN(emit_call_patches)(TB_Module* restrict m) {
     size_t r = 0;
-    FOREACH_N(i, 0, m->max_threads) {
-        TB_SymbolPatch* patches = m->thread_info[i].symbol_patches;
-
-        dyn_array_for(j, patches) {
-            TB_SymbolPatch* patch = &patches[j];
-
+    TB_FOR_THREAD_INFO(info, m) {
+        TB_FOR_PATCHES(TB_SymbolPatch, patch, info->symbol_patches) {
             if (patch->target->tag == TB_SYMBOL_FUNCTION) {
                 TB_FunctionOutput* out_f = patch->source->output;
                 assert(out_f && "Patch cannot be applied to function with no compiled output");